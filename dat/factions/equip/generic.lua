@@ -4,6 +4,11 @@ include("dat/factions/equip/outfits.lua")
 -- Helper functions
 include("dat/factions/equip/helper.lua")
 
+-- Number of loadouts remembered per ship and faction. Once a loadout has been
+-- generated for a random bucket, later pilots landing in the same bucket get
+-- it directly without running the equipper. Set to 0 to always run it.
+equip_variants = 16
+
 --[[
 -- @brief Does generic pilot equipping
 --
@@ -65,6 +65,8 @@
 
 #include "naev.h"
 
+#include "SDL.h"
+
 #include <stdlib.h>
 #include <stdio.h> /* malloc realloc */
 #include <math.h>
@@ -125,6 +127,8 @@
 #define AI_SUFFIX       ".lua" /**< AI file suffix. */
 #define AI_MEM_DEF      "def" /**< Default pilot memory. */
 
+#define AI_EQUIP_VARIANTS  "equip_variants" /**< Global setting the loadouts to remember per ship and faction. */
+
 
 /*
  * all the AI profiles
@@ -133,6 +137,25 @@ static AI_Profile* profiles = NULL; /**< Array of AI_Profiles loaded. */
 static lua_State *equip_L = NULL; /**< Equipment state. */
 
 
+/**
+ * @brief Outfits an equipper gave to a ship, by slot.
+ */
+typedef struct EquipLoadout_ {
+   Ship *ship;       /**< Ship equipped. */
+   int faction;      /**< Faction of the pilot equipped. */
+   int bucket;       /**< Random bucket the loadout belongs to. */
+   int noutfits;     /**< Number of slots. */
+   Outfit **outfit;  /**< Outfit of each slot (NULL if empty). */
+   Outfit **ammo;    /**< Ammo of each slot (NULL if none). */
+   int *quantity;    /**< Amount of ammo of each slot. */
+} EquipLoadout;
+static EquipLoadout *equip_cache = NULL; /**< Loadouts remembered, array.h. */
+static unsigned int equip_hits   = 0; /**< Pilots equipped from the cache. */
+static unsigned int equip_misses = 0; /**< Pilots equipped by running Lua. */
+static double equip_luaTime      = 0.; /**< Time spent running the equippers (ms). */
+static double equip_cacheTime    = 0.; /**< Time spent applying loadouts (ms). */
+
+
 /*
  * extern pilot hacks
  */
@@ -149,6 +172,12 @@ static int ai_loadProfile( const char* filename );
 static void ai_setMemory (void);
 static void ai_create( Pilot* pilot, char *param );
 static int ai_loadEquip (void);
+static double ai_equipTicks (void);
+static int ai_equipVariants( lua_State *L );
+static EquipLoadout* ai_equipGet( Pilot *p, int bucket );
+static void ai_equipStore( Pilot *p, int bucket );
+static void ai_equipApply( Pilot *p, const EquipLoadout *l );
+static void ai_equipCacheFree (void);
 /* Task management. */
 static void ai_taskGC( Pilot* pilot );
 static Task* ai_curTask( Pilot* pilot );
@@ -680,10 +709,10 @@ static int ai_loadEquip (void)
 
    /* Make sure doesn't already exist. */
    if (equip_L != NULL)
-      lua_close(equip_L);
+      nlua_closeState(equip_L);
 
    /* Create new state. */
-   equip_L = nlua_newState();
+   equip_L = nlua_newState( filename );
    L = equip_L;
 
    /* Prepare state. */
@@ -732,7 +761,7 @@ static int ai_loadProfile( const char* filename )
    prof->name[len] = '\0';
 
    /* Create Lua. */
-   prof->L = nlua_newState();
+   prof->L = nlua_newState( filename );
    if (prof->L == NULL) {
       WARN("Unable to create a new Lua state");
       return -1;
@@ -773,7 +802,7 @@ static int ai_loadProfile( const char* filename )
             filename, lua_tostring(L,-1));
       array_erase( &profiles, prof, &prof[1] );
       free(prof->name);
-      lua_close( L );
+      nlua_closeState( L );
       free(buf);
       return -1;
    }
@@ -815,14 +844,176 @@ void ai_exit (void)
    /* Free AI profiles. */
    for (i=0; i<array_size(profiles); i++) {
       free(profiles[i].name);
-      lua_close(profiles[i].L);
+      nlua_closeState(profiles[i].L);
    }
    array_free( profiles );
 
    /* Free equipment Lua. */
    if (equip_L != NULL)
-      lua_close(equip_L);
+      nlua_closeState(equip_L);
    equip_L = NULL;
+
+   /* Free remembered loadouts. */
+   ai_equipCacheFree();
+}
+
+
+/**
+ * @brief Gets a timestamp in milliseconds for measuring the equippers.
+ */
+static double ai_equipTicks (void)
+{
+#if SDL_VERSION_ATLEAST(2,0,0)
+   return 1000. * (double)SDL_GetPerformanceCounter() /
+         (double)SDL_GetPerformanceFrequency();
+#else /* SDL_VERSION_ATLEAST(2,0,0) */
+   return (double)SDL_GetTicks();
+#endif /* SDL_VERSION_ATLEAST(2,0,0) */
+}
+
+
+/**
+ * @brief Gets how many loadouts an equipper wants remembered per ship.
+ *
+ * Equippers opt in by setting the equip_variants global. Each pilot is then
+ *  assigned a random bucket and the first loadout generated for a bucket is
+ *  reused for the following pilots with the same ship and faction.
+ *
+ *    @param L Equipper state.
+ *    @return Number of buckets or 0 if the loadouts should not be remembered.
+ */
+static int ai_equipVariants( lua_State *L )
+{
+   int n;
+
+   lua_getglobal( L, AI_EQUIP_VARIANTS );
+   n = lua_isnumber(L,-1) ? (int)lua_tonumber(L,-1) : 0;
+   lua_pop(L,1);
+   return MAX( n, 0 );
+}
+
+
+/**
+ * @brief Gets the loadout remembered for a pilot.
+ *
+ *    @param p Pilot to get loadout of.
+ *    @param bucket Random bucket of the pilot.
+ *    @return The loadout or NULL if not remembered yet.
+ */
+static EquipLoadout* ai_equipGet( Pilot *p, int bucket )
+{
+   int i;
+
+   for (i=0; i<array_size(equip_cache); i++)
+      if ((equip_cache[i].ship == p->ship) &&
+            (equip_cache[i].faction == p->faction) &&
+            (equip_cache[i].bucket == bucket))
+         return &equip_cache[i];
+   return NULL;
+}
+
+
+/**
+ * @brief Remembers the loadout a pilot was just equipped with.
+ *
+ *    @param p Pilot to remember loadout of.
+ *    @param bucket Random bucket of the pilot.
+ */
+static void ai_equipStore( Pilot *p, int bucket )
+{
+   int i;
+   EquipLoadout *l;
+   PilotOutfitSlot *s;
+
+   if (equip_cache == NULL)
+      equip_cache = array_create( EquipLoadout );
+
+   l = &array_grow( &equip_cache );
+   l->ship     = p->ship;
+   l->faction  = p->faction;
+   l->bucket   = bucket;
+   l->noutfits = p->noutfits;
+   l->outfit   = malloc( p->noutfits * sizeof(Outfit*) );
+   l->ammo     = malloc( p->noutfits * sizeof(Outfit*) );
+   l->quantity = malloc( p->noutfits * sizeof(int) );
+   for (i=0; i<p->noutfits; i++) {
+      s = p->outfits[i];
+      l->outfit[i]   = s->outfit;
+      l->ammo[i]     = NULL;
+      l->quantity[i] = 0;
+      if ((s->outfit != NULL) &&
+            (outfit_isLauncher(s->outfit) || outfit_isFighterBay(s->outfit)) &&
+            (s->u.ammo.outfit != NULL) && (s->u.ammo.quantity > 0)) {
+         l->ammo[i]     = s->u.ammo.outfit;
+         l->quantity[i] = s->u.ammo.quantity;
+      }
+   }
+}
+
+
+/**
+ * @brief Equips a pilot with a remembered loadout.
+ *
+ * The loadout was valid when the equipper created it so the outfits are
+ *  added without checks, only slots that differ are touched.
+ *
+ *    @param p Pilot to equip, must be batching outfit changes.
+ *    @param l Loadout to equip.
+ */
+static void ai_equipApply( Pilot *p, const EquipLoadout *l )
+{
+   int i;
+   Outfit *o;
+   PilotOutfitSlot *s;
+
+   for (i=0; i<l->noutfits; i++) {
+      s = p->outfits[i];
+      if (s->outfit != l->outfit[i]) {
+         if (s->outfit != NULL) {
+            o = s->outfit;
+            pilot_rmOutfitRaw( p, s );
+            pilot_outfitChanged( p, o, 0 );
+         }
+         if (l->outfit[i] != NULL) {
+            pilot_addOutfitRaw( p, l->outfit[i], s );
+            pilot_outfitChanged( p, l->outfit[i], 1 );
+         }
+      }
+      if (l->ammo[i] != NULL)
+         pilot_addAmmo( p, s, l->ammo[i], l->quantity[i] );
+   }
+   p->outfit_dirty |= PILOT_BATCH_WEAPONS;
+}
+
+
+/**
+ * @brief Frees the remembered loadouts and reports how useful they were.
+ */
+static void ai_equipCacheFree (void)
+{
+   int i;
+   unsigned int n;
+   double saved;
+
+   n = equip_hits + equip_misses;
+   if (n > 0) {
+      saved = (equip_misses > 0) ?
+            equip_hits * equip_luaTime / equip_misses - equip_cacheTime : 0.;
+      DEBUG("Equip cache: %u of %u pilots (%.0f%%) reused one of %d loadouts, saving %.1f ms",
+            equip_hits, n, 100. * equip_hits / n, array_size(equip_cache), saved );
+   }
+
+   for (i=0; i<array_size(equip_cache); i++) {
+      free( equip_cache[i].outfit );
+      free( equip_cache[i].ammo );
+      free( equip_cache[i].quantity );
+   }
+   array_free( equip_cache );
+   equip_cache     = NULL;
+   equip_hits      = 0;
+   equip_misses    = 0;
+   equip_luaTime   = 0.;
+   equip_cacheTime = 0.;
 }
 
 
@@ -1049,8 +1240,10 @@ static void ai_create( Pilot* pilot, char *param )
 {
    LuaPilot lp;
    lua_State *L;
-   int errf, nparam;
+   int errf, nparam, variants, bucket;
    char *func;
+   EquipLoadout *l;
+   double t;
 
    L = equip_L;
    func = "equip_generic";
@@ -1071,13 +1264,34 @@ static void ai_create( Pilot* pilot, char *param )
       lua_pushcfunction(L, nlua_errTrace);
       errf = -3;
 #endif /* DEBUGGING */
-      lua_getglobal(L, func);
-      lp.pilot = pilot->id;
-      lua_pushpilot(L,lp);
-      if (lua_pcall(L, 1, 0, errf)) { /* Error has occurred. */
-         WARN("Pilot '%s' equip -> '%s': %s", pilot->name, func, lua_tostring(L,-1));
-         lua_pop(L,1);
+      /* Recalculate the stats only once all the outfits are in. */
+      pilot_outfitBatchBegin( pilot );
+      t = ai_equipTicks();
+
+      /* See if the equipper already made a loadout for this pilot. */
+      variants = ai_equipVariants( L );
+      bucket = (variants > 0) ? RNG(0, variants-1) : -1;
+      l      = (bucket >= 0) ? ai_equipGet( pilot, bucket ) : NULL;
+      if (l != NULL) {
+         ai_equipApply( pilot, l );
+         equip_hits++;
+         equip_cacheTime += ai_equipTicks() - t;
+      }
+      else {
+         lua_getglobal(L, func);
+         lp.pilot = pilot->id;
+         lua_pushpilot(L,lp);
+         if (lua_pcall(L, 1, 0, errf)) { /* Error has occurred. */
+            WARN("Pilot '%s' equip -> '%s': %s", pilot->name, func, lua_tostring(L,-1));
+            lua_pop(L,1);
+         }
+         else if (bucket >= 0) {
+            ai_equipStore( pilot, bucket );
+            equip_misses++;
+            equip_luaTime += ai_equipTicks() - t;
+         }
       }
+      pilot_outfitBatchCommit( pilot );
    }
 
    /* Since the pilot changes outfits and cores, we must heal him up. */
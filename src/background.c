@@ -31,6 +31,10 @@
 #include "nebula.h"
 #include "nstring.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif /* defined(__SSE2__) */
+
 
 /**
  * @brief Represents a background image like say a Nebula.
@@ -62,10 +66,20 @@ static lua_State *bkg_def_L = NULL; /**< Default Lua state. */
  * Background stars.
  */
 #define STAR_BUF     250 /**< Area to leave around screen for stars, more = less repetition */
+#define STAR_LAYERS  32 /**< Number of parallax layers stars are sorted into. */
+#define STAR_WRAP(x,w) ((x) - (w)*floor(((x)+(w)/2.)/(w))) /**< Wraps x into [-w/2,w/2). */
 static gl_vbo *star_vertexVBO = NULL; /**< Star Vertex VBO. */
 static gl_vbo *star_colourVBO = NULL; /**< Star Colour VBO. */
 static GLfloat *star_vertex = NULL; /**< Vertex of the stars. */
 static GLfloat *star_colour = NULL; /**< Brightness of the stars. */
+static GLfloat *star_px = NULL; /**< X position of the stars. */
+static GLfloat *star_py = NULL; /**< Y position of the stars. */
+static GLfloat *star_para = NULL; /**< Parallax factor of the stars. */
+static unsigned int star_layer[STAR_LAYERS+1]; /**< First star of each layer. */
+static GLfloat star_layerPara[STAR_LAYERS]; /**< Parallax factor of each layer. */
+static GLfloat star_layerX[STAR_LAYERS]; /**< X offset of each layer. */
+static GLfloat star_layerY[STAR_LAYERS]; /**< Y offset of each layer. */
+static int star_layerMoved = 0; /**< Layers have offsets not applied to the stars. */
 static unsigned int nstars = 0; /**< Total stars. */
 static unsigned int mstars = 0; /**< Memory stars are taking. */
 static GLfloat star_x = 0.; /**< Star X movement. */
@@ -76,6 +90,15 @@ static GLfloat star_y = 0.; /**< Star Y movement. */
  * Prototypes.
  */
 static void background_renderImages( background_image_t *bkg_arr );
+/* Stars. */
+static GLfloat star_parallax( GLfloat brightness );
+static void star_size( GLfloat *w, GLfloat *h );
+static void star_move( GLfloat sx, GLfloat sy, GLfloat w, GLfloat h );
+static void star_moveLayers( GLfloat sx, GLfloat sy, GLfloat w, GLfloat h );
+static void star_bakeLayers( GLfloat w, GLfloat h );
+static void star_pack( GLfloat lx, GLfloat ly );
+static int star_layerVertices( int k, GLint *first, GLsizei *count );
+static void star_renderLayers( GLfloat w, GLfloat h );
 static lua_State* background_create( const char *path );
 static void background_clearCurrent (void);
 static void background_clearImgArr( background_image_t **arr );
@@ -84,15 +107,55 @@ static int bkg_compare( const void *p1, const void *p2 );
 static void bkg_sort( background_image_t *arr );
 
 
+/**
+ * @brief Gets how much a star moves for each pixel the camera moves.
+ *
+ *    @param brightness Brightness of the star.
+ *    @return Parallax factor of the star.
+ */
+static GLfloat star_parallax( GLfloat brightness )
+{
+   return 1./(9. - 10.*brightness);
+}
+
+
+/**
+ * @brief Gets the size of the area the stars wrap around in.
+ *
+ *    @param[out] w Width of the area.
+ *    @param[out] h Height of the area.
+ */
+static void star_size( GLfloat *w, GLfloat *h )
+{
+   *w  = (SCREEN_W + 2.*STAR_BUF);
+   *w += conf.zoom_stars * (*w / conf.zoom_far - 1.);
+   *h  = (SCREEN_H + 2.*STAR_BUF);
+   *h += conf.zoom_stars * (*h / conf.zoom_far - 1.);
+}
+
+
 /**
  * @brief Initializes background stars.
  *
+ * Stars are sorted by brightness into parallax layers so that a layer can be
+ *  moved as a whole.
+ *
+ * This quantizes the parallax: every star in a layer moves with the parallax
+ *  at the centre of the layer instead of its own. Parallax goes from 1/7 to 1
+ *  over STAR_LAYERS layers, so a star is off by at most 0.86/(2*STAR_LAYERS)
+ *  pixels per pixel the camera moves, about 0.013 with 32 layers. This is
+ *  only an approximation. The dimmest stars are off by up to roughly 9% of
+ *  their own speed. Stars drift relative to their neighbours at most that
+ *  fast and their positions are random, so no pattern shows. Stars with
+ *  streaks always use their own parallax, see star_move.
+ *
  *    @param n Number of stars to add (stars per 800x640 screen).
  */
 void background_initStars( int n )
 {
-   unsigned int i;
+   unsigned int i, j, k;
    GLfloat w, h, hw, hh;
+   GLfloat x, y, b, pmin, pmax;
    double size;
 
    /* Calculate size. */
@@ -100,10 +163,7 @@ void background_initStars( int n )
    size /= pow2(conf.zoom_far);
 
    /* Calculate star buffer. */
-   w  = (SCREEN_W + 2.*STAR_BUF);
-   w += conf.zoom_stars * (w / conf.zoom_far - 1.);
-   h  = (SCREEN_H + 2.*STAR_BUF);
-   h += conf.zoom_stars * (h / conf.zoom_far - 1.);
+   star_size( &w, &h );
    hw = w / 2.;
    hh = h / 2.;
 
@@ -115,24 +175,59 @@ void background_initStars( int n )
       /* Create data. */
       star_vertex = realloc( star_vertex, nstars * sizeof(GLfloat) * 4 );
       star_colour = realloc( star_colour, nstars * sizeof(GLfloat) * 8 );
+      star_px     = realloc( star_px,     nstars * sizeof(GLfloat) );
+      star_py     = realloc( star_py,     nstars * sizeof(GLfloat) );
+      star_para   = realloc( star_para,   nstars * sizeof(GLfloat) );
       mstars = nstars;
    }
+
+   /* Generate the stars, temporarily storing them in the vertex data. */
+   pmin = star_parallax( 0.2 );
+   pmax = star_parallax( 0.8 );
+   memset( star_layer, 0, sizeof(star_layer) );
    for (i=0; i < nstars; i++) {
-      /* Set the position. */
       star_vertex[4*i+0] = RNGF()*w - hw;
       star_vertex[4*i+1] = RNGF()*h - hh;
-      star_vertex[4*i+2] = 0.;
-      star_vertex[4*i+3] = 0.;
+      star_vertex[4*i+2] = RNGF()*0.6 + 0.2;
+      k = (unsigned int)((star_parallax( star_vertex[4*i+2] ) - pmin) /
+            (pmax - pmin) * STAR_LAYERS);
+      k = MIN( k, STAR_LAYERS-1 );
+      star_vertex[4*i+3] = k;
+      star_layer[k+1]++;
+   }
+   for (k=0; k<STAR_LAYERS; k++) {
+      star_layer[k+1] += star_layer[k];
+      star_layerPara[k] = pmin + (pmax - pmin) * (k+0.5) / STAR_LAYERS;
+      star_layerX[k]    = 0.;
+      star_layerY[k]    = 0.;
+   }
+   star_layerMoved = 0;
+
+   /* Sort into the layers. */
+   for (i=0; i < nstars; i++) {
+      k = (unsigned int) star_vertex[4*i+3];
+      j = star_layer[k]++;
+      x = star_vertex[4*i+0];
+      y = star_vertex[4*i+1];
+      b = star_vertex[4*i+2];
+      /* Set the position. */
+      star_px[j]   = x;
+      star_py[j]   = y;
+      star_para[j] = star_parallax( b );
       /* Set the colour. */
-      star_colour[8*i+0] = 1.;
-      star_colour[8*i+1] = 1.;
-      star_colour[8*i+2] = 1.;
-      star_colour[8*i+3] = RNGF()*0.6 + 0.2;
-      star_colour[8*i+4] = 1.;
-      star_colour[8*i+5] = 1.;
-      star_colour[8*i+6] = 1.;
-      star_colour[8*i+7] = 0.;
+      star_colour[8*j+0] = 1.;
+      star_colour[8*j+1] = 1.;
+      star_colour[8*j+2] = 1.;
+      star_colour[8*j+3] = b;
+      star_colour[8*j+4] = 1.;
+      star_colour[8*j+5] = 1.;
+      star_colour[8*j+6] = 1.;
+      star_colour[8*j+7] = 0.;
    }
+   for (k=STAR_LAYERS; k>0; k--)
+      star_layer[k] = star_layer[k-1];
+   star_layer[0] = 0;
+   star_pack( 0., 0. );
 
    /* Destroy old VBO. */
    if (star_vertexVBO != NULL) {
@@ -165,31 +260,212 @@ void background_moveStars( double x, double y )
 }
 
 
+/**
+ * @brief Moves every star by its own parallax.
+ *
+ * Positions wrap around in closed form so it works for any displacement.
+ *
+ *    @param sx X displacement of the camera.
+ *    @param sy Y displacement of the camera.
+ *    @param w Width of the star area.
+ *    @param h Height of the star area.
+ */
+static void star_move( GLfloat sx, GLfloat sy, GLfloat w, GLfloat h )
+{
+   unsigned int i;
+   GLfloat x, y;
+
+   i = 0;
+#if defined(__SSE2__)
+   {
+      __m128 vsx, vsy, vw, vh, vhw, vhh, viw, vih, one;
+      __m128 b, vx, vy, t, f;
+
+      vsx = _mm_set1_ps( sx );
+      vsy = _mm_set1_ps( sy );
+      vw  = _mm_set1_ps( w );
+      vh  = _mm_set1_ps( h );
+      vhw = _mm_set1_ps( w/2. );
+      vhh = _mm_set1_ps( h/2. );
+      viw = _mm_set1_ps( 1./w );
+      vih = _mm_set1_ps( 1./h );
+      one = _mm_set1_ps( 1. );
+      for ( ; i+4 <= nstars; i+=4) {
+         b  = _mm_loadu_ps( &star_para[i] );
+         vx = _mm_add_ps( _mm_loadu_ps( &star_px[i] ), _mm_mul_ps( vsx, b ) );
+         vy = _mm_add_ps( _mm_loadu_ps( &star_py[i] ), _mm_mul_ps( vsy, b ) );
+
+         /* x -= w*floor((x+w/2)/w), floor done by truncating and fixing up. */
+         t  = _mm_mul_ps( _mm_add_ps( vx, vhw ), viw );
+         f  = _mm_cvtepi32_ps( _mm_cvttps_epi32( t ) );
+         f  = _mm_sub_ps( f, _mm_and_ps( _mm_cmpgt_ps( f, t ), one ) );
+         vx = _mm_sub_ps( vx, _mm_mul_ps( vw, f ) );
+         t  = _mm_mul_ps( _mm_add_ps( vy, vhh ), vih );
+         f  = _mm_cvtepi32_ps( _mm_cvttps_epi32( t ) );
+         f  = _mm_sub_ps( f, _mm_and_ps( _mm_cmpgt_ps( f, t ), one ) );
+         vy = _mm_sub_ps( vy, _mm_mul_ps( vh, f ) );
+
+         _mm_storeu_ps( &star_px[i], vx );
+         _mm_storeu_ps( &star_py[i], vy );
+      }
+   }
+#endif /* defined(__SSE2__) */
+   for ( ; i < nstars; i++) {
+      x = star_px[i] + sx*star_para[i];
+      y = star_py[i] + sy*star_para[i];
+      star_px[i] = STAR_WRAP( x, w );
+      star_py[i] = STAR_WRAP( y, h );
+   }
+}
+
+
+/**
+ * @brief Moves the parallax layers, the stars themselves are not touched.
+ *
+ *    @param sx X displacement of the camera.
+ *    @param sy Y displacement of the camera.
+ *    @param w Width of the star area.
+ *    @param h Height of the star area.
+ */
+static void star_moveLayers( GLfloat sx, GLfloat sy, GLfloat w, GLfloat h )
+{
+   int k;
+
+   if ((sx == 0.) && (sy == 0.))
+      return;
+
+   /* Offsets are kept in [0,w) and [0,h). */
+   for (k=0; k<STAR_LAYERS; k++) {
+      star_layerX[k] = fmod( star_layerX[k] + sx*star_layerPara[k], w );
+      if (star_layerX[k] < 0.)
+         star_layerX[k] += w;
+      star_layerY[k] = fmod( star_layerY[k] + sy*star_layerPara[k], h );
+      if (star_layerY[k] < 0.)
+         star_layerY[k] += h;
+   }
+   star_layerMoved = 1;
+}
+
+
+/**
+ * @brief Applies the layer offsets to the stars.
+ *
+ *    @param w Width of the star area.
+ *    @param h Height of the star area.
+ */
+static void star_bakeLayers( GLfloat w, GLfloat h )
+{
+   int k;
+   unsigned int i;
+
+   for (k=0; k<STAR_LAYERS; k++) {
+      for (i=star_layer[k]; i<star_layer[k+1]; i++) {
+         star_px[i] = STAR_WRAP( star_px[i] + star_layerX[k], w );
+         star_py[i] = STAR_WRAP( star_py[i] + star_layerY[k], h );
+      }
+      star_layerX[k] = 0.;
+      star_layerY[k] = 0.;
+   }
+   star_layerMoved = 0;
+}
+
+
+/**
+ * @brief Fills the vertex data of the stars.
+ *
+ *    @param lx X length of the streaks at full brightness.
+ *    @param ly Y length of the streaks at full brightness.
+ */
+static void star_pack( GLfloat lx, GLfloat ly )
+{
+   unsigned int i;
+   GLfloat brightness;
+
+   for (i=0; i < nstars; i++) {
+      brightness = star_colour[8*i+3];
+      star_vertex[4*i+0] = star_px[i];
+      star_vertex[4*i+1] = star_py[i];
+      star_vertex[4*i+2] = star_px[i] + lx*brightness;
+      star_vertex[4*i+3] = star_py[i] + ly*brightness;
+   }
+}
+
+
+/**
+ * @brief Gets the vertices of a layer that get drawn.
+ *
+ * Each star has two vertices, the second one being transparent, and only
+ *  half the stars are drawn. Stars are sorted by brightness so the first
+ *  half of each layer is drawn, otherwise the brightest stars would never
+ *  show.
+ *
+ *    @param k Layer to get vertices of.
+ *    @param[out] first First vertex to draw.
+ *    @param[out] count Number of vertices to draw.
+ *    @return 0 if there is nothing to draw.
+ */
+static int star_layerVertices( int k, GLint *first, GLsizei *count )
+{
+   *first = 2*star_layer[k];
+   *count = star_layer[k+1] - star_layer[k];
+   return (*count > 0);
+}
+
+
+/**
+ * @brief Renders the stars as points offset by their layer.
+ *
+ * Each layer is drawn up to four times to wrap around the star area.
+ *
+ *    @param w Width of the star area.
+ *    @param h Height of the star area.
+ */
+static void star_renderLayers( GLfloat w, GLfloat h )
+{
+   int k, cx, cy;
+   GLint first;
+   GLsizei count;
+
+   for (k=0; k<STAR_LAYERS; k++) {
+      if (!star_layerVertices( k, &first, &count ))
+         continue;
+
+      for (cx=0; cx<2; cx++) {
+         if ((cx > 0) && (star_layerX[k] == 0.))
+            break;
+         for (cy=0; cy<2; cy++) {
+            if ((cy > 0) && (star_layerY[k] == 0.))
+               break;
+            gl_matrixPush();
+               gl_matrixTranslate( star_layerX[k] - cx*w, star_layerY[k] - cy*h );
+               glDrawArrays( GL_POINTS, first, count );
+            gl_matrixPop();
+         }
+      }
+   }
+}
+
+
 /**
  * @brief Renders the starry background.
  *
- * This could really benefit from OpenCL directly. It would probably give a great
- *  speed up, although we'll consider it when we get a runtime linking OpenCL
- *  framework someday.
+ * When no streaks are drawn the stars don't need to be touched at all, the
+ *  parallax layers are just drawn with an offset. Streaks depend on the
+ *  position of each star so in that case the stars are moved individually
+ *  and uploaded.
  *
  *    @param dt Current delta tick.
  */
 void background_renderStars( const double dt )
 {
    (void) dt;
-   unsigned int i;
-   GLfloat hh, hw, h, w;
-   GLfloat x, y, m, b;
-   GLfloat brightness;
+   GLfloat h, w;
+   GLfloat x, y, m;
    double z;
-   double sx, sy;
-   int shade_mode;
-   int j, n;
-
+   int k, shade_mode;
+   GLint first;
+   GLsizei count;
 
-   /*
-    * gprof claims it's the slowest thing in the game!
-    */
 
    /* Do some scaling for now. */
    z = cam_getZoom();
@@ -198,55 +474,13 @@ void background_renderStars( const double dt )
       gl_matrixTranslate( SCREEN_W/2., SCREEN_H/2. );
       gl_matrixScale( z, z );
 
-   if (!paused && (player.p != NULL) && !player_isFlag(PLAYER_DESTROYED) &&
-         !player_isFlag(PLAYER_CREATING)) { /* update position */
-
-      /* Calculate some dimensions. */
-      w  = (SCREEN_W + 2.*STAR_BUF);
-      w += conf.zoom_stars * (w / conf.zoom_far - 1.);
-      h  = (SCREEN_H + 2.*STAR_BUF);
-      h += conf.zoom_stars * (h / conf.zoom_far - 1.);
-      hw = w/2.;
-      hh = h/2.;
-
-      /* Calculate multiple updates in the case the ship is moving really ridiculously fast. */
-      if ((star_x > SCREEN_W) || (star_y > SCREEN_H)) {
-         sx = ceil( star_x / SCREEN_W );
-         sy = ceil( star_y / SCREEN_H );
-         n  = MAX( sx, sy );
-         star_x /= (double)n;
-         star_y /= (double)n;
-      }
-      else
-         n = 1;
-
-      /* Calculate new star positions. */
-      for (j=0; j < n; j++) {
-         for (i=0; i < nstars; i++) {
-
-            /* Calculate new position */
-            b = 1./(9. - 10.*star_colour[8*i+3]);
-            star_vertex[4*i+0] = star_vertex[4*i+0] + star_x*b;
-            star_vertex[4*i+1] = star_vertex[4*i+1] + star_y*b;
-
-            /* check boundaries */
-            if (star_vertex[4*i+0] > hw)
-               star_vertex[4*i+0] -= w;
-            else if (star_vertex[4*i+0] < -hw)
-               star_vertex[4*i+0] += w;
-            if (star_vertex[4*i+1] > hh)
-               star_vertex[4*i+1] -= h;
-            else if (star_vertex[4*i+1] < -hh)
-               star_vertex[4*i+1] += h;
-         }
-      }
-
-      /* Upload the data. */
-      gl_vboSubData( star_vertexVBO, 0, nstars * 4 * sizeof(GLfloat), star_vertex );
-   }
+   /* Calculate some dimensions. */
+   star_size( &w, &h );
 
    /* Decide on shade mode. */
    shade_mode = 0;
+   x = 0.;
+   y = 0.;
    if ((player.p != NULL) && !player_isFlag(PLAYER_DESTROYED) &&
          !player_isFlag(PLAYER_CREATING)) {
 
@@ -275,30 +509,38 @@ void background_renderStars( const double dt )
          x = m*cos(VANGLE(player.p->solid->vel));
          y = m*sin(VANGLE(player.p->solid->vel));
       }
+   }
 
-      if (shade_mode) {
-         /* Generate lines. */
-         for (i=0; i < nstars; i++) {
-            brightness = star_colour[8*i+3];
-            star_vertex[4*i+2] = star_vertex[4*i+0] + x*brightness;
-            star_vertex[4*i+3] = star_vertex[4*i+1] + y*brightness;
-         }
+   /* Update position. */
+   if (shade_mode) {
+      if (star_layerMoved)
+         star_bakeLayers( w, h );
+      if (!paused)
+         star_move( star_x, star_y, w, h );
 
-         /* Upload new data. */
-         gl_vboSubData( star_vertexVBO, 0, nstars * 4 * sizeof(GLfloat), star_vertex );
-      }
+      /* Generate lines and upload. */
+      star_pack( x, y );
+      gl_vboSubData( star_vertexVBO, 0, nstars * 4 * sizeof(GLfloat), star_vertex );
    }
+   else if (!paused && (player.p != NULL) && !player_isFlag(PLAYER_DESTROYED) &&
+         !player_isFlag(PLAYER_CREATING))
+      star_moveLayers( star_x, star_y, w, h );
 
    /* Render. */
    gl_vboActivate( star_vertexVBO, GL_VERTEX_ARRAY, 2, GL_FLOAT, 2 * sizeof(GLfloat) );
    gl_vboActivate( star_colourVBO, GL_COLOR_ARRAY,  4, GL_FLOAT, 4 * sizeof(GLfloat) );
    if (shade_mode) {
-      glDrawArrays( GL_LINES, 0, nstars );
-      glDrawArrays( GL_POINTS, 0, nstars ); /* This second pass is when the lines are very short that they "lose" intensity. */
+      for (k=0; k<STAR_LAYERS; k++)
+         if (star_layerVertices( k, &first, &count ))
+            glDrawArrays( GL_LINES, first, count );
+      /* This second pass is when the lines are very short that they "lose" intensity. */
+      for (k=0; k<STAR_LAYERS; k++)
+         if (star_layerVertices( k, &first, &count ))
+            glDrawArrays( GL_POINTS, first, count );
       glShadeModel(GL_FLAT);
    }
    else
-      glDrawArrays( GL_POINTS, 0, nstars );
+      star_renderLayers( w, h );
 
    /* Clear star movement. */
    star_x = 0.;
@@ -430,7 +672,7 @@ static lua_State* background_create( const char *name )
    nsnprintf( path, sizeof(path), "dat/bkg/%s.lua", name );
 
    /* Create the Lua state. */
-   L = nlua_newState();
+   L = nlua_newState( path );
    nlua_loadStandard(L,1);
    nlua_loadTex(L,0);
    nlua_loadCol(L,0);
@@ -440,7 +682,7 @@ static lua_State* background_create( const char *name )
    buf = ndata_read( path, &bufsize );
    if (buf == NULL) {
       WARN("Default background script '%s' not found.", path);
-      lua_close(L);
+      nlua_closeState(L);
       return NULL;
    }
 
@@ -451,7 +693,7 @@ static lua_State* background_create( const char *name )
             "Most likely Lua file has improper syntax, please check",
             path, lua_tostring(L,-1));
       free(buf);
-      lua_close(L);
+      nlua_closeState(L);
       return NULL;
    }
    free(buf);
@@ -525,7 +767,7 @@ static void background_clearCurrent (void)
 {
    if (bkg_cur_L != bkg_def_L) {
       if (bkg_cur_L != NULL)
-         lua_close( bkg_cur_L );
+         nlua_closeState( bkg_cur_L );
    }
    bkg_cur_L = NULL;
 }
@@ -577,7 +819,7 @@ void background_free (void)
    /* Free the Lua. */
    background_clear();
    if (bkg_def_L != NULL)
-      lua_close( bkg_def_L );
+      nlua_closeState( bkg_def_L );
    bkg_def_L = NULL;
 
    /* Free the images. */
@@ -592,7 +834,7 @@ void background_free (void)
 
    /* Free the Lua. */
    if (bkg_cur_L != NULL)
-      lua_close( bkg_cur_L );
+      nlua_closeState( bkg_cur_L );
    bkg_cur_L = NULL;
 
    /* Destroy VBOs. */
@@ -614,6 +856,12 @@ void background_free (void)
       free(star_colour);
       star_colour = NULL;
    }
+   free(star_px);
+   star_px = NULL;
+   free(star_py);
+   star_py = NULL;
+   free(star_para);
+   star_para = NULL;
    nstars = 0;
    mstars = 0;
 }
@@ -154,12 +154,158 @@ int CollideLineLine( double s1x, double s1y, double e1x, double e1y,
 }
 
 
+/**
+ * @brief Gets the first set bit of a transparency map in a range.
+ *
+ *    @param trans Transparency map to check.
+ *    @param a First bit of the range.
+ *    @param b Last bit of the range (inclusive).
+ *    @return The first set bit or -1 if none are set.
+ */
+static int CollideMaskFirst( const uint8_t *trans, int a, int b )
+{
+   int i, ib;
+
+   /* Leading partial byte. */
+   for (i=a; (i<=b) && (i & 7); i++)
+      if (trans[ i>>3 ] & (1 << (i & 7)))
+         return i;
+   if (i > b)
+      return -1;
+
+   /* Whole bytes, skipping empty ones. */
+   for (ib=i>>3; (ib<<3)+7 <= b; ib++)
+      if (trans[ib])
+         break;
+   i = ib<<3;
+
+   /* Trailing bits. */
+   for (; i<=b; i++)
+      if (trans[ i>>3 ] & (1 << (i & 7)))
+         return i;
+   return -1;
+}
+
+
+/**
+ * @brief Gets the last set bit of a transparency map in a range.
+ *
+ *    @param trans Transparency map to check.
+ *    @param a First bit of the range.
+ *    @param b Last bit of the range (inclusive).
+ *    @return The last set bit or -1 if none are set.
+ */
+static int CollideMaskLast( const uint8_t *trans, int a, int b )
+{
+   int i, ib;
+
+   /* Trailing partial byte. */
+   for (i=b; (i>=a) && ((i & 7) != 7); i--)
+      if (trans[ i>>3 ] & (1 << (i & 7)))
+         return i;
+   if (i < a)
+      return -1;
+
+   /* Whole bytes, skipping empty ones. */
+   for (ib=(i+1)>>3; (ib<<3)-8 >= a; ib--)
+      if (trans[ib-1])
+         break;
+   i = (ib<<3)-1;
+
+   /* Leading bits. */
+   for (; i>=a; i--)
+      if (trans[ i>>3 ] & (1 << (i & 7)))
+         return i;
+   return -1;
+}
+
+
+/**
+ * @brief Walks a line through a sprite's transparency map.
+ *
+ * The line is walked a row at a time.  Every pixel the line crosses in a row
+ *  forms a contiguous run of bits in the map, so empty bytes are skipped
+ *  instead of testing each pixel.
+ *
+ *    @param[in] bt Texture to walk.
+ *    @param[in] bbx X position of the sprite in the sheet.
+ *    @param[in] bby Y position of the sprite in the sheet.
+ *    @param[in] x0 X start of the line in sprite coordinates.
+ *    @param[in] y0 Y start of the line in sprite coordinates.
+ *    @param[in] x1 X end of the line in sprite coordinates.
+ *    @param[in] y1 Y end of the line in sprite coordinates.
+ *    @param[out] t Position along the line of the first opaque pixel [0:1].
+ *    @return 1 if an opaque pixel was found, 0 else.
+ */
+static int CollideLineMask( const glTexture *bt, int bbx, int bby,
+      double x0, double y0, double x1, double y1, double *t )
+{
+   int w, sw, sh;
+   int ry, ry1, sy, cxa, cxb, base, bit;
+   double dx, dy, ta, tb, xa, xb, tx;
+
+   w  = (int)bt->w;
+   sw = (int)bt->sw;
+   sh = (int)bt->sh;
+   dx = x1 - x0;
+   dy = y1 - y0;
+
+   /* Rows to walk. */
+   ry  = CLAMP( 0, sh-1, (int)floor(y0) );
+   ry1 = CLAMP( 0, sh-1, (int)floor(y1) );
+   sy  = (ry1 >= ry) ? 1 : -1;
+
+   for ( ; ; ry += sy) {
+      /* Part of the line inside the row. */
+      if (dy == 0.) {
+         ta = 0.;
+         tb = 1.;
+      }
+      else {
+         ta = ((double)ry + ((dy > 0.) ? 0. : 1.) - y0) / dy;
+         tb = ((double)ry + ((dy > 0.) ? 1. : 0.) - y0) / dy;
+         ta = CLAMP( 0., 1., ta );
+         tb = CLAMP( 0., 1., tb );
+      }
+      xa = x0 + dx*ta;
+      xb = x0 + dx*tb;
+      cxa = CLAMP( 0, sw-1, (int)floor( MIN(xa,xb) ) );
+      cxb = CLAMP( 0, sw-1, (int)floor( MAX(xa,xb) ) );
+
+      /* Look for an opaque pixel in the direction of the line. */
+      base = (bby+ry)*w + bbx;
+      if (dx >= 0.)
+         bit = CollideMaskFirst( bt->trans, base+cxa, base+cxb );
+      else
+         bit = CollideMaskLast( bt->trans, base+cxa, base+cxb );
+
+      if (bit >= 0) {
+         /* Where the line enters the pixel. */
+         bit -= base;
+         if (dx > 0.)
+            tx = ((double)bit - x0) / dx;
+         else if (dx < 0.)
+            tx = ((double)bit + 1. - x0) / dx;
+         else
+            tx = ta;
+         *t = CLAMP( ta, tb, tx );
+         return 1;
+      }
+
+      if (ry == ry1)
+         break;
+   }
+
+   return 0;
+}
+
+
 /**
  * @brief Checks to see if a line collides with a sprite.
  *
- * First collisions are detected on all the walls of the sprite's rectangle.
- *  Then the collisions are tested by pixel perfectness until collisions are
- *  actually found with the ship itself.
+ * First the line is clipped to the sprite's rectangle.  Then the part of the
+ *  line inside the rectangle is walked through the transparency map from both
+ *  ends until it reaches the ship itself.
  *
  *    @param[in] ap Origin of the line.
  *    @param[in] ad Direction of the line.
@@ -177,10 +323,9 @@ int CollideLineSprite( const Vector2d* ap, double ad, double al,
       const glTexture* bt, const int bsx, const int bsy, const Vector2d* bp,
       Vector2d crash[2] )
 {
-   int x,y, rbsy, bbx,bby;
-   double ep[2], bl[2], tr[2], v[2], mod;
-   int hits, real_hits;
-   Vector2d tmp_crash, border[2];
+   int i, rbsy, bbx,bby;
+   double d[2], o[2], lo[2], hi[2], t0, t1, t, ta, tb;
+   double x0,y0, x1,y1;
 
    /* Make sure texture has transparency map. */
    if (bt->trans == NULL) {
@@ -188,72 +333,41 @@ int CollideLineSprite( const Vector2d* ap, double ad, double al,
       return 0;
    }
 
-   /* Set up end point of line. */
-   ep[0] = ap->x + al*cos(ad);
-   ep[1] = ap->y + al*sin(ad);
-
-   /* Set up top right corner of the rectangle. */
-   tr[0] = bp->x + bt->sw/2.;
-   tr[1] = bp->y + bt->sh/2.;
-   /* Set up bottom left corner of the rectangle. */
-   bl[0] = bp->x - bt->sw/2.;
-   bl[1] = bp->y - bt->sh/2.;
-
-   /*
-    * Start check for rectangular collisions.
-    */
-   hits = 0;
-   /* Left border. */
-   if (CollideLineLine(ap->x, ap->y, ep[0], ep[1],
-         bl[0], bl[1], bl[0], tr[1], &tmp_crash) == 1) {
-      border[hits].x = tmp_crash.x;
-      border[hits].y = tmp_crash.y;
-      hits++;
-   }
-   /* Top border. */
-   if (CollideLineLine(ap->x, ap->y, ep[0], ep[1],
-         bl[0], tr[1], tr[0], tr[1], &tmp_crash) == 1) {
-      border[hits].x = tmp_crash.x;
-      border[hits].y = tmp_crash.y;
-      hits++;
-   }
-   /* Now we have to make sure hits isn't 2. */
-   /* Right border. */
-   if ((hits < 2) && CollideLineLine(ap->x, ap->y, ep[0], ep[1],
-         tr[0], tr[1], tr[0], bl[1], &tmp_crash) == 1) {
-      border[hits].x = tmp_crash.x;
-      border[hits].y = tmp_crash.y;
-      hits++;
-   }
-   /* Bottom border. */
-   if ((hits < 2) && CollideLineLine(ap->x, ap->y, ep[0], ep[1],
-         tr[0], bl[1], bl[0], bl[1], &tmp_crash) == 1) {
-      border[hits].x = tmp_crash.x;
-      border[hits].y = tmp_crash.y;
-      hits++;
-   }
-
-   /* No hits - missed. */
-   if (hits == 0)
-      return 0;
-
-   /* Beam must die in the rectangle. */
-   if (hits == 1) {
-      border[1].x = ep[0];
-      border[1].y = ep[1];
+   /* Line in sprite coordinates, origin at the bottom left corner. */
+   o[0]  = ap->x - (bp->x - bt->sw/2.);
+   o[1]  = ap->y - (bp->y - bt->sh/2.);
+   d[0]  = al*cos(ad);
+   d[1]  = al*sin(ad);
+   lo[0] = 0.;
+   lo[1] = 0.;
+   hi[0] = bt->sw;
+   hi[1] = bt->sh;
+
+   /* Clip the line against the rectangle one slab at a time. */
+   t0 = 0.;
+   t1 = 1.;
+   for (i=0; i<2; i++) {
+      if (d[i] == 0.) {
+         if ((o[i] < lo[i]) || (o[i] > hi[i]))
+            return 0;
+         continue;
+      }
+      ta = (lo[i] - o[i]) / d[i];
+      tb = (hi[i] - o[i]) / d[i];
+      if (ta > tb) {
+         t  = ta;
+         ta = tb;
+         tb = t;
+      }
+      t0 = MAX( t0, ta );
+      t1 = MIN( t1, tb );
+      if (t0 > t1)
+         return 0;
    }
-
-   /*
-    * Now we do a pixel perfect approach.
-    */
-   real_hits = 0;
-   /* Directionality vector (normalized). */
-   v[0] = border[1].x - border[0].x;
-   v[1] = border[1].y - border[0].y;
-   /* Normalize. */
-   mod = MOD(v[0],v[1])/2.; /* Multiply by two to reduce check amount. */
-   v[0] /= mod;
-   v[1] /= mod;
+   x0 = o[0] + d[0]*t0;
+   y0 = o[1] + d[1]*t0;
+   x1 = o[0] + d[0]*t1;
+   y1 = o[1] + d[1]*t1;
 
    /* real vertical sprite value (flipped) */
    rbsy = bt->sy - bsy - 1;
@@ -261,46 +375,17 @@ int CollideLineSprite( const Vector2d* ap, double ad, double al,
    bbx =  bsx*(int)(bt->sw);
    bby = rbsy*(int)(bt->sh);
 
-   /* We start checking first border until we find collision. */
-   x = border[0].x - bl[0] + v[0];
-   y = border[0].y - bl[1] + v[1];
-   while ((x > 0.) && (x < bt->sw) && (y > 0.) && (y < bt->sh)) {
-      /* Is non-transparent. */
-      if (!gl_isTrans(bt, bbx+(int)x, bby+(int)y)) {
-         crash[real_hits].x = x + bl[0];
-         crash[real_hits].y = y + bl[1];
-         real_hits++;
-         break;
-      }
-      x += v[0];
-      y += v[1];
-   }
-
-   /* Now we check the second border. */
-   x = border[1].x - bl[0] - v[0];
-   y = border[1].y - bl[1] - v[1];
-   while ((x > 0.) && (x < bt->sw) && (y > 0.) && (y < bt->sh)) {
-      /* Is non-transparent. */
-      if (!gl_isTrans(bt, bbx+(int)x, bby+(int)y)) {
-         crash[real_hits].x = x + bl[0];
-         crash[real_hits].y = y + bl[1];
-         real_hits++;
-         break;
-      }
-      x -= v[0];
-      y -= v[1];
-   }
-
-   /* Actually missed. */
-   if (real_hits == 0)
+   /* Walk from the entry point until the ship is found. */
+   if (!CollideLineMask( bt, bbx, bby, x0, y0, x1, y1, &t ))
       return 0;
-
-   /* Strange situation, should never happen but just in case we duplicate
-    *  the hit. */
-   if (real_hits == 1) {
-      crash[1].x = crash[0].x;
-      crash[1].y = crash[0].y;
-   }
+   crash[0].x = x0 + (x1-x0)*t + bp->x - bt->sw/2.;
+   crash[0].y = y0 + (y1-y0)*t + bp->y - bt->sh/2.;
+
+   /* Walk back from the exit point, must hit at worst the same pixel. */
+   if (!CollideLineMask( bt, bbx, bby, x1, y1, x0, y0, &t ))
+      t = 1.;
+   crash[1].x = x1 + (x0-x1)*t + bp->x - bt->sw/2.;
+   crash[1].y = y1 + (y0-y1)*t + bp->y - bt->sh/2.;
 
    /* We hit. */
    return 1;
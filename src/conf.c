@@ -153,6 +153,7 @@ void conf_setDefaults (void)
    conf.devmode      = 0;
    conf.devautosave  = 0;
    conf.devcsv       = 0;
+   conf.lua_budget   = LUA_BUDGET_DEFAULT;
 
    /* Gameplay. */
    conf_setGameplayDefaults();
@@ -309,12 +310,12 @@ void conf_loadConfigPath( void )
    if (!nfile_fileExists(file))
       return;
 
-   lua_State *L = nlua_newState();
+   lua_State *L = nlua_newState( file );
    nlua_loadBasic(L); /* For os library */
    if (luaL_dofile(L, file) == 0)
       conf_loadString("datapath",conf.datapath);
 
-   lua_close(L);
+   nlua_closeState(L);
 }
 
 
@@ -335,7 +336,7 @@ int conf_loadConfig ( const char* file )
       return nfile_touch(file);
 
    /* Load the configuration. */
-   lua_State *L = nlua_newState();
+   lua_State *L = nlua_newState( file );
    if (luaL_dofile(L, file) == 0) {
 
       /* ndata. */
@@ -430,6 +431,7 @@ int conf_loadConfig ( const char* file )
       conf_loadBool("devmode",conf.devmode);
       conf_loadBool("devautosave",conf.devautosave);
       conf_loadBool("conf_nosave",conf.nosave);
+      conf_loadInt("lua_budget",conf.lua_budget);
 
       /* Debugging. */
       conf_loadBool("fpu_except",conf.fpu_except);
@@ -550,11 +552,11 @@ int conf_loadConfig ( const char* file )
    else { /* failed to load the config file */
       WARN("Config file '%s' has invalid syntax:", file );
       WARN("   %s", lua_tostring(L,-1));
-      lua_close(L);
+      nlua_closeState(L);
       return 1;
    }
 
-   lua_close(L);
+   nlua_closeState(L);
    return 0;
 }
 
@@ -1102,6 +1104,10 @@ int conf_saveConfig ( const char* file )
    conf_saveInt("conf_nosave",conf.nosave);
    conf_saveEmptyLine();
 
+   conf_saveComment("Memory in KB a mission or event can use before a warning is printed (0 disables)");
+   conf_saveInt("lua_budget",conf.lua_budget);
+   conf_saveEmptyLine();
+
    /* Debugging. */
    conf_saveComment("Enables FPU exceptions - only works on DEBUG builds");
    conf_saveBool("fpu_except",conf.fpu_except);
@@ -21,6 +21,7 @@
 #define AUTONAV_RESET_SPEED_DEFAULT          1.    /**< Shield level (0-1) to reset autonav speed at. 1 means at enemy presence, 0 means at armour damage. */
 #define MANUAL_ZOOM_DEFAULT                  0     /**< Whether or not to enable manual zoom controls. */
 #define INPUT_MESSAGES_DEFAULT               5     /**< Amount of messages to display. */
+#define LUA_BUDGET_DEFAULT                   8192  /**< Memory in KB a mission or event Lua state can use before warning. */
 /* Video options */
 #define RESOLUTION_W_DEFAULT                 1024  /**< Default screen width. */
 #define RESOLUTION_H_DEFAULT                 768   /**< Default screen height. */
@@ -144,6 +145,7 @@ typedef struct PlayerConf_s {
    int devmode; /**< Developer mode. */
    int devautosave; /**< Developer mode autosave. */
    int devcsv; /**< Output CSV data. */
+   int lua_budget; /**< Memory in KB a mission or event can use before warning, 0 disables. */
 
    /* Debugging. */
    int fpu_except; /**< Enable FPU exceptions? */
@@ -317,7 +317,7 @@ int cli_init (void)
       return 0;
 
    /* Create the state. */
-   cli_state   = nlua_newState();
+   cli_state   = nlua_newState( "console" );
    nlua_loadStandard( cli_state, 0 );
    nlua_loadCol( cli_state, 0 );
    nlua_loadTex( cli_state, 0 );
@@ -355,7 +355,7 @@ void cli_exit (void)
 {
    /* Destroy the state. */
    if (cli_state != NULL) {
-      lua_close( cli_state );
+      nlua_closeState( cli_state );
       cli_state = NULL;
    }
 }
@@ -1109,6 +1109,9 @@ static int equipment_swapSlot( unsigned int wid, Pilot *p, PilotOutfitSlot *slot
       if (pilot_canEquip( eq_wgt.selected, slot, NULL ) != NULL)
          return 0;
 
+      /* Stats get recalculated once at the end. */
+      pilot_outfitBatchBegin( eq_wgt.selected );
+
       /* Remove ammo first. */
       ammo = outfit_ammo(o);
       if (ammo != NULL) {
@@ -1137,23 +1140,24 @@ static int equipment_swapSlot( unsigned int wid, Pilot *p, PilotOutfitSlot *slot
       if (pilot_canEquip( eq_wgt.selected, slot, o ) != NULL)
          return 0;
 
+      /* Stats get recalculated once at the end. */
+      pilot_outfitBatchBegin( eq_wgt.selected );
+
       /* Add outfit to ship. */
       ret = player_rmOutfit( o, 1 );
       if (ret == 1) {
          pilot_addOutfitRaw( eq_wgt.selected, o, slot );
-
-         /* Recalculate stats. */
-         pilot_calcStats( eq_wgt.selected );
+         pilot_outfitChanged( eq_wgt.selected, o, 1 );
       }
 
       equipment_addAmmo();
    }
 
+   /* Recalculate stats. */
+   pilot_outfitBatchCommit( eq_wgt.selected );
+
    /* Refuel if necessary. */
    land_refuel();
-
-   /* Recalculate stats. */
-   pilot_calcStats( p );
    pilot_healLanded( p );
 
    /* Redo the outfits thingy. */
@@ -34,6 +34,7 @@
 #include "nlua_tut.h"
 #include "rng.h"
 #include "ndata.h"
+#include "conf.h"
 #include "nxml.h"
 #include "nxml_lua.h"
 #include "cond.h"
@@ -268,8 +269,9 @@ static int event_create( int dataid, unsigned int *id )
    data = &event_data[dataid];
 
    /* Open the new state. */
-   ev->L = nlua_newState();
+   ev->L = nlua_newState( data->name );
    L = ev->L;
+   nlua_setBudget( L, conf.lua_budget );
    nlua_loadStandard(L,0);
    nlua_loadEvt(L);
    nlua_loadHook(L);
@@ -315,7 +317,7 @@ static int event_create( int dataid, unsigned int *id )
 static void event_cleanup( Event_t *ev )
 {
    /* Destroy Lua. */
-   lua_close(ev->L);
+   nlua_closeState(ev->L);
 
    /* Free hooks. */
    hook_rmEventParent(ev->id);
@@ -871,7 +871,7 @@ static int faction_parse( Faction* temp, xmlNodePtr parent )
          if (temp->sched_state != NULL)
             WARN("Faction '%s' has duplicate 'spawn' tag.", temp->name);
          nsnprintf( buf, sizeof(buf), "dat/factions/spawn/%s.lua", xml_raw(node) );
-         temp->sched_state = nlua_newState();
+         temp->sched_state = nlua_newState( buf );
          nlua_loadStandard( temp->sched_state, 0 );
          dat = ndata_read( buf, &ndat );
          if (luaL_dobuffer(temp->sched_state, dat, ndat, buf) != 0) {
@@ -879,7 +879,7 @@ static int faction_parse( Faction* temp, xmlNodePtr parent )
                   "%s\n"
                   "Most likely Lua file has improper syntax, please check",
                   buf, lua_tostring(temp->sched_state,-1));
-            lua_close( temp->sched_state );
+            nlua_closeState( temp->sched_state );
             temp->sched_state = NULL;
          }
          free(dat);
@@ -890,7 +890,7 @@ static int faction_parse( Faction* temp, xmlNodePtr parent )
          if (temp->state != NULL)
             WARN("Faction '%s' has duplicate 'standing' tag.", temp->name);
          nsnprintf( buf, sizeof(buf), "dat/factions/standing/%s.lua", xml_raw(node) );
-         temp->state = nlua_newState();
+         temp->state = nlua_newState( buf );
          nlua_loadStandard( temp->state, 0 );
          dat = ndata_read( buf, &ndat );
          if (luaL_dobuffer(temp->state, dat, ndat, buf) != 0) {
@@ -898,7 +898,7 @@ static int faction_parse( Faction* temp, xmlNodePtr parent )
                   "%s\n"
                   "Most likely Lua file has improper syntax, please check",
                   buf, lua_tostring(temp->state,-1));
-            lua_close( temp->state );
+            nlua_closeState( temp->state );
             temp->state = NULL;
          }
          free(dat);
@@ -914,7 +914,7 @@ static int faction_parse( Faction* temp, xmlNodePtr parent )
          if (temp->equip_state != NULL)
             WARN("Faction '%s' has duplicate 'equip' tag.", temp->name);
          nsnprintf( buf, sizeof(buf), "dat/factions/equip/%s.lua", xml_raw(node) );
-         temp->equip_state = nlua_newState();
+         temp->equip_state = nlua_newState( buf );
          nlua_loadStandard( temp->equip_state, 0 );
          dat = ndata_read( buf, &ndat );
          if (luaL_dobuffer(temp->equip_state, dat, ndat, buf) != 0) {
@@ -922,7 +922,7 @@ static int faction_parse( Faction* temp, xmlNodePtr parent )
                   "%s\n"
                   "Most likely Lua file has improper syntax, please check",
                   buf, lua_tostring(temp->equip_state,-1));
-            lua_close( temp->equip_state );
+            nlua_closeState( temp->equip_state );
             temp->equip_state = NULL;
          }
          free(dat);
@@ -1170,11 +1170,11 @@ void factions_free (void)
       if (faction_stack[i].nenemies > 0)
          free(faction_stack[i].enemies);
       if (faction_stack[i].sched_state != NULL)
-         lua_close( faction_stack[i].sched_state );
+         nlua_closeState( faction_stack[i].sched_state );
       if (faction_stack[i].state != NULL)
-         lua_close( faction_stack[i].state );
+         nlua_closeState( faction_stack[i].state );
       if (faction_stack[i].equip_state != NULL)
-         lua_close( faction_stack[i].equip_state );
+         nlua_closeState( faction_stack[i].equip_state );
    }
    free(faction_stack);
    faction_stack = NULL;
@@ -15,6 +15,10 @@
  * There are hard-coded size limits.  256 characters for all routines
  * except gl_printText which has a 1024 limit.
  *
+ * Glyphs are accumulated into a run that is drawn with a single call.  Blocks
+ * of text printed with gl_printTextRaw are laid out once and kept in a small
+ * cache along with their vertices, so static text only needs a draw call.
+ *
  * @todo check if length is too long
  */
 
@@ -31,6 +35,11 @@
 #include "ndata.h"
 
 
+#define FONT_RUN_CHUNK     256 /**< Glyphs to grow the run by. */
+#define FONT_DRAW_MAX      16384 /**< Maximum glyphs in a single draw (16 bit indices). */
+#define FONT_CACHE_SIZE    64 /**< Text blocks kept in the layout cache. */
+
+
 /**
  * @brief Stores a font character.
  */
@@ -55,11 +64,54 @@ glFont gl_smallFont; /**< Small font. */
 glFont gl_defFontMono; /**< Default mono font. */
 
 
+/**
+ * @brief Cached layout of a block of text.
+ */
+typedef struct font_cache_s {
+   const glFont *font; /**< Font of the text. */
+   char *text; /**< Text laid out. */
+   uint32_t hash; /**< Hash of the text. */
+   int width; /**< Width the text was laid out to. */
+   int height; /**< Height the text was laid out to. */
+   int n; /**< Glyphs in the block. */
+   const glColour **src; /**< Colour escape of each glyph, NULL for base colour. */
+   GLfloat *col; /**< Colours of the vertices. */
+   glColour base; /**< Base colour the colours were generated with. */
+   const glColour *lastCol; /**< Colour escape active at the end of the text. */
+   gl_vbo *vbo; /**< Vertex, texture and colour planes of the block. */
+   unsigned int used; /**< Last time the entry was used. */
+} font_cache_t;
+
+
 /* Last used colour. */
 static const glColour *font_lastCol    = NULL; /**< Stores last colour used (activated by '\e'). */
 static int font_restoreLast      = 0; /**< Restore last colour. */
 
 
+/* Glyph run. */
+static const glFont *font_runFont = NULL; /**< Font of the current run. */
+static GLfloat *font_runVert     = NULL; /**< Vertex coordinates of the run. */
+static GLfloat *font_runTex      = NULL; /**< Texture coordinates of the run. */
+static GLfloat *font_runCol      = NULL; /**< Colours of the run. */
+static const glColour **font_runSrc = NULL; /**< Colour escape of each glyph of the run. */
+static int font_nrun             = 0; /**< Glyphs in the run. */
+static int font_mrun             = 0; /**< Memory allocated for the run. */
+static double font_penX          = 0.; /**< X position of the next glyph. */
+static double font_penY          = 0.; /**< Y position of the next glyph. */
+static GLfloat font_col[4];            /**< Current colour of the run. */
+static const glColour *font_src  = NULL; /**< Current colour escape of the run. */
+static GLushort *font_index      = NULL; /**< Indices to draw glyph quads as triangles. */
+static int font_mindex           = 0; /**< Glyphs font_index covers. */
+static gl_vbo *font_vbo          = NULL; /**< Streaming VBO runs are drawn from. */
+static int font_mvbo             = 0; /**< Glyphs that fit in font_vbo. */
+static int font_nfonts           = 0; /**< Loaded fonts, shared memory is freed with the last. */
+
+
+/* Layout cache. */
+static font_cache_t font_cache[FONT_CACHE_SIZE]; /**< Cached text blocks. */
+static unsigned int font_cacheTime = 0; /**< Clock for least recently used eviction. */
+
+
 /*
  * prototypes
  */
@@ -70,6 +122,16 @@ static const glColour* gl_fontGetColour( int ch );
 static void gl_fontRenderStart( const glFont* font, double x, double y, const glColour *c );
 static int gl_fontRenderCharacter( const glFont* font, int ch, const glColour *c, int state );
 static void gl_fontRenderEnd (void);
+static void font_setColour( GLfloat col[4], const glColour *src, const glColour *c );
+static void font_runGrow( int n );
+static void font_indexGrow( int n );
+static void font_runFlush (void);
+static void font_draw( const glFont *font, gl_vbo *vbo, int m, int n );
+/* Layout cache. */
+static uint32_t font_hash( const char *text );
+static font_cache_t* font_cacheGet( const glFont *ft_font, const char *text,
+      const int width, const int height );
+static void font_cacheFree( font_cache_t *e );
 
 
 /**
@@ -447,7 +509,8 @@ int gl_printMid( const glFont *ft_font, const int width,
 /**
  * @brief Prints a block of text that fits in the dimensions given.
  *
- * Positions are based on origin being top-left.
+ * Positions are based on origin being top-left.  The layout is cached so
+ *  printing the same text again only costs a draw call.
  *
  *    @param ft_font Font to use.
  *    @param width Maximum width to print to.
@@ -464,40 +527,50 @@ int gl_printTextRaw( const glFont *ft_font,
       double bx, double by,
       const glColour* c, const char *text )
 {
-   int ret, i, p, s;
-   double x,y;
+   int i, m;
+   double y;
+   font_cache_t *e;
+   glColour base;
 
    if (ft_font == NULL)
       ft_font = &gl_defFont;
 
-   x = bx;
    y = by + height - (double)ft_font->h; /* y is top left corner */
 
    /* Clears restoration. */
    gl_printRestoreClear();
 
-   s = 0;
-   p = 0; /* where we last drew up to */
-   while (y - by > -1e-5) {
-      ret = gl_printWidthForText( ft_font, &text[p], width );
-
-      /* Must restore stuff. */
-      gl_printRestoreLast();
-
-      /* Render it. */
-      gl_fontRenderStart(ft_font, x, y, c);
-      for (i=0; i < ret; i++)
-         s = gl_fontRenderCharacter( ft_font, text[p+i], c, s );
-      gl_fontRenderEnd();
+   /* Get the laid out text. */
+   e = font_cacheGet( ft_font, text, width, height );
+
+   /* Colours only need to be regenerated if the base colour changed. */
+   base = (c==NULL) ? cWhite : *c;
+   if ((e->n > 0) && (memcmp( &base, &e->base, sizeof(glColour) ) != 0)) {
+      for (i=0; i<e->n; i++) {
+         font_setColour( &e->col[ 16*i ], e->src[i], c );
+         memcpy( &e->col[ 16*i+4 ],  &e->col[ 16*i ], 4*sizeof(GLfloat) );
+         memcpy( &e->col[ 16*i+8 ],  &e->col[ 16*i ], 4*sizeof(GLfloat) );
+         memcpy( &e->col[ 16*i+12 ], &e->col[ 16*i ], 4*sizeof(GLfloat) );
+      }
+      m = e->n;
+      gl_vboSubData( e->vbo, m*4*(2+2)*sizeof(GLfloat),
+            m*4*4*sizeof(GLfloat), e->col );
+      e->base = base;
+   }
 
-      if (text[p+i] == '\0')
-         break;
-      p += i;
-      if ((text[p] == '\n') || (text[p] == ' '))
-         p++; /* Skip "empty char". */
-      y -= 1.5*(double)ft_font->h; /* move position down */
+   /* Render it. */
+   if (e->n > 0) {
+      gl_matrixMode(GL_MODELVIEW);
+      gl_matrixPush();
+         gl_matrixTranslate( round(bx), round(y) );
+      font_draw( ft_font, e->vbo, e->n, e->n );
+      gl_matrixPop();
+      gl_matrixMode( GL_PROJECTION );
    }
 
+   /* Leave the colour state as if it had been rendered. */
+   font_lastCol     = e->lastCol;
+   font_restoreLast = 0;
 
    return 0;
 }
@@ -709,8 +782,8 @@ static int font_genTextureAtlas( glFont* font, FT_Face face )
    int w, h, max_h;
    int offset;
    GLubyte *data;
-   GLfloat *vbo_tex;
-   GLshort *vbo_vert;
+   GLfloat *glyph_tex;
+   GLshort *glyph_vert;
    GLfloat tx, ty, txw, tyh;
    GLfloat fw, fh;
    GLshort vx, vy, vw, vh;
@@ -822,10 +895,10 @@ static int font_genTextureAtlas( glFont* font, FT_Face face )
    /* Check for errors. */
    gl_checkErr();
 
-   /* Create the VBOs. */
+   /* Create the glyph quads. */
    n           = 8 * 128;
-   vbo_tex     = malloc(sizeof(GLfloat) * n);
-   vbo_vert    = malloc(sizeof(GLshort) * n);
+   glyph_tex   = malloc(sizeof(GLfloat) * n);
+   glyph_vert  = malloc(sizeof(GLshort) * n);
    for (i=0; i<128; i++) {
       /* We do something like the following for vertex coordinates.
        *
@@ -862,68 +935,202 @@ static int font_genTextureAtlas( glFont* font, FT_Face face )
       vw  = chars[i].w;
       vh  = chars[i].h;
       /* Texture coords. */
-      vbo_tex[  8*i + 0 ] = tx;  /* Top left. */
-      vbo_tex[  8*i + 1 ] = ty;
-      vbo_tex[  8*i + 2 ] = txw; /* Top right. */
-      vbo_tex[  8*i + 3 ] = ty;
-      vbo_tex[  8*i + 4 ] = txw; /* Bottom right. */
-      vbo_tex[  8*i + 5 ] = tyh;
-      vbo_tex[  8*i + 6 ] = tx;  /* Bottom left. */
-      vbo_tex[  8*i + 7 ] = tyh;
+      glyph_tex[  8*i + 0 ] = tx;  /* Top left. */
+      glyph_tex[  8*i + 1 ] = ty;
+      glyph_tex[  8*i + 2 ] = txw; /* Top right. */
+      glyph_tex[  8*i + 3 ] = ty;
+      glyph_tex[  8*i + 4 ] = txw; /* Bottom right. */
+      glyph_tex[  8*i + 5 ] = tyh;
+      glyph_tex[  8*i + 6 ] = tx;  /* Bottom left. */
+      glyph_tex[  8*i + 7 ] = tyh;
       /* Vertex coords. */
-      vbo_vert[ 8*i + 0 ] = vx;    /* Top left. */
-      vbo_vert[ 8*i + 1 ] = vy+vh;
-      vbo_vert[ 8*i + 2 ] = vx+vw; /* Top right. */
-      vbo_vert[ 8*i + 3 ] = vy+vh;
-      vbo_vert[ 8*i + 4 ] = vx+vw; /* Bottom right. */
-      vbo_vert[ 8*i + 5 ] = vy;
-      vbo_vert[ 8*i + 6 ] = vx;    /* Bottom left. */
-      vbo_vert[ 8*i + 7 ] = vy;
+      glyph_vert[ 8*i + 0 ] = vx;    /* Top left. */
+      glyph_vert[ 8*i + 1 ] = vy+vh;
+      glyph_vert[ 8*i + 2 ] = vx+vw; /* Top right. */
+      glyph_vert[ 8*i + 3 ] = vy+vh;
+      glyph_vert[ 8*i + 4 ] = vx+vw; /* Bottom right. */
+      glyph_vert[ 8*i + 5 ] = vy;
+      glyph_vert[ 8*i + 6 ] = vx;    /* Bottom left. */
+      glyph_vert[ 8*i + 7 ] = vy;
    }
-   font->vbo_tex  = gl_vboCreateStatic( sizeof(GLfloat)*n, vbo_tex );
-   font->vbo_vert = gl_vboCreateStatic( sizeof(GLshort)*n, vbo_vert );
+   font->glyph_tex  = glyph_tex;
+   font->glyph_vert = glyph_vert;
 
    /* Free the data. */
    free(data);
-   free(vbo_tex);
-   free(vbo_vert);
 
    return 0;
 }
 
 
 /**
- * @brief Starts the rendering engine.
+ * @brief Sets a glyph colour.
+ *
+ *    @param[out] col Colour to set.
+ *    @param src Colour escape in use, NULL for the base colour.
+ *    @param c Base colour, NULL for white.
  */
-static void gl_fontRenderStart( const glFont* font, double x, double y, const glColour *c )
+static void font_setColour( GLfloat col[4], const glColour *src, const glColour *c )
 {
    double a;
 
+   a = (c==NULL) ? 1. : c->a;
+   if (src != NULL) {
+      col[0] = src->r;
+      col[1] = src->g;
+      col[2] = src->b;
+      col[3] = a;
+   }
+   else if (c != NULL) {
+      col[0] = c->r;
+      col[1] = c->g;
+      col[2] = c->b;
+      col[3] = c->a;
+   }
+   else {
+      col[0] = 1.;
+      col[1] = 1.;
+      col[2] = 1.;
+      col[3] = 1.;
+   }
+}
+
+
+/**
+ * @brief Makes sure the run can hold n glyphs.
+ */
+static void font_runGrow( int n )
+{
+   if (n <= font_mrun)
+      return;
+
+   font_mrun = MAX( n, font_mrun + FONT_RUN_CHUNK );
+   font_runVert = realloc( font_runVert, font_mrun*4*2*sizeof(GLfloat) );
+   font_runTex  = realloc( font_runTex,  font_mrun*4*2*sizeof(GLfloat) );
+   font_runCol  = realloc( font_runCol,  font_mrun*4*4*sizeof(GLfloat) );
+   font_runSrc  = realloc( font_runSrc,  font_mrun*sizeof(glColour*) );
+}
+
+
+/**
+ * @brief Makes sure there are indices to draw n glyphs at once.
+ */
+static void font_indexGrow( int n )
+{
+   int i, m;
+
+   n = MIN( n, FONT_DRAW_MAX );
+   if (n > font_mindex) {
+      m = MIN( FONT_DRAW_MAX, MAX( n, font_mindex + FONT_RUN_CHUNK ) );
+      font_index = realloc( font_index, m*6*sizeof(GLushort) );
+      /*
+       * Global  Local
+       * 0--1      0--1 4
+       * | /|  =>  | / /|
+       * |/ |      |/ / |
+       * 3--2      2 3--5
+       */
+      for (i=font_mindex; i<m; i++) {
+         font_index[ 6*i+0 ] = 4*i + 0;
+         font_index[ 6*i+1 ] = 4*i + 1;
+         font_index[ 6*i+2 ] = 4*i + 3;
+         font_index[ 6*i+3 ] = 4*i + 1;
+         font_index[ 6*i+4 ] = 4*i + 3;
+         font_index[ 6*i+5 ] = 4*i + 2;
+      }
+      font_mindex = m;
+   }
+}
+
+
+/**
+ * @brief Draws glyphs from a VBO.
+ *
+ *    @param font Font the glyphs belong to.
+ *    @param vbo VBO with the vertex, texture and colour planes.
+ *    @param m Glyphs each plane of the VBO holds.
+ *    @param n Glyphs to draw.
+ */
+static void font_draw( const glFont *font, gl_vbo *vbo, int m, int n )
+{
+   int i, k;
+
+   font_indexGrow( n );
+
    /* Enable textures. */
    glEnable(GL_TEXTURE_2D);
    glBindTexture( GL_TEXTURE_2D, font->texture);
 
-   /* Set up matrix. */
-   gl_matrixMode(GL_MODELVIEW);
-   gl_matrixPush();
-      gl_matrixTranslate( round(x), round(y) );
+   /* Draw the glyphs, as many at once as the indices allow. */
+   for (i=0; i<n; i+=FONT_DRAW_MAX) {
+      k = MIN( FONT_DRAW_MAX, n-i );
+      gl_vboActivateOffset( vbo, GL_VERTEX_ARRAY,
+            i*4*2*sizeof(GLfloat), 2, GL_FLOAT, 0 );
+      gl_vboActivateOffset( vbo, GL_TEXTURE_COORD_ARRAY,
+            (m+i)*4*2*sizeof(GLfloat), 2, GL_FLOAT, 0 );
+      gl_vboActivateOffset( vbo, GL_COLOR_ARRAY,
+            (m*4*(2+2) + i*4*4)*sizeof(GLfloat), 4, GL_FLOAT, 0 );
+      glDrawElements( GL_TRIANGLES, 6*k, GL_UNSIGNED_SHORT, font_index );
+      gl_renderCount( 4*k );
+   }
 
-   /* Handle colour. */
-   if (font_restoreLast) {
-      a   = (c==NULL) ? 1. : c->a;
-      ACOLOUR(*font_lastCol,a);
+   /* Clear state. */
+   gl_vboDeactivate();
+   glDisable(GL_TEXTURE_2D);
+
+   /* Check for errors. */
+   gl_checkErr();
+}
+
+
+/**
+ * @brief Draws the glyphs in the run and empties it.
+ */
+static void font_runFlush (void)
+{
+   int n;
+
+   if (font_nrun == 0)
+      return;
+   n = font_nrun;
+   font_nrun = 0;
+
+   /* Make sure the VBO is big enough. */
+   if (font_vbo == NULL) {
+      font_mvbo = font_mrun;
+      font_vbo  = gl_vboCreateStream( font_mvbo*4*(2+2+4)*sizeof(GLfloat), NULL );
    }
-   else {
-      if (c==NULL)
-         glColor4d( 1., 1., 1., 1. );
-      else
-         COLOUR(*c);
+   else if (font_mvbo < font_mrun) {
+      font_mvbo = font_mrun;
+      gl_vboData( font_vbo, font_mvbo*4*(2+2+4)*sizeof(GLfloat), NULL );
    }
-   font_restoreLast = 0;
 
-   /* Activate the appropriate VBOs. */
-   gl_vboActivateOffset( font->vbo_tex,  GL_TEXTURE_COORD_ARRAY, 0, 2, GL_FLOAT, 0 );
-   gl_vboActivateOffset( font->vbo_vert, GL_VERTEX_ARRAY, 0, 2, GL_SHORT, 0 );
+   /* Upload the used part of each plane. */
+   gl_vboSubData( font_vbo, 0, n*4*2*sizeof(GLfloat), font_runVert );
+   gl_vboSubData( font_vbo, font_mvbo*4*2*sizeof(GLfloat),
+         n*4*2*sizeof(GLfloat), font_runTex );
+   gl_vboSubData( font_vbo, font_mvbo*4*(2+2)*sizeof(GLfloat),
+         n*4*4*sizeof(GLfloat), font_runCol );
+
+   font_draw( font_runFont, font_vbo, font_mvbo, n );
+}
+
+
+/**
+ * @brief Starts the rendering engine.
+ */
+static void gl_fontRenderStart( const glFont* font, double x, double y, const glColour *c )
+{
+   /* Start the run. */
+   font_runFont = font;
+   font_nrun    = 0;
+   font_penX    = round(x);
+   font_penY    = round(y);
+
+   /* Handle colour. */
+   font_src = (font_restoreLast) ? font_lastCol : NULL;
+   font_setColour( font_col, font_src, c );
+   font_restoreLast = 0;
 }
 
 
@@ -971,49 +1178,41 @@ static const glColour* gl_fontGetColour( int ch )
  */
 static int gl_fontRenderCharacter( const glFont* font, int ch, const glColour *c, int state )
 {
-   GLushort ind[6];
-   double a;
-   const glColour *col;
+   int i, j;
+   GLfloat *vert, *tex, *col;
 
    /* Handle escape sequences. */
    if (ch == '\e') /* Start sequence. */
       return 1;
    if (state == 1) {
-      col = gl_fontGetColour( ch );
-      a   = (c==NULL) ? 1. : c->a;
-      if (col == NULL) {
-         if (c==NULL)
-            glColor4d( 1., 1., 1., 1. );
-         else
-            COLOUR(*c);
-      }
-      else
-         ACOLOUR(*col,a);
-      font_lastCol = col;
+      font_src = gl_fontGetColour( ch );
+      font_setColour( font_col, font_src, c );
+      font_lastCol = font_src;
       return 0;
    }
 
    if (!isspace(ch)) {
-      /*
-       * Global  Local
-       * 0--1      0--1 4
-       * | /|  =>  | / /|
-       * |/ |      |/ / |
-       * 3--2      2 3--5
-       */
-      ind[0] = 4*ch + 0;
-      ind[1] = 4*ch + 1;
-      ind[2] = 4*ch + 3;
-      ind[3] = 4*ch + 1;
-      ind[4] = 4*ch + 3;
-      ind[5] = 4*ch + 2;
-
-      /* Draw the element. */
-      glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, ind );
+      font_runGrow( font_nrun+1 );
+
+      /* Add the glyph quad at the pen position. */
+      vert = &font_runVert[ 8*font_nrun ];
+      tex  = &font_runTex[ 8*font_nrun ];
+      col  = &font_runCol[ 16*font_nrun ];
+      for (i=0; i<4; i++) {
+         vert[ 2*i+0 ] = font_penX + font->glyph_vert[ 8*ch + 2*i+0 ];
+         vert[ 2*i+1 ] = font_penY + font->glyph_vert[ 8*ch + 2*i+1 ];
+         tex[ 2*i+0 ]  = font->glyph_tex[ 8*ch + 2*i+0 ];
+         tex[ 2*i+1 ]  = font->glyph_tex[ 8*ch + 2*i+1 ];
+         for (j=0; j<4; j++)
+            col[ 4*i+j ] = font_col[j];
+      }
+      font_runSrc[ font_nrun ] = font_src;
+      font_nrun++;
    }
 
-   /* Translate matrix. */
-   gl_matrixTranslate( font->chars[ch].adv_x, font->chars[ch].adv_y );
+   /* Move pen. */
+   font_penX += font->chars[ch].adv_x;
+   font_penY += font->chars[ch].adv_y;
 
    return 0;
 }
@@ -1024,13 +1223,123 @@ static int gl_fontRenderCharacter( const glFont* font, int ch, const glColour *c
  */
 static void gl_fontRenderEnd (void)
 {
-   gl_vboDeactivate();
-   gl_matrixPop();
-   gl_matrixMode( GL_PROJECTION );
-   glDisable(GL_TEXTURE_2D);
+   font_runFlush();
+}
 
-   /* Check for errors. */
-   gl_checkErr();
+
+/**
+ * @brief Hashes a string for the layout cache.
+ */
+static uint32_t font_hash( const char *text )
+{
+   uint32_t hash;
+   const unsigned char *c;
+
+   /* FNV-1a. */
+   hash = 2166136261u;
+   for (c=(const unsigned char*)text; *c != '\0'; c++) {
+      hash ^= *c;
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+
+/**
+ * @brief Frees a layout cache entry.
+ */
+static void font_cacheFree( font_cache_t *e )
+{
+   free( e->text );
+   free( e->src );
+   free( e->col );
+   if (e->vbo != NULL)
+      gl_vboDestroy( e->vbo );
+   memset( e, 0, sizeof(font_cache_t) );
+}
+
+
+/**
+ * @brief Gets the layout of a block of text, laying it out if not cached.
+ *
+ * The glyphs are laid out relative to the top left line like
+ *  gl_printTextRaw renders them.  Colours are left for the caller to fill.
+ *
+ *    @param ft_font Font to use.
+ *    @param text Text to lay out.
+ *    @param width Maximum width to print to.
+ *    @param height Maximum height to print to.
+ *    @return The cached layout.
+ */
+static font_cache_t* font_cacheGet( const glFont *ft_font, const char *text,
+      const int width, const int height )
+{
+   int i, p, s, ret, n;
+   double yoff;
+   uint32_t hash;
+   font_cache_t *e;
+
+   font_cacheTime++;
+   hash = font_hash( text );
+
+   /* Look in the cache, picking the least recently used slot otherwise. */
+   e = &font_cache[0];
+   for (i=0; i<FONT_CACHE_SIZE; i++) {
+      if ((font_cache[i].font == ft_font) && (font_cache[i].hash == hash) &&
+            (font_cache[i].width == width) && (font_cache[i].height == height) &&
+            (strcmp( font_cache[i].text, text ) == 0)) {
+         font_cache[i].used = font_cacheTime;
+         return &font_cache[i];
+      }
+      if (font_cache[i].used < e->used)
+         e = &font_cache[i];
+   }
+   font_cacheFree( e );
+
+   /* Lay out the text into the run. */
+   gl_fontRenderStart( ft_font, 0., 0., NULL );
+   yoff = 0.;
+   s = 0;
+   p = 0; /* where we last drew up to */
+   while (height - ft_font->h + yoff > -1e-5) {
+      ret = gl_printWidthForText( ft_font, &text[p], width );
+
+      font_penX = 0.;
+      font_penY = round(yoff);
+      for (i=0; i < ret; i++)
+         s = gl_fontRenderCharacter( ft_font, text[p+i], NULL, s );
+
+      if (text[p+i] == '\0')
+         break;
+      p += i;
+      if ((text[p] == '\n') || (text[p] == ' '))
+         p++; /* Skip "empty char". */
+      yoff -= 1.5*(double)ft_font->h; /* move position down */
+   }
+
+   /* Store it. */
+   n = font_nrun;
+   font_nrun   = 0;
+   e->font     = ft_font;
+   e->text     = strdup( text );
+   e->hash     = hash;
+   e->width    = width;
+   e->height   = height;
+   e->n        = n;
+   e->lastCol  = font_lastCol;
+   e->used     = font_cacheTime;
+   e->base.a   = -1.; /* Forces colours to be generated. */
+   if (n > 0) {
+      e->src = malloc( n*sizeof(glColour*) );
+      memcpy( e->src, font_runSrc, n*sizeof(glColour*) );
+      e->col = malloc( n*4*4*sizeof(GLfloat) );
+      e->vbo = gl_vboCreateStatic( n*4*(2+2+4)*sizeof(GLfloat), NULL );
+      gl_vboSubData( e->vbo, 0, n*4*2*sizeof(GLfloat), font_runVert );
+      gl_vboSubData( e->vbo, n*4*2*sizeof(GLfloat),
+            n*4*2*sizeof(GLfloat), font_runTex );
+   }
+
+   return e;
 }
 
 
@@ -1099,6 +1408,7 @@ void gl_fontInit( glFont* font, const char *fname, const unsigned int h )
 
    /* Generate the font atlas. */
    font_genTextureAtlas( font, face );
+   font_nfonts++;
 
    /* we can now free the face and library */
    FT_Done_Face(face);
@@ -1113,16 +1423,44 @@ void gl_fontInit( glFont* font, const char *fname, const unsigned int h )
  */
 void gl_freeFont( glFont* font )
 {
+   int i;
+
    if (font == NULL)
       font = &gl_defFont;
+
+   /* Drop cached text. */
+   for (i=0; i<FONT_CACHE_SIZE; i++)
+      if (font_cache[i].font == font)
+         font_cacheFree( &font_cache[i] );
+
    glDeleteTextures(1,&font->texture);
    if (font->chars != NULL)
       free(font->chars);
    font->chars = NULL;
-   if (font->vbo_tex != NULL)
-      gl_vboDestroy(font->vbo_tex);
-   font->vbo_tex = NULL;
-   if (font->vbo_vert != NULL)
-      gl_vboDestroy(font->vbo_vert);
-   font->vbo_vert = NULL;
+   free(font->glyph_tex);
+   font->glyph_tex = NULL;
+   free(font->glyph_vert);
+   font->glyph_vert = NULL;
+
+   /* Free the shared memory with the last font. */
+   font_nfonts--;
+   if (font_nfonts <= 0) {
+      free(font_runVert);
+      free(font_runTex);
+      free(font_runCol);
+      free(font_runSrc);
+      free(font_index);
+      font_runVert = NULL;
+      font_runTex  = NULL;
+      font_runCol  = NULL;
+      font_runSrc  = NULL;
+      font_index   = NULL;
+      font_mrun    = 0;
+      font_mindex  = 0;
+      if (font_vbo != NULL)
+         gl_vboDestroy( font_vbo );
+      font_vbo     = NULL;
+      font_mvbo    = 0;
+      font_nfonts  = 0;
+   }
 }
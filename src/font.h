@@ -26,8 +26,8 @@ typedef struct glFontChar_s {
 typedef struct glFont_s {
    int h; /**< Font height. */
    GLuint texture; /**< Font atlas. */
-   gl_vbo *vbo_tex; /**< VBO associated to texture coordinates. */
-   gl_vbo *vbo_vert; /**< VBO associated to vertex coordinates. */
+   GLfloat *glyph_tex; /**< Texture coordinates of each glyph quad. */
+   GLshort *glyph_vert; /**< Vertex coordinates of each glyph quad. */
    glFontChar *chars; /**< Characters in the font. */
 } glFont;
 extern glFont gl_defFont; /**< Default font. */
@@ -2098,18 +2098,18 @@ int gui_load( const char* name )
 
    /* Clean up. */
    if (gui_L != NULL) {
-      lua_close( gui_L );
+      nlua_closeState( gui_L );
       gui_L = NULL;
    }
 
    /* Create Lua state. */
-   gui_L = nlua_newState();
+   gui_L = nlua_newState( path );
    if (luaL_dobuffer( gui_L, buf, bufsize, path ) != 0) {
       WARN("Failed to load GUI Lua: %s\n"
             "%s\n"
             "Most likely Lua file has improper syntax, please check",
             path, lua_tostring(gui_L,-1));
-      lua_close( gui_L );
+      nlua_closeState( gui_L );
       gui_L = NULL;
       free(buf);
       return -1;
@@ -2121,7 +2121,7 @@ int gui_load( const char* name )
 
    /* Run create function. */
    if (gui_doFunc( "create" )) {
-      lua_close( gui_L );
+      nlua_closeState( gui_L );
       gui_L = NULL;
    }
 
@@ -2253,7 +2253,7 @@ void gui_cleanup (void)
 
    /* Destroy lua. */
    if (gui_L != NULL) {
-      lua_close( gui_L );
+      nlua_closeState( gui_L );
       gui_L = NULL;
    }
 
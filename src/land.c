@@ -1394,6 +1394,9 @@ void land( Planet* p, int load )
    /* Create all the windows. */
    land_genWindows( load, 0 );
 
+   /* Good time to collect all the Lua garbage since nothing is moving. */
+   nlua_gcFull();
+
    /* Hack so that load can run player.takeoff(). */
    if (load)
       hooks_run( "load" );
@@ -1661,7 +1664,7 @@ static void land_stranded (void)
       return;
 
    if (rescue_L == NULL) {
-      rescue_L = nlua_newState();
+      rescue_L = nlua_newState( file );
       nlua_loadStandard( rescue_L, 0 );
       nlua_loadTk( rescue_L );
 
@@ -1738,7 +1741,7 @@ void land_cleanup (void)
 
    /* Clean up rescue Lua. */
    if (rescue_L != NULL) {
-      lua_close(rescue_L);
+      nlua_closeState(rescue_L);
       rescue_L = NULL;
    }
 }
@@ -14,6 +14,7 @@
 #include "naev.h"
 
 #include "nxml.h"
+#include "libxml/xmlreader.h"
 #include "log.h"
 #include "player.h"
 #include "nfile.h"
@@ -33,6 +34,7 @@
 #include "hook.h"
 #include "nstring.h"
 #include "outfit.h"
+#include "save.h"
 
 
 #define LOAD_WIDTH      600 /**< Load window width. */
@@ -76,30 +78,146 @@ static void load_menu_close( unsigned int wdw, char *str );
 static void load_menu_load( unsigned int wdw, char *str );
 static void load_menu_delete( unsigned int wdw, char *str );
 static int load_load( nsave_t *save, const char *path );
+static void load_loadVersion( nsave_t *save, xmlNodePtr parent, char **version );
+static int load_loadPlayerNode( nsave_t *save, xmlNodePtr node );
+static int load_loadPlayer( nsave_t *save, xmlTextReaderPtr reader );
+
+
+/**
+ * @brief Loads the version of a save.
+ */
+static void load_loadVersion( nsave_t *save, xmlNodePtr parent, char **version )
+{
+   xmlNodePtr node;
+
+   node = parent->xmlChildrenNode;
+   do {
+      xmlr_strd(node,"naev",*version);
+      xmlr_strd(node,"data",save->data);
+   } while (xml_nextNode(node));
+}
+
+
+/**
+ * @brief Loads a node of the player summary of a save.
+ *
+ *    @return 1 if it was the ship node which comes last, 0 otherwise.
+ */
+static int load_loadPlayerNode( nsave_t *save, xmlNodePtr node )
+{
+   xmlNodePtr cur;
+   int scu, stp, stu;
+
+   /* Player info. */
+   if (xml_isNode(node,"location")) {
+      save->planet = xml_getStrd(node);
+      return 0;
+   }
+   if (xml_isNode(node,"credits")) {
+      save->credits = xml_getULong(node);
+      return 0;
+   }
+
+   /* Time. */
+   if (xml_isNode(node,"time")) {
+      cur = node->xmlChildrenNode;
+      scu = stp = stu = 0;
+      do {
+         xmlr_int(cur,"SCU",scu);
+         xmlr_int(cur,"STP",stp);
+         xmlr_int(cur,"STU",stu);
+      } while (xml_nextNode(cur));
+      save->date = ntime_create( scu, stp, stu );
+      return 0;
+   }
+
+   /* Ship info. */
+   if (xml_isNode(node,"ship")) {
+      xmlr_attr(node,"name",save->shipname);
+      xmlr_attr(node,"model",save->shipmodel);
+      return 1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Loads the player summary from the node the reader is at.
+ *
+ * Only the small nodes are expanded, the rest of the player data is skipped
+ *  without building it.
+ *
+ *    @param save Save to load into.
+ *    @param reader Reader positioned at the header or player node.
+ *    @return 0 on success.
+ */
+static int load_loadPlayer( nsave_t *save, xmlTextReaderPtr reader )
+{
+   int depth, ret;
+   xmlNodePtr node;
+   const char *name;
+
+   /* Get name. */
+   save->name = (char*)xmlTextReaderGetAttribute( reader, (xmlChar*)"name" );
+   if (xmlTextReaderIsEmptyElement( reader ))
+      return 0;
+
+   /* Parse children. */
+   depth = xmlTextReaderDepth( reader );
+   ret   = xmlTextReaderRead( reader );
+   while ((ret == 1) && (xmlTextReaderDepth( reader ) > depth)) {
+      if (xmlTextReaderNodeType( reader ) != XML_READER_TYPE_ELEMENT) {
+         ret = xmlTextReaderRead( reader );
+         continue;
+      }
+
+      name = (const char*)xmlTextReaderConstName( reader );
+      if ((strcmp(name,"location")==0) || (strcmp(name,"credits")==0) ||
+            (strcmp(name,"time")==0) || (strcmp(name,"ship")==0)) {
+         node = xmlTextReaderExpand( reader );
+         if ((node != NULL) && load_loadPlayerNode( save, node ))
+            break; /* Nothing interesting after the ship. */
+      }
+
+      /* Skip the whole node. */
+      ret = xmlTextReaderNext( reader );
+   }
+
+   return (ret < 0) ? -1 : 0;
+}
 
 
 /**
  * @brief Loads an individual save.
+ *
+ * Saves are read with a streaming reader that stops once it has the header,
+ *  older saves without header are read up to the player's current ship.
  */
 static int load_load( nsave_t *save, const char *path )
 {
-   xmlDocPtr doc;
-   xmlNodePtr root, parent, node, cur;
-   int scu, stp, stu;
+   xmlTextReaderPtr reader;
+   xmlNodePtr node;
+   const char *name;
+   int ret, done;
    char *version = NULL;
 
    memset( save, 0, sizeof(nsave_t) );
 
-   /* Load the XML. */
-   doc   = xmlParseFile(path);
-   if (doc == NULL) {
+   /* Open the XML. */
+   reader = xmlReaderForFile( path, NULL, 0 );
+   if (reader == NULL) {
       WARN("Unable to parse save path '%s'.", path);
       return -1;
    }
-   root = doc->xmlChildrenNode; /* base node */
-   if (root == NULL) {
+
+   /* Get to the base node. */
+   do {
+      ret = xmlTextReaderRead( reader );
+   } while ((ret == 1) && (xmlTextReaderNodeType( reader ) != XML_READER_TYPE_ELEMENT));
+   if ((ret != 1) || xmlTextReaderIsEmptyElement( reader )) {
       WARN("Unable to get child node of save '%s'.",path);
-      xmlFreeDoc(doc);
+      xmlFreeTextReader( reader );
       return -1;
    }
 
@@ -107,55 +225,32 @@ static int load_load( nsave_t *save, const char *path )
    save->path = strdup(path);
 
    /* Iterate inside the naev_save. */
-   parent = root->xmlChildrenNode;
-   do {
-      xml_onlyNodes(parent);
+   done = 0;
+   ret  = xmlTextReaderRead( reader );
+   while (!done && (ret == 1) && (xmlTextReaderDepth( reader ) > 0)) {
+      if (xmlTextReaderNodeType( reader ) != XML_READER_TYPE_ELEMENT) {
+         ret = xmlTextReaderRead( reader );
+         continue;
+      }
+      name = (const char*)xmlTextReaderConstName( reader );
 
       /* Info. */
-      if (xml_isNode(parent,"version")) {
-         node = parent->xmlChildrenNode;
-         do {
-            xmlr_strd(node,"naev",version);
-            xmlr_strd(node,"data",save->data);
-         } while (xml_nextNode(node));
-         continue;
+      if (strcmp(name,"version")==0) {
+         node = xmlTextReaderExpand( reader );
+         if (node != NULL)
+            load_loadVersion( save, node, &version );
       }
 
-      if (xml_isNode(parent,"player")) {
-         /* Get name. */
-         xmlr_attr(parent,"name",save->name);
-         /* Parse rest. */
-         node = parent->xmlChildrenNode;
-         do {
-            xml_onlyNodes(node);
-
-            /* Player info. */
-            xmlr_strd(node,"location",save->planet);
-            xmlr_ulong(node,"credits",save->credits);
-
-            /* Time. */
-            if (xml_isNode(node,"time")) {
-               cur = node->xmlChildrenNode;
-               scu = stp = stu = 0;
-               do {
-                  xmlr_int(cur,"SCU",scu);
-                  xmlr_int(cur,"STP",stp);
-                  xmlr_int(cur,"STU",stu);
-               } while (xml_nextNode(cur));
-               save->date = ntime_create( scu, stp, stu );
-               continue;
-            }
-
-            /* Ship info. */
-            if (xml_isNode(node,"ship")) {
-               xmlr_attr(node,"name",save->shipname);
-               xmlr_attr(node,"model",save->shipmodel);
-               continue;
-            }
-         } while (xml_nextNode(node));
+      /* Header or player data of old saves, the rest isn't needed. */
+      else if ((strcmp(name,"header")==0) || (strcmp(name,"player")==0)) {
+         load_loadPlayer( save, reader );
+         done = 1;
          continue;
       }
-   } while (xml_nextNode(parent));
+
+      /* Skip the whole node. */
+      ret = xmlTextReaderNext( reader );
+   }
 
    /* Handle version. */
    if (version != NULL) {
@@ -164,7 +259,7 @@ static int load_load( nsave_t *save, const char *path )
    }
 
    /* Clean up. */
-   xmlFreeDoc(doc);
+   xmlFreeTextReader( reader );
 
    return 0;
 }
@@ -180,6 +275,9 @@ int load_refresh (void)
    int ok;
    nsave_t *ns;
 
+   /* Make sure the last save is on disk. */
+   save_sync();
+
    if (load_saves != NULL)
       load_free();
    load_saves = array_create( nsave_t );
@@ -542,6 +640,9 @@ int load_game( const char* file, int version_diff )
    xmlDocPtr doc;
    Planet *pnt;
 
+   /* Don't read a save that's still being written. */
+   save_sync();
+
    /* Make sure it exists. */
    if (!nfile_fileExists(file)) {
       dialogue_alert("Savegame file seems to have been deleted.");
@@ -38,6 +38,7 @@
 #include "npc.h"
 #include "array.h"
 #include "land.h"
+#include "conf.h"
 
 
 #define XML_MISSION_ID        "Missions" /**< XML document identifier */
@@ -177,11 +178,12 @@ static int mission_init( Mission* mission, MissionData* misn, int genid, int cre
    }
 
    /* init Lua */
-   mission->L = nlua_newState();
+   mission->L = nlua_newState( misn->name );
    if (mission->L == NULL) {
       WARN("Unable to create a new Lua state.");
       return -1;
    }
+   nlua_setBudget( mission->L, conf.lua_budget );
    nlua_loadBasic( mission->L ); /* pairs and such */
    misn_loadLibs( mission->L ); /* load our custom libraries */
 
@@ -534,7 +536,7 @@ void mission_cleanup( Mission* misn )
    if (misn->osd > 0)
       osd_destroy(misn->osd);
    if (misn->L)
-      lua_close(misn->L);
+      nlua_closeState(misn->L);
 
    /* Data. */
    if (misn->title != NULL)
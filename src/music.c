@@ -546,7 +546,7 @@ static int music_luaInit (void)
    if (music_lua != NULL)
       music_luaQuit();
 
-   music_lua = nlua_newState();
+   music_lua = nlua_newState( MUSIC_LUA_PATH );
    nlua_loadBasic(music_lua);
    nlua_loadStandard(music_lua,1);
    nlua_loadMusic(music_lua,0); /* write it */
@@ -577,7 +577,7 @@ static void music_luaQuit (void)
    if (music_lua == NULL)
       return;
 
-   lua_close(music_lua);
+   nlua_closeState(music_lua);
    music_lua = NULL;
 }
 
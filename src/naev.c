@@ -70,6 +70,7 @@
 #include "economy.h"
 #include "menu.h"
 #include "mission.h"
+#include "nlua.h"
 #include "nlua_misn.h"
 #include "nfile.h"
 #include "nebula.h"
@@ -94,6 +95,7 @@
 #include "start.h"
 #include "threadpool.h"
 #include "load.h"
+#include "save.h"
 #include "options.h"
 #include "dialogue.h"
 #include "slots.h"
@@ -669,6 +671,9 @@ static void loadscreen_unload (void)
    if (loading != NULL)
       gl_freeTexture(loading);
    loading = NULL;
+
+   /* Collect the garbage loading the Lua states made. */
+   nlua_gcFull();
 }
 
 
@@ -718,6 +723,7 @@ void load_all (void)
 void unload_all (void)
 {
    /* cleanup some stuff */
+   save_sync(); /* make sure the last save hit the disk */
    player_cleanup(); /* cleans up the player stuff */
    gui_free(); /* cleans up the player's GUI */
    weapon_exit(); /* destroys all active weapons */
@@ -727,6 +733,7 @@ void unload_all (void)
    npc_clear(); /* In case exiting while landed. */
    background_free(); /* Destroy backgrounds. */
    load_free(); /* Clean up loading game stuff stuff. */
+   diff_free(); /* Frees the parsed universe diffs. */
    economy_destroy(); /* must be called before space_exit */
    space_exit(); /* cleans up the universe itself */
    tech_free(); /* Frees tech stuff. */
@@ -766,6 +773,7 @@ void main_loop( int update )
       player_updateAutonav( real_dt );
       update_all(); /* update game */
    }
+   nlua_gcUpdate(); /* Spread Lua garbage collection over the frames. */
 
    /*
     * Handle render.
@@ -1094,6 +1102,13 @@ static double fps_cur = 0.; /**< FPS accumulator to trigger change. */
 static void display_fps( const double dt )
 {
    double x,y;
+#ifdef DEBUGGING
+   int wused, walloced, wmallocs;
+   int draws, vertices;
+   int nstates;
+   nlua_MemStats lmem;
+   int vreal, vvirtual, vsteals, vrestores;
+#endif /* DEBUGGING */
 
    fps_dt  += dt;
    fps_cur += 1.;
@@ -1107,7 +1122,26 @@ static void display_fps( const double dt )
    if (conf.fps_show) {
       gl_print( NULL, x, y, NULL, "%3.2f", fps );
       y -= gl_defFont.h + 5.;
+#ifdef DEBUGGING
+      weapon_allocStats( &wused, &walloced, &wmallocs );
+      gl_print( NULL, x, y, NULL, "Weapons: %d/%d (%d allocs)",
+            wused, walloced, wmallocs );
+      y -= gl_defFont.h + 5.;
+      gl_renderStats( &draws, &vertices );
+      gl_print( NULL, x, y, NULL, "Draws: %d (%d vertices)",
+            draws, vertices );
+      y -= gl_defFont.h + 5.;
+      nstates = nlua_memStats( &lmem );
+      gl_print( NULL, x, y, NULL, "Lua: %lu KB in %d states (%lu allocs)",
+            (unsigned long)(lmem.live >> 10), nstates, lmem.nallocs );
+      y -= gl_defFont.h + 5.;
+      sound_voiceStats( &vreal, &vvirtual, &vsteals, &vrestores );
+      gl_print( NULL, x, y, NULL, "Voices: %d real, %d virtual (%d/%d swaps)",
+            vreal, vvirtual, vsteals, vrestores );
+      y -= gl_defFont.h + 5.;
+#endif /* DEBUGGING */
    }
+   gl_renderStatsReset();
    if (dt_mod != 1.)
       gl_print( NULL, x, y, NULL, "%3.1fx", dt_mod);
 
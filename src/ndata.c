@@ -21,6 +21,11 @@
  *  5) Makefile version
  *  6) ./ndata*
  *  7) dirname(argv[0])/ndata* (binary path)
+ *
+ * Loose files are resolved once and the resulting path is cached, archive
+ *  files are looked up in an index of the archive built when it's opened.
+ *  ndata_map can be used instead of ndata_read for data that is only read,
+ *  loose files are then memory mapped instead of copied.
  */
 
 #include "ndata.h"
@@ -29,6 +34,10 @@
 
 #if HAS_POSIX
 #include <libgen.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif /* HAS_POSIX */
 #if HAS_WIN32
 #include <windows.h>
@@ -60,6 +69,8 @@
 #define NDATA_SRC_NDATADEF       2
 #define NDATA_SRC_BINARY         3
 
+#define NDATA_PATHS_MIN          256 /**< Minimum size of the resolved path table. */
+
 
 /*
  * ndata archive.
@@ -77,6 +88,36 @@ static int ndata_source             = 0;
  */
 static char **ndata_fileList  = NULL; /**< List of files in the archive. */
 static uint32_t ndata_fileNList     = 0; /**< Number of files in ndata_fileList. */
+static NZipEntry *ndata_entries     = NULL; /**< Index of the archive. */
+static int ndata_nentries           = 0; /**< Number of entries in the index. */
+
+
+/**
+ * @brief A loose file resolved to a path on disk.
+ */
+typedef struct NDataPath_ {
+   char *name; /**< Name of the file in the ndata. */
+   char *path; /**< Path of the file on disk. */
+   int src; /**< Source the file was found in. */
+} NDataPath;
+
+
+/*
+ * Resolved loose files.
+ */
+static NDataPath *ndata_paths       = NULL; /**< Hash table of resolved files. */
+static int ndata_npaths             = 0; /**< Number of resolved files. */
+static int ndata_mpaths             = 0; /**< Size of the table (power of two). */
+static char *ndata_defDir           = NULL; /**< Directory of NDATA_DEF. */
+static char *ndata_binDir           = NULL; /**< Directory of the binary. */
+
+
+/*
+ * Memory mapped files.
+ */
+static void **ndata_maps            = NULL; /**< Currently mapped files. */
+static int ndata_nmaps              = 0; /**< Number of mapped files. */
+static int ndata_mmaps              = 0; /**< Memory allocated for ndata_maps. */
 
 
 /*
@@ -94,6 +135,16 @@ static char** ndata_listBackend( const char* path, uint32_t* nfiles, int dirs );
 static char **stripPath( const char **list, int nlist, const char *path );
 static char** filterList( const char** list, int nlist,
       const char* path, uint32_t* nfiles, int recursive );
+static uint32_t ndata_hash( const char *name );
+static NDataPath* ndata_pathGet( const char *name );
+static void ndata_pathAdd( const char *name, const char *path, int src );
+static void ndata_pathClear (void);
+static int ndata_srcPath( int src, const char *filename, char *path, size_t len );
+static int ndata_resolve( const char *filename, char *path, size_t len );
+static NZipEntry* ndata_getEntry( const char *filename );
+#if HAS_POSIX
+static void* ndata_mapFile( const char *path, uint32_t *filesize );
+#endif /* HAS_POSIX */
 
 
 /**
@@ -127,6 +178,9 @@ int ndata_setPath( const char* path )
    ndata_filename = NULL;
    ndata_dirname  = NULL;
 
+   /* Files may resolve differently now. */
+   ndata_pathClear();
+
    if (path == NULL)
       return 0;
    else if (nfile_dirExists(path)) {
@@ -464,6 +518,8 @@ static int ndata_openFile (void)
    ndata_archive = nzip_open( ndata_filename );
    if (ndata_archive == NULL)
       WARN("Unable to open ndata from '%s'.", ndata_filename );
+   else
+      ndata_entries = nzip_index( ndata_archive, &ndata_nentries );
 
    /* Close lock. */
    SDL_mutexV(ndata_lock);
@@ -557,6 +613,27 @@ void ndata_close (void)
       ndata_fileNList = 0;
    }
 
+   /* Destroy the index. */
+   nzip_freeIndex( ndata_entries, ndata_nentries );
+   ndata_entries  = NULL;
+   ndata_nentries = 0;
+
+   /* Destroy the resolved files. */
+   ndata_pathClear();
+   free(ndata_paths);
+   ndata_paths  = NULL;
+   ndata_mpaths = 0;
+   free(ndata_defDir);
+   free(ndata_binDir);
+   ndata_defDir = NULL;
+   ndata_binDir = NULL;
+
+   /* Mapped files should be gone by now. */
+   free(ndata_maps);
+   ndata_maps  = NULL;
+   ndata_nmaps = 0;
+   ndata_mmaps = 0;
+
    /* Close the archive. */
    if (ndata_archive) {
       nzip_close(ndata_archive);
@@ -611,52 +688,221 @@ const char* ndata_getDirname(void)
 
 
 /**
- * @brief Checks to see if a file is in the NDATA.
- *    @param filename Name of the file to check.
- *    @return 1 if the file exists, 0 otherwise.
+ * @brief Hashes a file name.
  */
-int ndata_exists( const char* filename )
+static uint32_t ndata_hash( const char *name )
 {
-   char *buf, path[PATH_MAX];
+   uint32_t h;
 
-   /* See if needs to load ndata archive. */
-   if (ndata_archive == NULL) {
+   h = 2166136261u;
+   while (*name != '\0') {
+      h ^= (unsigned char)*name++;
+      h *= 16777619u;
+   }
+   return h;
+}
 
-      /* Try to read the file as locally. */
-      if (nfile_fileExists( filename ) && (ndata_source <= NDATA_SRC_LAIDOUT))
-         return 1;
 
-      /* We can try to use the dirname path. */
-      if ((ndata_filename == NULL) && (ndata_dirname != NULL) &&
-            (ndata_source <= NDATA_SRC_DIRNAME)) {
-         nsnprintf( path, sizeof(path), "%s/%s", ndata_dirname, filename );
-         if (nfile_fileExists( path ))
-            return 1;
-      }
+/**
+ * @brief Gets the resolved path of a loose file.
+ *
+ *    @param name Name of the file in the ndata.
+ *    @return The resolved path or NULL if not resolved yet.
+ */
+static NDataPath* ndata_pathGet( const char *name )
+{
+   uint32_t i;
 
-      /* We can also try default location. */
-      if (ndata_source <= NDATA_SRC_NDATADEF) {
-         buf = strdup( NDATA_DEF );
-         nsnprintf( path, sizeof(path), "%s/%s", nfile_dirname(buf), filename );
-         free(buf);
-         if (nfile_fileExists( path ))
-            return 1;
-      }
+   if (ndata_npaths == 0)
+      return NULL;
 
-      /* Try binary location. */
-      if (ndata_source <= NDATA_SRC_BINARY) {
-         buf = strdup( naev_binary() );
-         nsnprintf( path, sizeof(path), "%s/%s", nfile_dirname(buf), filename );
-         free(buf);
-         if (nfile_fileExists( path ))
-            return 1;
+   for (i=ndata_hash(name) & (ndata_mpaths-1); ndata_paths[i].name != NULL;
+         i = (i+1) & (ndata_mpaths-1))
+      if (strcmp(ndata_paths[i].name, name)==0)
+         return &ndata_paths[i];
+   return NULL;
+}
+
+
+/**
+ * @brief Remembers the resolved path of a loose file.
+ *
+ *    @param name Name of the file in the ndata.
+ *    @param path Path of the file on disk.
+ *    @param src Source the file was found in.
+ */
+static void ndata_pathAdd( const char *name, const char *path, int src )
+{
+   NDataPath *old, *e;
+   int i, mold;
+   uint32_t j;
+
+   /* Might just be stale. */
+   e = ndata_pathGet( name );
+   if (e != NULL) {
+      free(e->path);
+      e->path = strdup(path);
+      e->src  = src;
+      return;
+   }
+
+   /* Keep the table at most half full. */
+   if (2*(ndata_npaths+1) > ndata_mpaths) {
+      old   = ndata_paths;
+      mold  = ndata_mpaths;
+      ndata_mpaths = MAX( NDATA_PATHS_MIN, 2*mold );
+      ndata_paths  = calloc( ndata_mpaths, sizeof(NDataPath) );
+      for (i=0; i<mold; i++) {
+         if (old[i].name == NULL)
+            continue;
+         for (j=ndata_hash(old[i].name) & (ndata_mpaths-1); ndata_paths[j].name != NULL;
+               j = (j+1) & (ndata_mpaths-1));
+         ndata_paths[j] = old[i];
       }
+      free(old);
+   }
 
-      return 0;
+   for (j=ndata_hash(name) & (ndata_mpaths-1); ndata_paths[j].name != NULL;
+         j = (j+1) & (ndata_mpaths-1));
+   ndata_paths[j].name = strdup(name);
+   ndata_paths[j].path = strdup(path);
+   ndata_paths[j].src  = src;
+   ndata_npaths++;
+}
+
+
+/**
+ * @brief Forgets all the resolved loose files.
+ */
+static void ndata_pathClear (void)
+{
+   int i;
+
+   for (i=0; i<ndata_mpaths; i++) {
+      free(ndata_paths[i].name);
+      free(ndata_paths[i].path);
+   }
+   if (ndata_paths != NULL)
+      memset( ndata_paths, 0, ndata_mpaths * sizeof(NDataPath) );
+   ndata_npaths = 0;
+}
+
+
+/**
+ * @brief Gets where a loose file would be for a given source.
+ *
+ *    @param src Source to get the path for.
+ *    @param filename Name of the file in the ndata.
+ *    @param[out] path Path of the file on disk.
+ *    @param len Size of path.
+ *    @return 0 if the source can be used, -1 otherwise.
+ */
+static int ndata_srcPath( int src, const char *filename, char *path, size_t len )
+{
+   char *buf;
+
+   switch (src) {
+      case NDATA_SRC_LAIDOUT:
+         nsnprintf( path, len, "%s", filename );
+         return 0;
+
+      case NDATA_SRC_DIRNAME:
+         if ((ndata_filename != NULL) || (ndata_dirname == NULL))
+            return -1;
+         nsnprintf( path, len, "%s/%s", ndata_dirname, filename );
+         return 0;
+
+      case NDATA_SRC_NDATADEF:
+         if (ndata_defDir == NULL) {
+            buf = strdup( NDATA_DEF );
+            ndata_defDir = strdup( nfile_dirname(buf) );
+            free(buf);
+         }
+         nsnprintf( path, len, "%s/%s", ndata_defDir, filename );
+         return 0;
+
+      case NDATA_SRC_BINARY:
+         if (ndata_binDir == NULL) {
+            buf = strdup( naev_binary() );
+            ndata_binDir = strdup( nfile_dirname(buf) );
+            free(buf);
+         }
+         nsnprintf( path, len, "%s/%s", ndata_binDir, filename );
+         return 0;
+   }
+
+   return -1;
+}
+
+
+/**
+ * @brief Finds a loose file on disk.
+ *
+ * The lookup is done once per file, afterwards the resolved path is reused.
+ *
+ *    @param filename Name of the file in the ndata.
+ *    @param[out] path Path of the file on disk.
+ *    @param len Size of path.
+ *    @return The source the file was found in or -1 if not found.
+ */
+static int ndata_resolve( const char *filename, char *path, size_t len )
+{
+   NDataPath *e;
+   int src;
+
+   SDL_mutexP(ndata_lock);
+
+   /* Already resolved. */
+   e = ndata_pathGet( filename );
+   if ((e != NULL) && (e->src >= ndata_source)) {
+      nsnprintf( path, len, "%s", e->path );
+      SDL_mutexV(ndata_lock);
+      return e->src;
    }
 
+   /* Look in the sources still in use. */
+   for (src=ndata_source; src<=NDATA_SRC_BINARY; src++) {
+      if (ndata_srcPath( src, filename, path, len ) < 0)
+         continue;
+      if (nfile_fileExists( path )) {
+         ndata_pathAdd( filename, path, src );
+         SDL_mutexV(ndata_lock);
+         return src;
+      }
+   }
+
+   SDL_mutexV(ndata_lock);
+   return -1;
+}
+
+
+/**
+ * @brief Gets a file from the archive index.
+ *
+ *    @param filename Name of the file to get.
+ *    @return The index entry or NULL if not in the archive.
+ */
+static NZipEntry* ndata_getEntry( const char *filename )
+{
+   return nzip_findEntry( ndata_entries, ndata_nentries, filename );
+}
+
+
+/**
+ * @brief Checks to see if a file is in the NDATA.
+ *    @param filename Name of the file to check.
+ *    @return 1 if the file exists, 0 otherwise.
+ */
+int ndata_exists( const char* filename )
+{
+   char path[PATH_MAX];
+
+   /* See if needs to load ndata archive. */
+   if (ndata_archive == NULL)
+      return (ndata_resolve( filename, path, sizeof(path) ) >= 0);
+
    /* Try to get it from the archive. */
-   return nzip_hasFile( ndata_archive, filename );
+   return (ndata_getEntry( filename ) != NULL);
 }
 
 
@@ -670,68 +916,24 @@ int ndata_exists( const char* filename )
 void* ndata_read( const char* filename, uint32_t *filesize )
 {
    char *buf, path[PATH_MAX];
-   int nbuf;
+   int nbuf, src;
+   NZipEntry *entry;
 
    /* See if needs to load ndata archive. */
    if (ndata_archive == NULL) {
 
-      /* Try to read the file as locally. */
-      if (nfile_fileExists( filename ) && (ndata_source <= NDATA_SRC_LAIDOUT)) {
-         buf = nfile_readFile( &nbuf, filename );
+      /* Try to read the file from disk. */
+      src = ndata_resolve( filename, path, sizeof(path) );
+      if (src >= 0) {
+         buf = nfile_readFile( &nbuf, path );
          if (buf != NULL) {
+            ndata_source = src;
             ndata_loadedfile = 1;
             *filesize = nbuf;
             return buf;
          }
       }
 
-      /* We can try to use the dirname path. */
-      if ((ndata_filename == NULL) && (ndata_dirname != NULL) &&
-            (ndata_source <= NDATA_SRC_DIRNAME)) {
-         nsnprintf( path, sizeof(path), "%s/%s", ndata_dirname, filename );
-         if (nfile_fileExists( path )) {
-            buf = nfile_readFile( &nbuf, path );
-            if (buf != NULL) {
-               ndata_source = NDATA_SRC_DIRNAME;
-               ndata_loadedfile = 1;
-               *filesize = nbuf;
-               return buf;
-            }
-         }
-      }
-
-      /* We can also try default location. */
-      if (ndata_source <= NDATA_SRC_NDATADEF) {
-         buf = strdup( NDATA_DEF );
-         nsnprintf( path, sizeof(path), "%s/%s", nfile_dirname(buf), filename );
-         free(buf);
-         if (nfile_fileExists( path )) {
-            buf = nfile_readFile( &nbuf, path );
-            if (buf != NULL) {
-               ndata_source = NDATA_SRC_NDATADEF;
-               ndata_loadedfile = 1;
-               *filesize = nbuf;
-               return buf;
-            }
-         }
-      }
-
-      /* Try binary location. */
-      if (ndata_source <= NDATA_SRC_BINARY) {
-         buf = strdup( naev_binary() );
-         nsnprintf( path, sizeof(path), "%s/%s", nfile_dirname(buf), filename );
-         free(buf);
-         if (nfile_fileExists( path )) {
-            buf = nfile_readFile( &nbuf, path );
-            if (buf != NULL) {
-               ndata_source = NDATA_SRC_BINARY;
-               ndata_loadedfile = 1;
-               *filesize = nbuf;
-               return buf;
-            }
-         }
-      }
-
       /* Load the ndata archive. */
       ndata_openFile();
    }
@@ -747,65 +949,152 @@ void* ndata_read( const char* filename, uint32_t *filesize )
    ndata_loadedfile = 1;
 
    /* Get data from ndata archive. */
-   return nzip_readFile( ndata_archive, filename, filesize );
+   entry = ndata_getEntry( filename );
+   if (entry == NULL) {
+      WARN("Unable to open file '%s': not found in archive.", filename);
+      *filesize = 0;
+      return NULL;
+   }
+   buf = malloc( entry->size );
+   if (nzip_readEntry( ndata_archive, entry, buf ) < 0) {
+      free(buf);
+      *filesize = 0;
+      return NULL;
+   }
+   *filesize = entry->size;
+   return buf;
 }
 
 
+#if HAS_POSIX
 /**
- * @brief Creates an rwops from a file in the ndata.
+ * @brief Memory maps a file read only.
  *
- *    @param filename Name of the file to create rwops of.
- *    @return rwops that accesses the file in the ndata.
+ *    @param path Path of the file to map.
+ *    @param[out] filesize Stores the size of the file.
+ *    @return The mapped file or NULL on error.
  */
-SDL_RWops *ndata_rwops( const char* filename )
+static void* ndata_mapFile( const char *path, uint32_t *filesize )
 {
-   char path[PATH_MAX], *tmp;
-   SDL_RWops *rw;
+   struct stat st;
+   void *data;
+   int fd;
 
-   if (ndata_archive == NULL) {
+   fd = open( path, O_RDONLY );
+   if (fd < 0)
+      return NULL;
+   if ((fstat( fd, &st ) < 0) || (st.st_size <= 0)) {
+      close(fd);
+      return NULL;
+   }
 
-      /* Try to open from file. */
-      if (ndata_source <= NDATA_SRC_LAIDOUT) {
-         rw = SDL_RWFromFile( filename, "rb" );
-         if (rw != NULL) {
-            ndata_loadedfile = 1;
-            return rw;
-         }
-      }
+   data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+   close(fd); /* The mapping keeps the file open. */
+   if (data == MAP_FAILED)
+      return NULL;
 
-      /* Try to open from dirname. */
-      if ((ndata_filename == NULL) && (ndata_dirname != NULL) &&
-            (ndata_source <= NDATA_SRC_DIRNAME)) {
-         nsnprintf( path, sizeof(path), "%s/%s", ndata_dirname, filename );
-         rw = SDL_RWFromFile( path, "rb" );
-         if (rw != NULL) {
-            ndata_source = NDATA_SRC_DIRNAME;
-            ndata_loadedfile = 1;
-            return rw;
-         }
-      }
+   /* Remember it's mapped. */
+   SDL_mutexP(ndata_lock);
+   if (ndata_nmaps >= ndata_mmaps) {
+      ndata_mmaps = MAX( 8, 2*ndata_mmaps );
+      ndata_maps  = realloc( ndata_maps, ndata_mmaps * sizeof(void*) );
+   }
+   ndata_maps[ ndata_nmaps++ ] = data;
+   SDL_mutexV(ndata_lock);
 
-      /* Try to open from def. */
-      if (ndata_source <= NDATA_SRC_NDATADEF) {
-         tmp = strdup( NDATA_DEF );
-         nsnprintf( path, sizeof(path), "%s/%s", nfile_dirname(tmp), filename );
-         free(tmp);
-         rw = SDL_RWFromFile( path, "rb" );
-         if (rw != NULL) {
-            ndata_source = NDATA_SRC_NDATADEF;
+   *filesize = st.st_size;
+   return data;
+}
+#endif /* HAS_POSIX */
+
+
+/**
+ * @brief Gets a read only view of a file in the ndata.
+ *
+ * Loose files are memory mapped when possible, archived files are
+ *  decompressed into a buffer. The data is not NUL terminated and must be
+ *  released with ndata_unmap.
+ *
+ *    @param filename Name of the file to map.
+ *    @param[out] filesize Stores the size of the file.
+ *    @return The file data or NULL on error.
+ */
+void* ndata_map( const char* filename, uint32_t *filesize )
+{
+#if HAS_POSIX
+   char path[PATH_MAX];
+   void *data;
+   int src;
+
+   if (ndata_archive == NULL) {
+      src = ndata_resolve( filename, path, sizeof(path) );
+      if (src >= 0) {
+         data = ndata_mapFile( path, filesize );
+         if (data != NULL) {
+            ndata_source = src;
             ndata_loadedfile = 1;
-            return rw;
+            return data;
          }
       }
+   }
+#endif /* HAS_POSIX */
 
-      /* Try to open from binary. */
-      if (ndata_source <= NDATA_SRC_BINARY) {
-         tmp = strdup( naev_binary() );
-         nsnprintf( path, sizeof(path), "%s/%s", nfile_dirname(tmp), filename );
-         free(tmp);
+   return ndata_read( filename, filesize );
+}
+
+
+/**
+ * @brief Releases a view gotten with ndata_map.
+ *
+ *    @param data Data to release.
+ *    @param filesize Size of the data.
+ */
+void ndata_unmap( void *data, uint32_t filesize )
+{
+#if HAS_POSIX
+   int i;
+
+   if (data == NULL)
+      return;
+
+   SDL_mutexP(ndata_lock);
+   for (i=ndata_nmaps-1; i>=0; i--) {
+      if (ndata_maps[i] != data)
+         continue;
+      ndata_maps[i] = ndata_maps[ --ndata_nmaps ];
+      SDL_mutexV(ndata_lock);
+      munmap( data, filesize );
+      return;
+   }
+   SDL_mutexV(ndata_lock);
+#else /* HAS_POSIX */
+   (void) filesize;
+#endif /* HAS_POSIX */
+
+   free(data);
+}
+
+
+/**
+ * @brief Creates an rwops from a file in the ndata.
+ *
+ *    @param filename Name of the file to create rwops of.
+ *    @return rwops that accesses the file in the ndata.
+ */
+SDL_RWops *ndata_rwops( const char* filename )
+{
+   char path[PATH_MAX];
+   SDL_RWops *rw;
+   int src;
+
+   if (ndata_archive == NULL) {
+
+      /* Try to open from disk. */
+      src = ndata_resolve( filename, path, sizeof(path) );
+      if (src >= 0) {
          rw = SDL_RWFromFile( path, "rb" );
          if (rw != NULL) {
-            ndata_source = NDATA_SRC_BINARY;
+            ndata_source = src;
             ndata_loadedfile = 1;
             return rw;
          }
@@ -39,7 +39,6 @@
 #define MISSION_LUA_PATH         "dat/missions/" /**< Path to Lua files. */
 #define EVENT_LUA_PATH           "dat/events/" /**< Path to Lua files. */
 #define OUTFIT_DATA_PATH         "dat/outfits/" /**< Path to outfits. */
-#define MAP_DATA_PATH            "dat/outfits/maps/" /**< Path to maps. */
 #define PLANET_DATA_PATH         "dat/assets/" /**< Path to planets. */
 #define SYSTEM_DATA_PATH         "dat/ssys/" /**< Path to systems. */
 #define SHIP_DATA_PATH           "dat/ships/" /**< Path to ships. */
@@ -79,6 +78,8 @@ const char* ndata_name (void);
  */
 int ndata_exists( const char* filename );
 void* ndata_read( const char* filename, uint32_t *filesize );
+void* ndata_map( const char* filename, uint32_t *filesize );
+void ndata_unmap( void *data, uint32_t filesize );
 char** ndata_list( const char *path, uint32_t* nfiles );
 char** ndata_listRecursive( const char *path, uint32_t* nfiles );
 void ndata_sortName( char **files, uint32_t nfiles );
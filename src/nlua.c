@@ -6,6 +6,14 @@
  * @file nlua.c
  *
  * @brief Handles creating and setting up basic Lua environments.
+ *
+ * Every state created with nlua_newState gets its own allocator, which keeps
+ *  track of the memory used by the state, and is registered with the garbage
+ *  collection scheduler. The automatic collector of the states is stopped
+ *  and instead nlua_gcUpdate steps each state once per frame, proportionally
+ *  to how much it allocated since the last frame. Full collections are only
+ *  done with nlua_gcFull, which is run when landing and loading, when a
+ *  pause is not noticed.
  */
 
 #include "nlua.h"
@@ -34,29 +42,421 @@
 #include "nstring.h"
 
 
+#define NLUA_GC_STEPMUL    2  /**< KB collected per KB allocated each frame. */
+#define NLUA_STATE_CHUNK   32 /**< Registered states to allocate at once. */
+
+#define NLUA_ALLOC_ALIGN   16 /**< Granularity of the size classes. */
+#define NLUA_ALLOC_CLASSES 16 /**< Number of size classes, larger blocks use malloc. */
+#define NLUA_ALLOC_MAX     (NLUA_ALLOC_ALIGN*NLUA_ALLOC_CLASSES) /**< Largest pooled block. */
+#define NLUA_ARENA_CHUNK   16384 /**< Size of the chunks pooled blocks are carved from. */
+
+
+/**
+ * @brief Chunk of memory pooled blocks are carved from.
+ */
+typedef struct nlua_Chunk_ {
+   struct nlua_Chunk_ *next; /**< Next chunk of the state. */
+} nlua_Chunk;
+
+
+/**
+ * @brief Data of a Lua state created with nlua_newState.
+ *
+ * Used as the userdata of the allocator, small blocks are kept in per size
+ *  class free lists carved out of per state chunks so they don't fragment
+ *  the heap and all go away at once when the state is closed. It is also
+ *  stored in the registry, since LuaJIT doesn't always allow custom allocators.
+ */
+typedef struct nlua_State_ {
+   lua_State *L;     /**< The state. */
+   char *name;       /**< Name to report the state as. */
+   int count;        /**< Memory in use after the last collection step (KB). */
+
+   /* Arena. */
+   void *free[NLUA_ALLOC_CLASSES]; /**< Free blocks of each size class. */
+   nlua_Chunk *chunks; /**< Chunks allocated. */
+   char *cur;        /**< Unused part of the current chunk. */
+   size_t left;      /**< Bytes left in the current chunk. */
+
+   /* Statistics. */
+   size_t live;      /**< Bytes in use. */
+   size_t peak;      /**< Most bytes ever in use. */
+   unsigned long nallocs; /**< Number of allocations made. */
+   size_t budget;    /**< Bytes the state should stay under, 0 for none. */
+   int warned;       /**< Already warned about exceeding the budget. */
+} nlua_State;
+static nlua_State **nlua_states = NULL; /**< Registered states. */
+static int nlua_nstates = 0; /**< Number of registered states. */
+static int nlua_mstates = 0; /**< Memory allocated for registered states. */
+static char nlua_stateKey = 0; /**< Address is the registry key of the nlua_State. */
+
+
 /*
  * prototypes
  */
 static int nlua_packfileLoader( lua_State* L );
+static int nlua_panic( lua_State *L );
+static nlua_State *nlua_getState( lua_State *L );
+static void nlua_checkBudget( nlua_State *s );
+#ifndef HAVE_LUAJIT
+static int nlua_allocClass( size_t size );
+static void* nlua_arenaGet( nlua_State *s, int c );
+static void *nlua_alloc( void *ud, void *ptr, size_t osize, size_t nsize );
+#endif /* HAVE_LUAJIT */
+
+
+/**
+ * @brief Reports errors happening outside of protected calls.
+ */
+static int nlua_panic( lua_State *L )
+{
+   WARN("PANIC: unprotected error in call to Lua API (%s)", lua_tostring(L,-1));
+   return 0;
+}
+
+
+/**
+ * @brief Gets the data of a state created with nlua_newState.
+ */
+static nlua_State *nlua_getState( lua_State *L )
+{
+   nlua_State *s;
+
+   lua_pushlightuserdata( L, &nlua_stateKey );
+   lua_rawget( L, LUA_REGISTRYINDEX );
+   s = (nlua_State*) lua_touserdata( L, -1 );
+   lua_pop( L, 1 );
+   return s;
+}
+
+
+/**
+ * @brief Warns the first time a state goes over its budget.
+ */
+static void nlua_checkBudget( nlua_State *s )
+{
+   if ((s->budget > 0) && (s->live > s->budget) && !s->warned) {
+      WARN("Lua state '%s' is using %lu KB, over its budget of %lu KB.",
+            s->name, (unsigned long)(s->live >> 10),
+            (unsigned long)(s->budget >> 10) );
+      s->warned = 1;
+   }
+}
+
+
+#ifndef HAVE_LUAJIT
+/**
+ * @brief Gets the size class of a block, -1 for blocks that aren't pooled.
+ */
+static int nlua_allocClass( size_t size )
+{
+   if (size > NLUA_ALLOC_MAX)
+      return -1;
+   return (size + NLUA_ALLOC_ALIGN - 1) / NLUA_ALLOC_ALIGN - 1;
+}
+
+
+/**
+ * @brief Gets a block of a size class from the arena of a state.
+ */
+static void* nlua_arenaGet( nlua_State *s, int c )
+{
+   void *ptr;
+   size_t size;
+   nlua_Chunk *chunk;
+
+   /* Reuse a freed block. */
+   ptr = s->free[c];
+   if (ptr != NULL) {
+      s->free[c] = *(void**)ptr;
+      return ptr;
+   }
+
+   /* Carve out of the current chunk, the tail of the old one is lost. */
+   size = (c+1) * NLUA_ALLOC_ALIGN;
+   if (s->left < size) {
+      chunk = malloc( NLUA_ARENA_CHUNK );
+      if (chunk == NULL)
+         return NULL;
+      chunk->next = s->chunks;
+      s->chunks   = chunk;
+      s->cur      = (char*)chunk + NLUA_ALLOC_ALIGN; /* Keeps blocks aligned. */
+      s->left     = NLUA_ARENA_CHUNK - NLUA_ALLOC_ALIGN;
+   }
+   ptr      = s->cur;
+   s->cur  += size;
+   s->left -= size;
+   return ptr;
+}
+
+
+/**
+ * @brief Allocator used by the Lua states, see lua_Alloc.
+ */
+static void *nlua_alloc( void *ud, void *ptr, size_t osize, size_t nsize )
+{
+   nlua_State *s;
+   void *nptr;
+   int oc, nc;
+
+   s  = (nlua_State*) ud;
+   oc = (ptr != NULL) ? nlua_allocClass( osize ) : -1;
+
+   /* Free. */
+   if (nsize == 0) {
+      if (ptr == NULL)
+         return NULL;
+      if (oc >= 0) {
+         *(void**)ptr = s->free[oc];
+         s->free[oc]  = ptr;
+      }
+      else
+         free( ptr );
+      s->live -= osize;
+      return NULL;
+   }
+
+   nc = nlua_allocClass( nsize );
+   if ((ptr != NULL) && (oc == nc) && (oc >= 0))
+      nptr = ptr; /* Still fits. */
+   else if ((nc < 0) && ((ptr == NULL) || (oc < 0))) {
+      nptr = realloc( ptr, nsize );
+      if (nptr == NULL)
+         return NULL;
+   }
+   else {
+      nptr = (nc >= 0) ? nlua_arenaGet( s, nc ) : malloc( nsize );
+      if (nptr == NULL)
+         return NULL;
+      if (ptr != NULL) {
+         memcpy( nptr, ptr, MIN( osize, nsize ) );
+         if (oc >= 0) {
+            *(void**)ptr = s->free[oc];
+            s->free[oc]  = ptr;
+         }
+         else
+            free( ptr );
+      }
+   }
+
+   /* Statistics. */
+   if (ptr != NULL)
+      s->live -= osize;
+   s->live += nsize;
+   s->nallocs++;
+   if (s->live > s->peak)
+      s->peak = s->live;
+   nlua_checkBudget( s );
+
+   return nptr;
+}
+#endif /* HAVE_LUAJIT */
 
 
 /**
- * @brief Wrapper around luaL_newstate.
+ * @brief Wrapper around lua_newstate.
  *
+ * The state gets its own allocator, is registered with the garbage
+ *  collection scheduler and must be closed with nlua_closeState. LuaJIT
+ *  keeps the default allocator since x86-64 builds without GC64 refuse
+ *  custom ones, memory is then only sampled by nlua_gcUpdate and the
+ *  allocation count stays at 0.
+ *
+ *    @param name Name of the state for memory reports.
  *    @return A newly created lua_State.
  */
-lua_State *nlua_newState (void)
+lua_State *nlua_newState( const char *name )
 {
-   lua_State *L;
+   nlua_State *s;
+
+   s = calloc( 1, sizeof(nlua_State) );
 
    /* try to create the new state */
-   L = luaL_newstate();
-   if (L == NULL) {
+#ifdef HAVE_LUAJIT
+   s->L = luaL_newstate();
+#else /* HAVE_LUAJIT */
+   s->L = lua_newstate( nlua_alloc, s );
+#endif /* HAVE_LUAJIT */
+   if (s->L == NULL) {
       WARN("Failed to create new Lua state.");
+      free( s );
       return NULL;
    }
+   lua_atpanic( s->L, nlua_panic );
+   lua_pushlightuserdata( s->L, &nlua_stateKey );
+   lua_pushlightuserdata( s->L, s );
+   lua_rawset( s->L, LUA_REGISTRYINDEX );
+
+   /* Collection is driven by nlua_gcUpdate from now on. */
+   lua_gc( s->L, LUA_GCSTOP, 0 );
+   s->name  = strdup( (name != NULL) ? name : "unnamed" );
+   s->count = lua_gc( s->L, LUA_GCCOUNT, 0 );
+#ifdef HAVE_LUAJIT
+   s->live  = (size_t)s->count << 10;
+   s->peak  = s->live;
+#endif /* HAVE_LUAJIT */
+
+   /* Register. */
+   if (nlua_nstates >= nlua_mstates) {
+      nlua_mstates += NLUA_STATE_CHUNK;
+      nlua_states   = realloc( nlua_states, nlua_mstates * sizeof(nlua_State*) );
+   }
+   nlua_states[ nlua_nstates++ ] = s;
+
+   return s->L;
+}
+
+
+/**
+ * @brief Closes a state created with nlua_newState.
+ *
+ *    @param L State to close.
+ */
+void nlua_closeState( lua_State *L )
+{
+   int i;
+   nlua_State *s;
+   nlua_Chunk *chunk;
+
+   s = nlua_getState( L );
+   lua_close( L );
+
+   /* Unregister. */
+   for (i=0; i<nlua_nstates; i++) {
+      if (nlua_states[i] != s)
+         continue;
+      nlua_nstates--;
+      memmove( &nlua_states[i], &nlua_states[i+1],
+            (nlua_nstates-i) * sizeof(nlua_State*) );
+      break;
+   }
+   if (nlua_nstates == 0) {
+      free( nlua_states );
+      nlua_states  = NULL;
+      nlua_mstates = 0;
+   }
 
-   return L;
+   /* Free the arena. */
+   while (s->chunks != NULL) {
+      chunk     = s->chunks;
+      s->chunks = chunk->next;
+      free( chunk );
+   }
+   free( s->name );
+   free( s );
+}
+
+
+/**
+ * @brief Sets the memory budget of a state.
+ *
+ * A warning is printed the first time the state goes over the budget.
+ *
+ *    @param L State to set budget of, must be created with nlua_newState.
+ *    @param kb Budget in kilobytes, 0 for none.
+ */
+void nlua_setBudget( lua_State *L, int kb )
+{
+   nlua_State *s;
+
+   s = nlua_getState( L );
+   s->budget = (kb > 0) ? ((size_t)kb << 10) : 0;
+   s->warned = 0;
+}
+
+
+/**
+ * @brief Steps the garbage collector of all the states.
+ *
+ * Should be run once a frame. Each state collects twice as much as it
+ *  allocated since the last frame so the collector keeps ahead of it without
+ *  any state ever running a full collection mid frame.
+ */
+void nlua_gcUpdate (void)
+{
+   int i, count, step;
+   nlua_State *s;
+
+   for (i=0; i<nlua_nstates; i++) {
+      s     = nlua_states[i];
+      count = lua_gc( s->L, LUA_GCCOUNT, 0 );
+      step  = NLUA_GC_STEPMUL * (count - s->count);
+      if (step > 0) {
+         lua_gc( s->L, LUA_GCSTEP, step );
+         /* Stepping restarts the automatic collector. */
+         lua_gc( s->L, LUA_GCSTOP, 0 );
+         count = lua_gc( s->L, LUA_GCCOUNT, 0 );
+      }
+      s->count = count;
+#ifdef HAVE_LUAJIT
+      s->live  = (size_t)count << 10;
+      s->peak  = MAX( s->peak, s->live );
+      nlua_checkBudget( s );
+#endif /* HAVE_LUAJIT */
+   }
+}
+
+
+/**
+ * @brief Runs a full garbage collection on all the states.
+ *
+ * Should only be run when a pause will not be noticed.
+ */
+void nlua_gcFull (void)
+{
+   int i;
+   nlua_State *s;
+
+   for (i=0; i<nlua_nstates; i++) {
+      s = nlua_states[i];
+      lua_gc( s->L, LUA_GCCOLLECT, 0 );
+      lua_gc( s->L, LUA_GCSTOP, 0 );
+      s->count = lua_gc( s->L, LUA_GCCOUNT, 0 );
+#ifdef HAVE_LUAJIT
+      s->live  = (size_t)s->count << 10;
+#endif /* HAVE_LUAJIT */
+   }
+}
+
+
+/**
+ * @brief Gets the memory statistics of a registered state.
+ *
+ *    @param i Index of the state.
+ *    @param[out] stats Statistics of the state.
+ *    @return Name of the state or NULL if i is past the last state.
+ */
+const char *nlua_stateInfo( int i, nlua_MemStats *stats )
+{
+   nlua_State *s;
+
+   if ((i < 0) || (i >= nlua_nstates))
+      return NULL;
+   s = nlua_states[i];
+   stats->live    = s->live;
+   stats->peak    = s->peak;
+   stats->nallocs = s->nallocs;
+   return s->name;
+}
+
+
+/**
+ * @brief Gets the memory statistics of all the registered states together.
+ *
+ *    @param[out] stats Sum of the statistics of all the states.
+ *    @return Number of registered states.
+ */
+int nlua_memStats( nlua_MemStats *stats )
+{
+   int i;
+
+   memset( stats, 0, sizeof(nlua_MemStats) );
+   for (i=0; i<nlua_nstates; i++) {
+      stats->live    += nlua_states[i]->live;
+      stats->peak    += nlua_states[i]->peak;
+      stats->nallocs += nlua_states[i]->nallocs;
+   }
+   return nlua_nstates;
 }
 
 
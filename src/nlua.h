@@ -13,10 +13,26 @@
 #define NLUA_DONE       "__done__"
 
 
+/**
+ * @brief Memory statistics of a Lua state.
+ */
+typedef struct nlua_MemStats_ {
+   size_t live;      /**< Bytes in use. */
+   size_t peak;      /**< Most bytes ever in use. */
+   unsigned long nallocs; /**< Number of allocations made. */
+} nlua_MemStats;
+
+
 /*
  * standard Lua stuff wrappers
  */
-lua_State *nlua_newState (void); /* creates a new state */
+lua_State *nlua_newState( const char *name ); /* creates a new state */
+void nlua_closeState( lua_State *L );
+void nlua_setBudget( lua_State *L, int kb );
+void nlua_gcUpdate (void);
+void nlua_gcFull (void);
+const char *nlua_stateInfo( int i, nlua_MemStats *stats );
+int nlua_memStats( nlua_MemStats *stats );
 int nlua_load( lua_State* L, lua_CFunction f );
 int nlua_loadBasic( lua_State* L );
 int nlua_loadStandard( lua_State *L, int readonly );
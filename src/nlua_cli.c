@@ -18,10 +18,14 @@
 #include "nluadef.h"
 #include "log.h"
 #include "mission.h"
+#include "console.h"
+#include "nstring.h"
 
 
 /* CLI */
+static int cliL_memory( lua_State *L );
 static const luaL_reg cli_methods[] = {
+   { "memory", cliL_memory },
    {0,0}
 }; /**< CLI Lua methods. */
 
@@ -38,3 +42,38 @@ int nlua_loadCLI( lua_State *L )
    return 0;
 }
 
+
+/**
+ * @brief Prints the memory used by each Lua state to the console.
+ *
+ * Shows the memory in use, the most memory ever used and the number of
+ *  allocations of each state.
+ *
+ * @usage cli.memory()
+ *
+ *    @luareturn Total memory used by all the Lua states in kilobytes.
+ * @luafunc memory()
+ */
+static int cliL_memory( lua_State *L )
+{
+   int i, n;
+   const char *name;
+   nlua_MemStats stats;
+   char buf[256];
+
+   for (i=0; (name = nlua_stateInfo( i, &stats )) != NULL; i++) {
+      nsnprintf( buf, sizeof(buf), "%8lu KB %8lu KB peak %10lu allocs  %s",
+            (unsigned long)(stats.live >> 10), (unsigned long)(stats.peak >> 10),
+            stats.nallocs, name );
+      cli_addMessage( buf );
+   }
+   n = nlua_memStats( &stats );
+   nsnprintf( buf, sizeof(buf), "%8lu KB %8lu KB peak %10lu allocs  total in %d states",
+         (unsigned long)(stats.live >> 10), (unsigned long)(stats.peak >> 10),
+         stats.nallocs, n );
+   cli_addMessage( buf );
+
+   lua_pushnumber( L, stats.live >> 10 );
+   return 1;
+}
+
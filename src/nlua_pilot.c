@@ -40,6 +40,21 @@
 #include "land_outfits.h"
 
 
+#define PILOT_FILTER_FACTIONS 16 /**< Maximum factions in a query filter. */
+
+
+/**
+ * @brief Filter used by the C-side pilot queries.
+ */
+typedef struct PilotFilter_ {
+   int factions[PILOT_FILTER_FACTIONS]; /**< Factions to match. */
+   int nfactions;       /**< Number of factions to match, 0 matches all. */
+   int disabled;        /**< Whether or not to match disabled pilots. */
+   Pilot *enemy;        /**< Only match enemies of this pilot if not NULL. */
+   unsigned int exclude; /**< Pilot to never match. */
+} PilotFilter;
+
+
 /*
  * From pilot.c
  */
@@ -47,12 +62,25 @@ extern Pilot** pilot_stack;
 extern int pilot_nstack;
 
 
+/*
+ * Query results.
+ */
+static Pilot **pilotL_queryRes = NULL; /**< Results of the last range query. */
+static int pilotL_mqueryRes    = 0; /**< Memory allocated for pilotL_queryRes. */
+
+
 /*
  * Prototypes.
  */
 static Task *pilotL_newtask( lua_State *L, Pilot* p, const char *task );
 static int pilotL_addFleetFrom( lua_State *L, int from_ship );
 static int outfit_compareActive( const void *slot1, const void *slot2 );
+static int pilotL_isEnemy( const Pilot *p, const Pilot *t );
+static void pilotL_checkFilter( lua_State *L, int ind, PilotFilter *filter );
+static int pilotL_matchFilter( const Pilot *p, const PilotFilter *filter );
+static int pilotL_queryRange( const Vector2d *pos, double r,
+      const PilotFilter *filter, Pilot ***pilots );
+static int pilotL_rangeIter( lua_State *L );
 
 
 /* Pilot metatable methods. */
@@ -63,6 +91,10 @@ static int pilotL_remove( lua_State *L );
 static int pilotL_clear( lua_State *L );
 static int pilotL_toggleSpawn( lua_State *L );
 static int pilotL_getPilots( lua_State *L );
+static int pilotL_getInRange( lua_State *L );
+static int pilotL_getHostiles( lua_State *L );
+static int pilotL_nearest( lua_State *L );
+static int pilotL_inRange( lua_State *L );
 static int pilotL_eq( lua_State *L );
 static int pilotL_name( lua_State *L );
 static int pilotL_id( lua_State *L );
@@ -77,6 +109,8 @@ static int pilotL_outfits( lua_State *L );
 static int pilotL_rename( lua_State *L );
 static int pilotL_position( lua_State *L );
 static int pilotL_velocity( lua_State *L );
+static int pilotL_positionXY( lua_State *L );
+static int pilotL_velocityXY( lua_State *L );
 static int pilotL_dir( lua_State *L );
 static int pilotL_ew( lua_State *L );
 static int pilotL_temp( lua_State *L );
@@ -108,6 +142,7 @@ static int pilotL_setNoJump( lua_State *L );
 static int pilotL_setNoLand( lua_State *L );
 static int pilotL_addOutfit( lua_State *L );
 static int pilotL_rmOutfit( lua_State *L );
+static int pilotL_outfitBatch( lua_State *L );
 static int pilotL_setFuel( lua_State *L );
 static int pilotL_changeAI( lua_State *L );
 static int pilotL_setTemp( lua_State *L );
@@ -148,6 +183,10 @@ static const luaL_reg pilotL_methods[] = {
    { "add", pilotL_addFleet },
    { "rm", pilotL_remove },
    { "get", pilotL_getPilots },
+   { "getInRange", pilotL_getInRange },
+   { "getHostiles", pilotL_getHostiles },
+   { "nearest", pilotL_nearest },
+   { "inRange", pilotL_inRange },
    { "__eq", pilotL_eq },
    /* Info. */
    { "name", pilotL_name },
@@ -163,6 +202,8 @@ static const luaL_reg pilotL_methods[] = {
    { "rename", pilotL_rename },
    { "pos", pilotL_position },
    { "vel", pilotL_velocity },
+   { "posxy", pilotL_positionXY },
+   { "velxy", pilotL_velocityXY },
    { "dir", pilotL_dir },
    { "ew", pilotL_ew },
    { "temp", pilotL_temp },
@@ -211,6 +252,7 @@ static const luaL_reg pilotL_methods[] = {
    /* Outfits. */
    { "addOutfit", pilotL_addOutfit },
    { "rmOutfit", pilotL_rmOutfit },
+   { "outfitBatch", pilotL_outfitBatch },
    { "setFuel", pilotL_setFuel },
    /* Ship. */
    { "cargoList", pilotL_cargoList },
@@ -243,6 +285,10 @@ static const luaL_reg pilotL_cond_methods[] = {
    /* General. */
    { "player", pilotL_getPlayer },
    { "get", pilotL_getPilots },
+   { "getInRange", pilotL_getInRange },
+   { "getHostiles", pilotL_getHostiles },
+   { "nearest", pilotL_nearest },
+   { "inRange", pilotL_inRange },
    { "__eq", pilotL_eq },
    /* Info. */
    { "name", pilotL_name },
@@ -257,6 +303,8 @@ static const luaL_reg pilotL_cond_methods[] = {
    { "outfits", pilotL_outfits },
    { "pos", pilotL_position },
    { "vel", pilotL_velocity },
+   { "posxy", pilotL_positionXY },
+   { "velxy", pilotL_velocityXY },
    { "dir", pilotL_dir },
    { "ew", pilotL_ew },
    { "temp", pilotL_temp },
@@ -903,6 +951,348 @@ static int pilotL_getPilots( lua_State *L )
    return 1;
 }
 
+
+/**
+ * @brief Checks to see if two pilots are enemies.
+ */
+static int pilotL_isEnemy( const Pilot *p, const Pilot *t )
+{
+   /* Player needs special handling in case of hostility. */
+   if (p->faction == FACTION_PLAYER)
+      return pilot_isHostile(t);
+   if (t->faction == FACTION_PLAYER)
+      return pilot_isHostile(p);
+   return areEnemies( p->faction, t->faction );
+}
+
+
+/**
+ * @brief Gets a pilot query filter from a Lua table.
+ *
+ * The table can have the following fields, all optional:
+ *  <ul>
+ *   <li> faction: Faction or table of factions to match. </li>
+ *   <li> disabled: Whether or not to match disabled pilots (default false). </li>
+ *   <li> hostile: Only match the enemies of this pilot. </li>
+ *   <li> exclude: Pilot to never match. </li>
+ *  </ul>
+ *
+ *    @param L Lua state to get filter from.
+ *    @param ind Index of the table, may be nil or none.
+ *    @param[out] filter Filter to fill.
+ */
+static void pilotL_checkFilter( lua_State *L, int ind, PilotFilter *filter )
+{
+   LuaFaction *f;
+
+   memset( filter, 0, sizeof(PilotFilter) );
+   if (lua_isnoneornil(L,ind))
+      return;
+   luaL_checktype(L, ind, LUA_TTABLE);
+
+   /* Factions. */
+   lua_getfield(L, ind, "faction");
+   if (lua_isfaction(L,-1)) {
+      f = lua_tofaction(L,-1);
+      filter->factions[ filter->nfactions++ ] = f->f;
+   }
+   else if (lua_istable(L,-1)) {
+      lua_pushnil(L);
+      while (lua_next(L, -2) != 0) {
+         if (lua_isfaction(L,-1)) {
+            if (filter->nfactions >= PILOT_FILTER_FACTIONS) {
+               NLUA_ERROR(L, "Pilot filter has more than %d factions.",
+                     PILOT_FILTER_FACTIONS );
+               return;
+            }
+            f = lua_tofaction(L,-1);
+            filter->factions[ filter->nfactions++ ] = f->f;
+         }
+         lua_pop(L,1);
+      }
+   }
+   lua_pop(L,1);
+
+   /* Disabled. */
+   lua_getfield(L, ind, "disabled");
+   filter->disabled = lua_toboolean(L,-1);
+   lua_pop(L,1);
+
+   /* Hostile. */
+   lua_getfield(L, ind, "hostile");
+   if (!lua_isnil(L,-1))
+      filter->enemy = luaL_validpilot(L,-1);
+   lua_pop(L,1);
+
+   /* Excluded pilot. */
+   lua_getfield(L, ind, "exclude");
+   if (!lua_isnil(L,-1))
+      filter->exclude = luaL_validpilot(L,-1)->id;
+   lua_pop(L,1);
+}
+
+
+/**
+ * @brief Checks to see if a pilot matches a query filter.
+ */
+static int pilotL_matchFilter( const Pilot *p, const PilotFilter *filter )
+{
+   int i;
+
+   if (pilot_isFlag(p, PILOT_DELETE))
+      return 0;
+   if (!filter->disabled && pilot_isDisabled(p))
+      return 0;
+   if (p->id == filter->exclude)
+      return 0;
+   if ((filter->enemy != NULL) &&
+         ((p == filter->enemy) || !pilotL_isEnemy( filter->enemy, p )))
+      return 0;
+   if (filter->nfactions == 0)
+      return 1;
+   for (i=0; i<filter->nfactions; i++)
+      if (p->faction == filter->factions[i])
+         return 1;
+   return 0;
+}
+
+
+/**
+ * @brief Gets the pilots matching a filter within a range of a position.
+ *
+ * Uses the per-tick spatial index of the pilots so only pilots near the
+ *  position are looked at.
+ *
+ *    @param pos Position to get pilots around.
+ *    @param r Range to get pilots in.
+ *    @param filter Filter to match.
+ *    @param[out] pilots Matching pilots, valid until the next query. They are
+ *           copied out of the spatial index, so C-side queries that are
+ *           running when a hook calls this are left untouched.
+ *    @return Number of matching pilots.
+ */
+static int pilotL_queryRange( const Vector2d *pos, double r,
+      const PilotFilter *filter, Pilot ***pilots )
+{
+   int i, k, n;
+   Pilot **res;
+
+   /* Spatial index matches the ship radius too, keep only the centres in range. */
+   n   = pilot_getInRadius( pos->x, pos->y, r, &pilotL_queryRes, &pilotL_mqueryRes );
+   res = pilotL_queryRes;
+   k = 0;
+   for (i=0; i<n; i++) {
+      if (vect_dist2( &res[i]->solid->pos, pos ) > pow2(r))
+         continue;
+      if (!pilotL_matchFilter( res[i], filter ))
+         continue;
+      res[k++] = res[i];
+   }
+
+   *pilots = res;
+   return k;
+}
+
+
+/**
+ * @brief Gets the pilots within a range of a position.
+ *
+ * @usage p = pilot.getInRange( player.pilot():pos(), 3000 ) -- Pilots near the player
+ * @usage p = pilot.getInRange( pos, 5000, { faction=faction.get("Pirate"), disabled=true } )
+ *
+ *    @luaparam pos Position to get pilots around.
+ *    @luaparam r Range to get pilots in.
+ *    @luaparam filters Optional table of filters (faction, disabled, hostile and exclude).
+ *    @luareturn A table containing the pilots, in the same order as pilot.get.
+ * @luafunc getInRange( pos, r, filters )
+ */
+static int pilotL_getInRange( lua_State *L )
+{
+   int i, n;
+   LuaVector *v;
+   double r;
+   PilotFilter filter;
+   Pilot **pilots;
+   LuaPilot lp;
+
+   v = luaL_checkvector(L,1);
+   r = luaL_checknumber(L,2);
+   pilotL_checkFilter( L, 3, &filter );
+   n = pilotL_queryRange( &v->vec, r, &filter, &pilots );
+
+   lua_createtable(L, n, 0);
+   for (i=0; i<n; i++) {
+      lua_pushnumber(L, i+1); /* key */
+      lp.pilot = pilots[i]->id;
+      lua_pushpilot(L, lp); /* value */
+      lua_rawset(L,-3); /* table[key] = value */
+   }
+   return 1;
+}
+
+
+/**
+ * @brief Gets the enemies of a pilot.
+ *
+ * @usage h = pilot.getHostiles( p, 5000 ) -- Enemies of p within 5000 units
+ * @usage h = pilot.getHostiles( player.pilot() ) -- Everyone hostile to the player
+ *
+ *    @luaparam p Pilot to get enemies of.
+ *    @luaparam r Optional range to get enemies in, defaults to the whole system.
+ *    @luareturn A table containing the enemies that are not disabled.
+ * @luafunc getHostiles( p, r )
+ */
+static int pilotL_getHostiles( lua_State *L )
+{
+   int i, k, n;
+   PilotFilter filter;
+   Pilot *p;
+   Pilot **pilots;
+   LuaPilot lp;
+
+   p = luaL_validpilot(L,1);
+   memset( &filter, 0, sizeof(PilotFilter) );
+   filter.enemy = p;
+
+   /* Whole system. */
+   if (lua_isnoneornil(L,2)) {
+      lua_newtable(L);
+      k = 1;
+      for (i=0; i<pilot_nstack; i++) {
+         if (!pilotL_matchFilter( pilot_stack[i], &filter ))
+            continue;
+         lua_pushnumber(L, k++); /* key */
+         lp.pilot = pilot_stack[i]->id;
+         lua_pushpilot(L, lp); /* value */
+         lua_rawset(L,-3); /* table[key] = value */
+      }
+      return 1;
+   }
+
+   /* Around the pilot. */
+   n = pilotL_queryRange( &p->solid->pos, luaL_checknumber(L,2), &filter, &pilots );
+
+   lua_createtable(L, n, 0);
+   for (i=0; i<n; i++) {
+      lua_pushnumber(L, i+1); /* key */
+      lp.pilot = pilots[i]->id;
+      lua_pushpilot(L, lp); /* value */
+      lua_rawset(L,-3); /* table[key] = value */
+   }
+   return 1;
+}
+
+
+/**
+ * @brief Gets the pilot nearest to a position.
+ *
+ * @usage p = pilot.nearest( pos, { hostile=player.pilot() } ) -- Closest enemy of the player
+ *
+ *    @luaparam pos Position to get nearest pilot to.
+ *    @luaparam filters Optional table of filters (faction, disabled, hostile and exclude).
+ *    @luareturn The nearest pilot matching the filters or nil if there are none.
+ * @luafunc nearest( pos, filters )
+ */
+static int pilotL_nearest( lua_State *L )
+{
+   int i;
+   PilotFilter filter;
+   LuaVector *v;
+   Pilot *p, *best;
+   double d, dbest;
+   LuaPilot lp;
+
+   v = luaL_checkvector(L,1);
+   pilotL_checkFilter( L, 2, &filter );
+
+   best  = NULL;
+   dbest = 0.;
+   for (i=0; i<pilot_nstack; i++) {
+      p = pilot_stack[i];
+      if (!pilotL_matchFilter( p, &filter ))
+         continue;
+      d = vect_dist2( &p->solid->pos, &v->vec );
+      if ((best == NULL) || (d < dbest)) {
+         best  = p;
+         dbest = d;
+      }
+   }
+
+   if (best == NULL)
+      return 0;
+   lp.pilot = best->id;
+   lua_pushpilot(L, lp);
+   return 1;
+}
+
+
+/**
+ * @brief Iterator function used by pilot.inRange.
+ *
+ * Upvalues are the buffer of pilot IDs, the amount of IDs and the current index.
+ */
+static int pilotL_rangeIter( lua_State *L )
+{
+   int i, n;
+   unsigned int *ids;
+   LuaPilot lp;
+
+   ids = lua_touserdata(L, lua_upvalueindex(1));
+   n   = lua_tointeger(L, lua_upvalueindex(2));
+   i   = lua_tointeger(L, lua_upvalueindex(3));
+
+   /* Skip pilots that went away during the loop. */
+   for ( ; i<n; i++)
+      if (pilot_get( ids[i] ) != NULL)
+         break;
+   if (i >= n)
+      return 0;
+
+   lua_pushinteger(L, i+1);
+   lua_replace(L, lua_upvalueindex(3));
+   lp.pilot = ids[i];
+   lua_pushpilot(L, lp);
+   return 1;
+}
+
+
+/**
+ * @brief Iterates over the pilots within a range of a position.
+ *
+ * Same as pilot.getInRange but no table is created for the results.
+ *
+ * @usage for p in pilot.inRange( pos, 3000, { hostile=player.pilot() } ) do p:setHilight() end
+ *
+ *    @luaparam pos Position to get pilots around.
+ *    @luaparam r Range to get pilots in.
+ *    @luaparam filters Optional table of filters (faction, disabled, hostile and exclude).
+ *    @luareturn An iterator function over the pilots.
+ * @luafunc inRange( pos, r, filters )
+ */
+static int pilotL_inRange( lua_State *L )
+{
+   int i, n;
+   LuaVector *v;
+   double r;
+   PilotFilter filter;
+   Pilot **pilots;
+   unsigned int *ids;
+
+   v = luaL_checkvector(L,1);
+   r = luaL_checknumber(L,2);
+   pilotL_checkFilter( L, 3, &filter );
+   n = pilotL_queryRange( &v->vec, r, &filter, &pilots );
+
+   /* Copy the IDs since the query results don't outlive the next query. */
+   ids = lua_newuserdata(L, MAX(n,1) * sizeof(unsigned int));
+   for (i=0; i<n; i++)
+      ids[i] = pilots[i]->id;
+   lua_pushinteger(L, n);
+   lua_pushinteger(L, 0);
+   lua_pushcclosure(L, pilotL_rangeIter, 3);
+   return 1;
+}
+
 /**
  * @brief Checks to see if pilot and p are the same.
  *
@@ -1706,48 +2096,110 @@ static int pilotL_rename( lua_State *L )
  * @brief Gets the pilot's position.
  *
  * @usage v = p:pos()
+ * @usage p:pos( v ) -- Stores the position in v instead of creating a vector
  *
  *    @luaparam p Pilot to get the position of.
+ *    @luaparam v Optional vector to store the position in.
  *    @luareturn The pilot's current position as a vec2.
- * @luafunc pos( p )
+ * @luafunc pos( p, v )
  */
 static int pilotL_position( lua_State *L )
 {
    Pilot *p;
-   LuaVector v;
+   LuaVector v, *out;
 
    /* Parse parameters */
    p     = luaL_validpilot(L,1);
 
+   /* Reuse the vector. */
+   if (!lua_isnoneornil(L,2)) {
+      out = luaL_checkvector(L,2);
+      vectcpy( &out->vec, &p->solid->pos );
+      lua_pushvalue(L,2);
+      return 1;
+   }
+
    /* Push position. */
    vectcpy( &v.vec, &p->solid->pos );
    lua_pushvector(L, v);
    return 1;
 }
 
+/**
+ * @brief Gets the pilot's position as coordinates.
+ *
+ * Same as pos but does not create a vector.
+ *
+ * @usage x, y = p:posxy()
+ *
+ *    @luaparam p Pilot to get the position of.
+ *    @luareturn The X and Y coordinates of the pilot's current position.
+ * @luafunc posxy( p )
+ */
+static int pilotL_positionXY( lua_State *L )
+{
+   Pilot *p;
+
+   p = luaL_validpilot(L,1);
+   lua_pushnumber(L, p->solid->pos.x);
+   lua_pushnumber(L, p->solid->pos.y);
+   return 2;
+}
+
 /**
  * @brief Gets the pilot's velocity.
  *
  * @usage vel = p:vel()
+ * @usage p:vel( v ) -- Stores the velocity in v instead of creating a vector
  *
  *    @luaparam p Pilot to get the velocity of.
+ *    @luaparam v Optional vector to store the velocity in.
  *    @luareturn The pilot's current velocity as a vec2.
- * @luafunc vel( p )
+ * @luafunc vel( p, v )
  */
 static int pilotL_velocity( lua_State *L )
 {
    Pilot *p;
-   LuaVector v;
+   LuaVector v, *out;
 
    /* Parse parameters */
    p     = luaL_validpilot(L,1);
 
+   /* Reuse the vector. */
+   if (!lua_isnoneornil(L,2)) {
+      out = luaL_checkvector(L,2);
+      vectcpy( &out->vec, &p->solid->vel );
+      lua_pushvalue(L,2);
+      return 1;
+   }
+
    /* Push velocity. */
    vectcpy( &v.vec, &p->solid->vel );
    lua_pushvector(L, v);
    return 1;
 }
 
+/**
+ * @brief Gets the pilot's velocity as coordinates.
+ *
+ * Same as vel but does not create a vector.
+ *
+ * @usage vx, vy = p:velxy()
+ *
+ *    @luaparam p Pilot to get the velocity of.
+ *    @luareturn The X and Y components of the pilot's current velocity.
+ * @luafunc velxy( p )
+ */
+static int pilotL_velocityXY( lua_State *L )
+{
+   Pilot *p;
+
+   p = luaL_validpilot(L,1);
+   lua_pushnumber(L, p->solid->vel.x);
+   lua_pushnumber(L, p->solid->vel.y);
+   return 2;
+}
+
 /**
  * @brief Gets the pilot's evasion.
  *
@@ -1763,6 +2215,7 @@ static int pilotL_ew( lua_State *L )
 
    /* Parse parameters */
    p     = luaL_validpilot(L,1);
+   pilot_outfitBatchSync( p );
 
    /* Push direction. */
    lua_pushnumber( L, p->ew_evasion );
@@ -1877,6 +2330,7 @@ static int pilotL_setPosition( lua_State *L )
 
    /* Warp pilot to new position. */
    vectcpy( &p->solid->pos, &v->vec );
+   pilot_spatialInvalidate();
 
    /* Update if necessary. */
    if (pilot_isPlayer(p))
@@ -2588,7 +3042,7 @@ static int pilotL_addOutfit( lua_State *L )
 
       /* Add outfit - already tested. */
       ret = pilot_addOutfitRaw( p, o, p->outfits[i] );
-      pilot_calcStats( p );
+      pilot_outfitChanged( p, o, 1 );
 
       /* Add ammo if needed. */
       if ((ret==0) && (outfit_ammo(o) != NULL))
@@ -2600,7 +3054,9 @@ static int pilotL_addOutfit( lua_State *L )
    }
 
    /* Update the weapon sets. */
-   if ((added > 0) && p->autoweap)
+   if ((added > 0) && pilot_outfitBatching(p))
+      p->outfit_dirty |= PILOT_BATCH_WEAPONS;
+   else if ((added > 0) && p->autoweap)
       pilot_weaponAuto(p);
 
    /* Update equipment window if operating on the player's pilot. */
@@ -2647,23 +3103,29 @@ static int pilotL_rmOutfit( lua_State *L )
 
    /* If outfit is "all", we remove everything except cores. */
    if (strcmp(outfit,"all")==0) {
+      pilot_outfitBatchBegin( p );
       for (i=0; i<p->noutfits; i++) {
          if (p->outfits[i]->sslot->required)
             continue;
+         o = p->outfits[i]->outfit;
          pilot_rmOutfitRaw( p, p->outfits[i] );
+         pilot_outfitChanged( p, o, 0 );
          removed++;
       }
-      pilot_calcStats( p ); /* Recalculate stats. */
+      pilot_outfitBatchCommit( p ); /* Recalculate stats. */
    }
    /* If outfit is "cores", we remove cores only. */
    else if (strcmp(outfit,"cores")==0) {
+      pilot_outfitBatchBegin( p );
       for (i=0; i<p->noutfits; i++) {
          if (!p->outfits[i]->sslot->required)
             continue;
+         o = p->outfits[i]->outfit;
          pilot_rmOutfitRaw( p, p->outfits[i] );
+         pilot_outfitChanged( p, o, 0 );
          removed++;
       }
-      pilot_calcStats( p ); /* Recalculate stats. */
+      pilot_outfitBatchCommit( p ); /* Recalculate stats. */
    }
    else {
       /* Get the outfit. */
@@ -2699,6 +3161,51 @@ static int pilotL_rmOutfit( lua_State *L )
 }
 
 
+/**
+ * @brief Edits the outfits of a pilot as a single batch.
+ *
+ * Stats and weapon sets are recalculated once when the function returns
+ *  instead of after every addOutfit or rmOutfit. CPU checks done by addOutfit
+ *  in the function remain valid.
+ *
+ * @usage p:outfitBatch( function ()
+ *    p:rmOutfit( "all" )
+ *    p:addOutfit( "Laser Cannon MK1", 2 )
+ * end )
+ *
+ *    @luaparam p Pilot to edit the outfits of.
+ *    @luaparam func Function that edits the outfits.
+ * @luafunc outfitBatch( p, func )
+ */
+static int pilotL_outfitBatch( lua_State *L )
+{
+   Pilot *p;
+   unsigned int id;
+   int ret;
+
+   /* Get parameters. */
+   p  = luaL_validpilot(L,1);
+   luaL_checktype(L, 2, LUA_TFUNCTION);
+   id = p->id;
+
+   /* Run the edits. */
+   pilot_outfitBatchBegin( p );
+   lua_pushvalue(L, 2);
+   ret = lua_pcall(L, 0, 0, 0);
+
+   /* Pilot may be gone by now. */
+   p = pilot_get( id );
+   if (p != NULL)
+      pilot_outfitBatchCommit( p );
+
+   /* Propagate the error. */
+   if (ret)
+      lua_error(L);
+
+   return 0;
+}
+
+
 /**
  * @brief Sets the fuel of a pilot.
  *
@@ -2994,6 +3501,7 @@ static int pilotL_getHealth( lua_State *L )
 
    /* Get the pilot. */
    p  = luaL_validpilot(L,1);
+   pilot_outfitBatchSync( p );
 
    /* Return parameters. */
    lua_pushnumber(L,(p->armour_max > 0.) ? p->armour / p->armour_max * 100. : 0. );
@@ -3020,6 +3528,7 @@ static int pilotL_getEnergy( lua_State *L )
 
    /* Get the pilot. */
    p  = luaL_validpilot(L,1);
+   pilot_outfitBatchSync( p );
 
    /* Return parameter. */
    lua_pushnumber(L, (p->energy_max > 0.) ? p->energy / p->energy_max * 100. : 0. );
@@ -3097,6 +3606,9 @@ static int pilotL_getStats( lua_State *L )
    /* Get the pilot. */
    p  = luaL_validpilot(L,1);
 
+   /* Stats may be pending in an outfit batch. */
+   pilot_outfitBatchSync( p );
+
    /* Create table with information. */
    lua_newtable(L);
    /* Core. */
@@ -3139,6 +3651,7 @@ static int pilotL_cargoFree( lua_State *L )
 {
    Pilot *p;
    p = luaL_validpilot(L,1);
+   pilot_outfitBatchSync( p );
 
    lua_pushnumber(L, pilot_cargoFree(p) );
    return 1;
@@ -1325,8 +1325,10 @@ static int playerL_teleport( lua_State *L )
    missions_run( MIS_AVAIL_SPACE, -1, NULL, NULL );
 
    /* Move to planet. */
-   if (pnt != NULL)
+   if (pnt != NULL) {
       vectcpy( &player.p->solid->pos, &pnt->pos );
+      pilot_spatialInvalidate();
+   }
 
    return 0;
 }
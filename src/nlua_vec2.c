@@ -21,6 +21,9 @@
 #include "log.h"
 
 
+/* Helpers. */
+static void vectorL_checkxy( lua_State *L, int ind, double *x, double *y );
+
 /* Vector metatable methods */
 static int vectorL_new( lua_State *L );
 static int vectorL_newP( lua_State *L );
@@ -39,6 +42,13 @@ static int vectorL_setP( lua_State *L );
 static int vectorL_distance( lua_State *L );
 static int vectorL_distance2( lua_State *L );
 static int vectorL_mod( lua_State *L );
+static int vectorL_addm( lua_State *L );
+static int vectorL_subm( lua_State *L );
+static int vectorL_mulm( lua_State *L );
+static int vectorL_divm( lua_State *L );
+static int vectorL_lerpInto( lua_State *L );
+static int vectorL_distxy( lua_State *L );
+static int vectorL_dist2xy( lua_State *L );
 static const luaL_reg vector_methods[] = {
    { "new", vectorL_new },
    { "newP", vectorL_newP },
@@ -57,6 +67,13 @@ static const luaL_reg vector_methods[] = {
    { "dist", vectorL_distance },
    { "dist2", vectorL_distance2 },
    { "mod", vectorL_mod },
+   { "addm", vectorL_addm },
+   { "subm", vectorL_subm },
+   { "mulm", vectorL_mulm },
+   { "divm", vectorL_divm },
+   { "lerpInto", vectorL_lerpInto },
+   { "distxy", vectorL_distxy },
+   { "dist2xy", vectorL_dist2xy },
    {0,0}
 }; /**< Vector metatable methods. */
 
@@ -105,6 +122,23 @@ int nlua_loadVector( lua_State *L )
  * @code
  * vector:function( param )
  * @endcode
+ *
+ * Every operator, add, sub, mul, div, new, newP and pilot:pos() create a new
+ *  vector that has to be garbage collected later. Code that runs every tick,
+ *  like the AI, should stick to the subset that does not create vectors:
+ *  get, set, setP, polar, mod, dist, dist2, the in place addm, subm, mulm,
+ *  divm and lerpInto, the scalar vec2.distxy and vec2.dist2xy, pilot:posxy(),
+ *  pilot:velxy() and pilot:pos( v ) or pilot:vel( v ) with a vector to reuse.
+ *
+ * @code
+ * local tmp = vec2.new() -- Created once and reused
+ * function midpoint_dist2( p, t )
+ *    p:pos( tmp )
+ *    tmp:addm( t:posxy() ):mulm( 0.5 ) -- Midpoint of p and t
+ *    local x, y = tmp:get()
+ *    return vec2.dist2xy( x, y, p:posxy() )
+ * end
+ * @endcode
  */
 /**
  * @brief Gets vector at index.
@@ -630,6 +664,24 @@ static int vectorL_distance2( lua_State *L )
    return 1;
 }
 
+/**
+ * @brief Gets cartesian coordinates from either a vector or two numbers.
+ */
+static void vectorL_checkxy( lua_State *L, int ind, double *x, double *y )
+{
+   LuaVector *v;
+
+   if (lua_isvector(L,ind)) {
+      v  = lua_tovector(L,ind);
+      *x = v->vec.x;
+      *y = v->vec.y;
+   }
+   else {
+      *x = luaL_checknumber(L,ind);
+      *y = luaL_checknumber(L,ind+1);
+   }
+}
+
 /**
  * @brief Gets the modulus of the vector.
  *    @luaparam v Vector to get modulus of.
@@ -645,3 +697,173 @@ static int vectorL_mod( lua_State *L )
    return 1;
 }
 
+
+/**
+ * @brief Adds a vector or cartesian coordinates to a vector in place.
+ *
+ * Unlike add, no new vector is created.
+ *
+ * @usage my_vec:addm( your_vec )
+ * @usage my_vec:addm( 5, 3 ):mulm( 2 )
+ *
+ *    @luaparam v Vector to add to.
+ *    @luaparam x X coordinate or vector to add.
+ *    @luaparam y Y coordinate or nil to add.
+ *    @luareturn The vector v itself.
+ * @luafunc addm( v, x, y )
+ */
+static int vectorL_addm( lua_State *L )
+{
+   LuaVector *v;
+   double x, y;
+
+   v = luaL_checkvector(L,1);
+   vectorL_checkxy( L, 2, &x, &y );
+   vect_cset( &v->vec, v->vec.x + x, v->vec.y + y );
+   lua_pushvalue(L,1);
+   return 1;
+}
+
+/**
+ * @brief Subtracts a vector or cartesian coordinates from a vector in place.
+ *
+ * Unlike sub, no new vector is created.
+ *
+ * @usage my_vec:subm( your_vec )
+ *
+ *    @luaparam v Vector to subtract from.
+ *    @luaparam x X coordinate or vector to subtract.
+ *    @luaparam y Y coordinate or nil to subtract.
+ *    @luareturn The vector v itself.
+ * @luafunc subm( v, x, y )
+ */
+static int vectorL_subm( lua_State *L )
+{
+   LuaVector *v;
+   double x, y;
+
+   v = luaL_checkvector(L,1);
+   vectorL_checkxy( L, 2, &x, &y );
+   vect_cset( &v->vec, v->vec.x - x, v->vec.y - y );
+   lua_pushvalue(L,1);
+   return 1;
+}
+
+/**
+ * @brief Multiplies a vector by a number in place.
+ *
+ * Unlike mul, no new vector is created.
+ *
+ * @usage my_vec:mulm( 3 )
+ *
+ *    @luaparam v Vector to multiply.
+ *    @luaparam mod Amount to multiply by.
+ *    @luareturn The vector v itself.
+ * @luafunc mulm( v, mod )
+ */
+static int vectorL_mulm( lua_State *L )
+{
+   LuaVector *v;
+   double mod;
+
+   v   = luaL_checkvector(L,1);
+   mod = luaL_checknumber(L,2);
+   vect_cset( &v->vec, v->vec.x * mod, v->vec.y * mod );
+   lua_pushvalue(L,1);
+   return 1;
+}
+
+/**
+ * @brief Divides a vector by a number in place.
+ *
+ * Unlike div, no new vector is created.
+ *
+ * @usage my_vec:divm( 3 )
+ *
+ *    @luaparam v Vector to divide.
+ *    @luaparam mod Amount to divide by.
+ *    @luareturn The vector v itself.
+ * @luafunc divm( v, mod )
+ */
+static int vectorL_divm( lua_State *L )
+{
+   LuaVector *v;
+   double mod;
+
+   v   = luaL_checkvector(L,1);
+   mod = luaL_checknumber(L,2);
+   vect_cset( &v->vec, v->vec.x / mod, v->vec.y / mod );
+   lua_pushvalue(L,1);
+   return 1;
+}
+
+/**
+ * @brief Sets a vector to the linear interpolation of two vectors.
+ *
+ * @usage my_vec:lerpInto( a, b, 0.5 ) -- my_vec is now halfway between a and b
+ *
+ *    @luaparam v Vector to set.
+ *    @luaparam a Vector at t=0.
+ *    @luaparam b Vector at t=1.
+ *    @luaparam t Interpolation parameter.
+ *    @luareturn The vector v itself.
+ * @luafunc lerpInto( v, a, b, t )
+ */
+static int vectorL_lerpInto( lua_State *L )
+{
+   LuaVector *v, *a, *b;
+   double t;
+
+   v = luaL_checkvector(L,1);
+   a = luaL_checkvector(L,2);
+   b = luaL_checkvector(L,3);
+   t = luaL_checknumber(L,4);
+   vect_cset( &v->vec, a->vec.x + (b->vec.x - a->vec.x) * t,
+         a->vec.y + (b->vec.y - a->vec.y) * t );
+   lua_pushvalue(L,1);
+   return 1;
+}
+
+/**
+ * @brief Gets the distance between two points given by coordinates.
+ *
+ * @usage d = vec2.distxy( x1, y1, x2, y2 )
+ *
+ *    @luaparam x1 X coordinate of the first point.
+ *    @luaparam y1 Y coordinate of the first point.
+ *    @luaparam x2 X coordinate of the second point.
+ *    @luaparam y2 Y coordinate of the second point.
+ *    @luareturn The distance between the points.
+ * @luafunc distxy( x1, y1, x2, y2 )
+ */
+static int vectorL_distxy( lua_State *L )
+{
+   double dx, dy;
+
+   dx = luaL_checknumber(L,3) - luaL_checknumber(L,1);
+   dy = luaL_checknumber(L,4) - luaL_checknumber(L,2);
+   lua_pushnumber(L, sqrt( dx*dx + dy*dy ));
+   return 1;
+}
+
+/**
+ * @brief Gets the squared distance between two points given by coordinates.
+ *
+ * @usage d2 = vec2.dist2xy( x1, y1, x2, y2 )
+ *
+ *    @luaparam x1 X coordinate of the first point.
+ *    @luaparam y1 Y coordinate of the first point.
+ *    @luaparam x2 X coordinate of the second point.
+ *    @luaparam y2 Y coordinate of the second point.
+ *    @luareturn The squared distance between the points.
+ * @luafunc dist2xy( x1, y1, x2, y2 )
+ */
+static int vectorL_dist2xy( lua_State *L )
+{
+   double dx, dy;
+
+   dx = luaL_checknumber(L,3) - luaL_checknumber(L,1);
+   dy = luaL_checknumber(L,4) - luaL_checknumber(L,2);
+   lua_pushnumber(L, dx*dx + dy*dy);
+   return 1;
+}
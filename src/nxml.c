@@ -14,6 +14,31 @@
 #include "naev.h"
 
 #include "nstring.h"
+#include "ndata.h"
+
+
+/**
+ * @brief Parses an XML file from the ndata.
+ *
+ * The file is only viewed while parsing, so loose files are never copied.
+ *
+ *    @param filename Name of the file in the ndata.
+ *    @return The parsed document or NULL on error.
+ */
+xmlDocPtr xml_parseNdata( const char *filename )
+{
+   xmlDocPtr doc;
+   uint32_t bufsize;
+   void *buf;
+
+   buf = ndata_map( filename, &bufsize );
+   if (buf == NULL)
+      return NULL;
+   doc = xmlParseMemory( buf, bufsize );
+   ndata_unmap( buf, bufsize );
+
+   return doc;
+}
 
 
 /**
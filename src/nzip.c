@@ -9,6 +9,7 @@
  */
 void nzip_printError ( int err );
 int nzip_rwopsClose ( struct SDL_RWops* context );
+static int nzip_cmpEntry ( const void* p1, const void* p2 );
 
 
 
@@ -188,6 +189,129 @@ char** nzip_listFiles ( struct zip* arc, uint32_t* nfiles )
    return filelist;
 }
 
+/**
+ * @brief Compares two index entries by name.
+ */
+static int nzip_cmpEntry ( const void* p1, const void* p2 )
+{
+   return strcmp ( ((const NZipEntry*)p1)->name, ((const NZipEntry*)p2)->name );
+}
+
+/**
+ * @brief Builds an index of all the files in an archive sorted by name.
+ *
+ * Looking files up in the index avoids stat'ing them by name in the archive.
+ *
+ *    @param arc Archive to index
+ *    @param[out] nentries Number of entries in the index
+ *    @return The index, free with nzip_freeIndex
+ */
+NZipEntry* nzip_index ( struct zip* arc, int* nentries )
+{
+   struct zip_stat stats;
+   NZipEntry* entries;
+   zip_int64_t i, n;
+   int j;
+
+   n = zip_get_num_entries ( arc, 0 );
+   *nentries = 0;
+   if ( n <= 0 )
+      return NULL;
+
+   entries = malloc ( sizeof ( NZipEntry ) * n );
+
+   for ( i = 0, j = 0; i < n; i++ ) {
+      zip_stat_init ( &stats );
+      if ( zip_stat_index ( arc, i, 0, &stats ) ) {
+         WARN ( "Error indexing archive" );
+         WARN ( "%s", zip_strerror ( arc ) );
+         nzip_freeIndex ( entries, j );
+         return NULL;
+      }
+
+      // Directories aren't files
+      if ( stats.name[strlen(stats.name) - 1] == '/' )
+         continue;
+
+      entries[j].name  = strdup ( stats.name );
+      entries[j].index = stats.index;
+      entries[j].size  = stats.size;
+      j++;
+   }
+
+   qsort ( entries, j, sizeof ( NZipEntry ), nzip_cmpEntry );
+
+   *nentries = j;
+   return entries;
+}
+
+/**
+ * @brief Frees an archive index.
+ *
+ *    @param entries Index to free
+ *    @param nentries Number of entries in the index
+ */
+void nzip_freeIndex ( NZipEntry* entries, int nentries )
+{
+   int i;
+
+   for ( i = 0; i < nentries; i++ )
+      free ( entries[i].name );
+   free ( entries );
+}
+
+/**
+ * @brief Looks a file up in an archive index.
+ *
+ *    @param entries Index to look in
+ *    @param nentries Number of entries in the index
+ *    @param filename File to look for
+ *    @return The entry or NULL if not found
+ */
+NZipEntry* nzip_findEntry ( NZipEntry* entries, int nentries, const char* filename )
+{
+   NZipEntry key;
+
+   if ( entries == NULL )
+      return NULL;
+
+   key.name = (char*) filename;
+   return bsearch ( &key, entries, nentries, sizeof ( NZipEntry ), nzip_cmpEntry );
+}
+
+/**
+ * @brief Reads an indexed file into a buffer provided by the caller.
+ *
+ *    @param arc Archive the index belongs to
+ *    @param entry Entry to read
+ *    @param buf Buffer of at least entry->size bytes to read into
+ *    @return 0 on success
+ */
+int nzip_readEntry ( struct zip* arc, const NZipEntry* entry, void* buf )
+{
+   struct zip_file* file;
+   zip_int64_t read;
+
+   file = zip_fopen_index ( arc, entry->index, 0 );
+   if ( file == NULL ) {
+      WARN ( "Error reading %s from archive", entry->name );
+      WARN ( "%s", zip_strerror ( arc ) );
+      return -1;
+   }
+
+   // Decompress straight into the buffer
+   read = zip_fread ( file, buf, entry->size );
+   zip_fclose ( file );
+
+   if ( read < (zip_int64_t) entry->size ) {
+      WARN ( "Error reading %s from archive", entry->name );
+      WARN ( "%s", zip_strerror ( arc ) );
+      return -1;
+   }
+
+   return 0;
+}
+
 /**
  * @brief Print error message given a libzip error code
  *
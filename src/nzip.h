@@ -8,6 +8,15 @@
 #include <zip.h>
 #include <SDL.h>
 
+/**
+ * @brief An entry of an archive index.
+ */
+typedef struct NZipEntry_ {
+   char *name; /**< Name of the file. */
+   zip_uint64_t index; /**< Index in the archive. */
+   uint32_t size; /**< Uncompressed size of the file. */
+} NZipEntry;
+
 int nzip_isZip ( const char* filename );
 struct zip* nzip_open ( const char* filename );
 void nzip_close ( struct zip* arc );
@@ -16,6 +25,11 @@ int nzip_hasFile ( struct zip* arc, const char* filename );
 void* nzip_readFile ( struct zip* arc, const char* filename, uint32_t* size );
 char** nzip_listFiles ( struct zip* arc, uint32_t* nfiles );
 
+NZipEntry* nzip_index ( struct zip* arc, int* nentries );
+void nzip_freeIndex ( NZipEntry* entries, int nentries );
+NZipEntry* nzip_findEntry ( NZipEntry* entries, int nentries, const char* filename );
+int nzip_readEntry ( struct zip* arc, const NZipEntry* entry, void* buf );
+
 SDL_RWops* nzip_rwops ( struct zip* arc, const char* filename );
 
 #endif
@@ -39,6 +39,7 @@
 
 
 #define OPENGL_RENDER_VBO_SIZE      256 /**< Size of VBO. */
+#define OPENGL_BATCH_SIZE           512 /**< Maximum quads in a sprite batch. */
 
 
 static gl_vbo *gl_renderVBO = 0; /**< VBO for rendering stuff. */
@@ -46,6 +47,19 @@ static int gl_renderVBOtexOffset = 0; /**< VBO texture offset. */
 static int gl_renderVBOcolOffset = 0; /**< VBO colour offset. */
 
 
+/*
+ * Sprite batch.
+ */
+static gl_vbo *gl_batchVBO       = NULL; /**< Streaming VBO for the sprite batch. */
+static GLfloat *gl_batchVertex   = NULL; /**< Vertex, texture and colour planes of the batch. */
+static GLushort *gl_batchIndex   = NULL; /**< Indices to draw the quads as triangles. */
+static GLuint gl_batchTex        = 0; /**< Texture of the quads in the batch. */
+static int gl_batchN             = 0; /**< Quads in the batch. */
+static int gl_batchActive        = 0; /**< Batching depth, quads are only flushed when needed while >0. */
+static int gl_renderDraws        = 0; /**< Draw calls since last reset. */
+static int gl_renderVertices     = 0; /**< Vertices drawn since last reset. */
+
+
 /*
  * Circle textures.
  */
@@ -57,6 +71,11 @@ static glTexture *gl_circle      = NULL; /**< Circle mipmap. */
  */
 static void gl_drawCircleEmpty( const double cx, const double cy,
       const double r, const glColour *c );
+static void gl_batchQuad( const glTexture* texture,
+      const double x, const double y,
+      const double w, const double h,
+      const double tx, const double ty,
+      const double tw, const double th, const glColour *c );
 static void gl_blitTextureInterpolate(  const glTexture* ta,
       const glTexture* tb, const double inter,
       const double x, const double y,
@@ -78,6 +97,8 @@ void gl_renderRect( double x, double y, double w, double h, const glColour *c )
 {
    GLfloat vertex[4*2], col[4*4];
 
+   gl_batchFlush();
+
    /* Set the vertex. */
    /*   1--2
     *   |  |
@@ -117,6 +138,7 @@ void gl_renderRect( double x, double y, double w, double h, const glColour *c )
 
    /* Draw. */
    glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+   gl_renderCount( 4 );
 
    /* Clear state. */
    gl_vboDeactivate();
@@ -140,6 +162,8 @@ void gl_renderRectEmpty( double x, double y, double w, double h, const glColour
    GLfloat vx, vy, vxw, vyh;
    GLfloat vertex[5*2], col[5*4];
 
+   gl_batchFlush();
+
    /* Helper variables. */
    vx  = (GLfloat) x;
    vy  = (GLfloat) y;
@@ -187,6 +211,7 @@ void gl_renderRectEmpty( double x, double y, double w, double h, const glColour
 
    /* Draw. */
    glDrawArrays( GL_LINE_STRIP, 0, 5 );
+   gl_renderCount( 5 );
 
    /* Clear state. */
    gl_vboDeactivate();
@@ -210,6 +235,8 @@ void gl_renderCross( double x, double y, double r, const glColour *c )
    GLfloat vertex[2*4], colours[4*4];
    GLfloat vx,vy, vr;
 
+   gl_batchFlush();
+
    /* Set up stuff. */
    vx = x;
    vy = y;
@@ -239,40 +266,144 @@ void gl_renderCross( double x, double y, double r, const glColour *c )
    gl_vboActivateOffset( gl_renderVBO, GL_COLOR_ARRAY,
          gl_renderVBOcolOffset, 4, GL_FLOAT, 0 );
    glDrawArrays( GL_LINES, 0, 4 );
+   gl_renderCount( 4 );
    gl_vboDeactivate();
 }
 
 
 /**
- * @brief Texture blitting backend.
+ * @brief Counts a draw call in the render statistics.
  *
- *    @param texture Texture to blit.
- *    @param x X position of the texture on the screen. (units pixels)
- *    @param y Y position of the texture on the screen. (units pixels)
- *    @param w Width on the screen. (units pixels)
- *    @param h Height on the screen. (units pixels)
- *    @param tx X position within the texture. [0:1]
- *    @param ty Y position within the texture. [0:1]
- *    @param tw Texture width. [0:1]
- *    @param th Texture height. [0:1]
- *    @param c Colour to use (modifies texture colour).
+ *    @param vertices Vertices drawn.
  */
-void gl_blitTexture(  const glTexture* texture,
+void gl_renderCount( int vertices )
+{
+   gl_renderDraws++;
+   gl_renderVertices += vertices;
+}
+
+
+/**
+ * @brief Gets the render statistics since the last reset.
+ *
+ *    @param[out] draws Draw calls issued.
+ *    @param[out] vertices Vertices drawn.
+ */
+void gl_renderStats( int *draws, int *vertices )
+{
+   *draws    = gl_renderDraws;
+   *vertices = gl_renderVertices;
+}
+
+
+/**
+ * @brief Resets the render statistics.
+ */
+void gl_renderStatsReset (void)
+{
+   gl_renderDraws    = 0;
+   gl_renderVertices = 0;
+}
+
+
+/**
+ * @brief Starts batching sprites.
+ *
+ * Until gl_batchEnd is called, blits are accumulated and only drawn when the
+ *  texture changes or the batch fills up.  Anything else that draws must call
+ *  gl_batchFlush first to keep the drawing order.  Batches may be nested.
+ */
+void gl_batchBegin (void)
+{
+   gl_batchActive++;
+}
+
+
+/**
+ * @brief Draws all the sprites pending in the batch.
+ */
+void gl_batchFlush (void)
+{
+   int n;
+
+   if (gl_batchN == 0)
+      return;
+   n = gl_batchN;
+   gl_batchN = 0;
+
+   /* Bind the texture. */
+   glEnable(GL_TEXTURE_2D);
+   glBindTexture( GL_TEXTURE_2D, gl_batchTex );
+
+   /* Upload the used part of each plane. */
+   gl_vboSubData( gl_batchVBO, 0, n*4*2*sizeof(GLfloat), gl_batchVertex );
+   gl_vboActivateOffset( gl_batchVBO, GL_VERTEX_ARRAY, 0, 2, GL_FLOAT, 0 );
+   gl_vboSubData( gl_batchVBO, OPENGL_BATCH_SIZE*4*2*sizeof(GLfloat),
+         n*4*2*sizeof(GLfloat), &gl_batchVertex[ OPENGL_BATCH_SIZE*4*2 ] );
+   gl_vboActivateOffset( gl_batchVBO, GL_TEXTURE_COORD_ARRAY,
+         OPENGL_BATCH_SIZE*4*2*sizeof(GLfloat), 2, GL_FLOAT, 0 );
+   gl_vboSubData( gl_batchVBO, OPENGL_BATCH_SIZE*4*(2+2)*sizeof(GLfloat),
+         n*4*4*sizeof(GLfloat), &gl_batchVertex[ OPENGL_BATCH_SIZE*4*(2+2) ] );
+   gl_vboActivateOffset( gl_batchVBO, GL_COLOR_ARRAY,
+         OPENGL_BATCH_SIZE*4*(2+2)*sizeof(GLfloat), 4, GL_FLOAT, 0 );
+
+   /* Draw. */
+   glDrawElements( GL_TRIANGLES, 6*n, GL_UNSIGNED_SHORT, gl_batchIndex );
+   gl_renderCount( 4*n );
+
+   /* Clear state. */
+   gl_vboDeactivate();
+   glDisable(GL_TEXTURE_2D);
+
+   /* anything failed? */
+   gl_checkErr();
+}
+
+
+/**
+ * @brief Stops batching sprites, drawing whatever is pending.
+ */
+void gl_batchEnd (void)
+{
+   if (gl_batchActive <= 0) {
+      WARN("Ending sprite batch that wasn't started.");
+      return;
+   }
+   gl_batchActive--;
+   if (gl_batchActive == 0)
+      gl_batchFlush();
+}
+
+
+/**
+ * @brief Adds a textured quad to the sprite batch.
+ *
+ * See gl_blitTexture for the parameters.
+ */
+static void gl_batchQuad( const glTexture* texture,
       const double x, const double y,
       const double w, const double h,
       const double tx, const double ty,
       const double tw, const double th, const glColour *c )
 {
-   GLfloat vertex[4*2], tex[4*2], col[4*4];
+   int i;
+   GLfloat *vertex, *tex, *col;
 
-   /* Bind the texture. */
-   glEnable(GL_TEXTURE_2D);
-   glBindTexture( GL_TEXTURE_2D, texture->texture);
+   /* Texture change or full batch. */
+   if ((gl_batchN > 0) &&
+         ((gl_batchTex != texture->texture) || (gl_batchN >= OPENGL_BATCH_SIZE)))
+      gl_batchFlush();
+   gl_batchTex = texture->texture;
 
    /* Must have colour for now. */
    if (c == NULL)
       c = &cWhite;
 
+   vertex = &gl_batchVertex[ gl_batchN*4*2 ];
+   tex    = &gl_batchVertex[ OPENGL_BATCH_SIZE*4*2 + gl_batchN*4*2 ];
+   col    = &gl_batchVertex[ OPENGL_BATCH_SIZE*4*(2+2) + gl_batchN*4*4 ];
+   gl_batchN++;
+
    /* Set the vertex. */
    vertex[0] = (GLfloat)x;
    vertex[4] = vertex[0];
@@ -282,8 +413,6 @@ void gl_blitTexture(  const glTexture* texture,
    vertex[3] = vertex[1];
    vertex[5] = vertex[1] + (GLfloat)h;
    vertex[7] = vertex[5];
-   gl_vboSubData( gl_renderVBO, 0, 4*2*sizeof(GLfloat), vertex );
-   gl_vboActivateOffset( gl_renderVBO, GL_VERTEX_ARRAY, 0, 2, GL_FLOAT, 0 );
 
    /* Set the texture. */
    tex[0] = (GLfloat)tx;
@@ -294,40 +423,43 @@ void gl_blitTexture(  const glTexture* texture,
    tex[3] = tex[1];
    tex[5] = tex[1] + (GLfloat)th;
    tex[7] = tex[5];
-   gl_vboSubData( gl_renderVBO, gl_renderVBOtexOffset, 4*2*sizeof(GLfloat), tex );
-   gl_vboActivateOffset( gl_renderVBO, GL_TEXTURE_COORD_ARRAY,
-         gl_renderVBOtexOffset, 2, GL_FLOAT, 0 );
 
    /* Set the colour. */
-   col[0] = c->r;
-   col[1] = c->g;
-   col[2] = c->b;
-   col[3] = c->a;
-   col[4] = col[0];
-   col[5] = col[1];
-   col[6] = col[2];
-   col[7] = col[3];
-   col[8] = col[0];
-   col[9] = col[1];
-   col[10] = col[2];
-   col[11] = col[3];
-   col[12] = col[0];
-   col[13] = col[1];
-   col[14] = col[2];
-   col[15] = col[3];
-   gl_vboSubData( gl_renderVBO, gl_renderVBOcolOffset, 4*4*sizeof(GLfloat), col );
-   gl_vboActivateOffset( gl_renderVBO, GL_COLOR_ARRAY,
-         gl_renderVBOcolOffset, 4, GL_FLOAT, 0 );
-
-   /* Draw. */
-   glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+   for (i=0; i<4; i++) {
+      col[4*i+0] = c->r;
+      col[4*i+1] = c->g;
+      col[4*i+2] = c->b;
+      col[4*i+3] = c->a;
+   }
+}
 
-   /* Clear state. */
-   gl_vboDeactivate();
-   glDisable(GL_TEXTURE_2D);
 
-   /* anything failed? */
-   gl_checkErr();
+/**
+ * @brief Texture blitting backend.
+ *
+ * Goes through the sprite batch, so it's only drawn right away when not
+ *  batching.
+ *
+ *    @param texture Texture to blit.
+ *    @param x X position of the texture on the screen. (units pixels)
+ *    @param y Y position of the texture on the screen. (units pixels)
+ *    @param w Width on the screen. (units pixels)
+ *    @param h Height on the screen. (units pixels)
+ *    @param tx X position within the texture. [0:1]
+ *    @param ty Y position within the texture. [0:1]
+ *    @param tw Texture width. [0:1]
+ *    @param th Texture height. [0:1]
+ *    @param c Colour to use (modifies texture colour).
+ */
+void gl_blitTexture(  const glTexture* texture,
+      const double x, const double y,
+      const double w, const double h,
+      const double tx, const double ty,
+      const double tw, const double th, const glColour *c )
+{
+   gl_batchQuad( texture, x, y, w, h, tx, ty, tw, th, c );
+   if (!gl_batchActive)
+      gl_batchFlush();
 }
 
 
@@ -381,6 +513,9 @@ static void gl_blitTextureInterpolate(  const glTexture* ta,
          gl_blitTexture( tb, x, y, w, h, tx, ty, tw, th, c );
    }
 
+   /* The interpolation constant is per blit so it can't be batched. */
+   gl_batchFlush();
+
    /* Set default colour. */
    if (c == NULL)
       c = &cWhite;
@@ -491,6 +626,7 @@ static void gl_blitTextureInterpolate(  const glTexture* ta,
 
    /* Draw. */
    glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+   gl_renderCount( 4 );
 
    /* Clear state. */
    gl_vboDeactivate();
@@ -782,6 +918,8 @@ void gl_drawCircleLoop( const double cx, const double cy,
    double nxc, xc, yc;
    GLfloat vertex[2*OPENGL_RENDER_VBO_SIZE], col[4*OPENGL_RENDER_VBO_SIZE];
 
+   gl_batchFlush();
+
    /* Aim for 10 px between each vertex. */
    points = CLAMP( 8, OPENGL_RENDER_VBO_SIZE, (int)ceil(M_PI * r * 5.) );
 
@@ -822,6 +960,7 @@ void gl_drawCircleLoop( const double cx, const double cy,
 
    /* Draw. */
    glDrawArrays( GL_LINE_LOOP, 0, points );
+   gl_renderCount( points );
 
    /* Clear state. */
    gl_vboDeactivate();
@@ -849,6 +988,8 @@ static void gl_drawCircleEmpty( const double cx, const double cy,
    double x,y,p;
    GLfloat vertex[2*OPENGL_RENDER_VBO_SIZE], col[4*OPENGL_RENDER_VBO_SIZE];
 
+   gl_batchFlush();
+
    /* Starting parameters. */
    i = 0;
    x = 0;
@@ -906,6 +1047,7 @@ static void gl_drawCircleEmpty( const double cx, const double cy,
 
    /* Draw. */
    glDrawArrays( GL_POINTS, 0, i );
+   gl_renderCount( i );
 
    /* Clear state. */
    gl_vboDeactivate();
@@ -950,6 +1092,7 @@ void gl_clipRect( int x, int y, int w, int h )
    ry = (y + gl_screen.y) / gl_screen.myscale;
    rw = w / gl_screen.mxscale;
    rh = h / gl_screen.myscale;
+   gl_batchFlush();
    glScissor( rx, ry, rw, rh );
    glEnable( GL_SCISSOR_TEST );
 }
@@ -960,6 +1103,7 @@ void gl_clipRect( int x, int y, int w, int h )
  */
 void gl_unclipRect (void)
 {
+   gl_batchFlush();
    glDisable( GL_SCISSOR_TEST );
    glScissor( 0, 0, gl_screen.rw, gl_screen.rh );
 }
@@ -994,6 +1138,8 @@ void gl_drawCircleInRect( const double cx, const double cy, const double r,
    double rxw,ryh, x,y,p, w,h, tx,ty, tw,th, r2;
    GLfloat vertex[2*OPENGL_RENDER_VBO_SIZE], col[4*OPENGL_RENDER_VBO_SIZE];
 
+   gl_batchFlush();
+
    rxw = rx+rw;
    ryh = ry+rh;
 
@@ -1085,6 +1231,7 @@ void gl_drawCircleInRect( const double cx, const double cy, const double r,
 
    /* Draw. */
    glDrawArrays( GL_POINTS, 0, i );
+   gl_renderCount( i );
 
    /* Clear state. */
    gl_vboDeactivate();
@@ -1153,12 +1300,30 @@ glTexture *gl_genCircle( int radius )
  */
 int gl_initRender (void)
 {
+   int i;
+
    /* Initialize the VBO. */
    gl_renderVBO = gl_vboCreateStream( sizeof(GLfloat) *
          OPENGL_RENDER_VBO_SIZE*(2 + 2 + 4), NULL );
    gl_renderVBOtexOffset = sizeof(GLfloat) * OPENGL_RENDER_VBO_SIZE*2;
    gl_renderVBOcolOffset = sizeof(GLfloat) * OPENGL_RENDER_VBO_SIZE*(2+2);
 
+   /* Initialize the sprite batch, quads are drawn as two triangles. */
+   gl_batchVBO    = gl_vboCreateStream( sizeof(GLfloat) *
+         OPENGL_BATCH_SIZE*4*(2 + 2 + 4), NULL );
+   gl_batchVertex = malloc( sizeof(GLfloat) * OPENGL_BATCH_SIZE*4*(2 + 2 + 4) );
+   gl_batchIndex  = malloc( sizeof(GLushort) * OPENGL_BATCH_SIZE*6 );
+   for (i=0; i<OPENGL_BATCH_SIZE; i++) {
+      gl_batchIndex[6*i+0] = 4*i+0;
+      gl_batchIndex[6*i+1] = 4*i+1;
+      gl_batchIndex[6*i+2] = 4*i+2;
+      gl_batchIndex[6*i+3] = 4*i+2;
+      gl_batchIndex[6*i+4] = 4*i+1;
+      gl_batchIndex[6*i+5] = 4*i+3;
+   }
+   gl_batchN      = 0;
+   gl_batchActive = 0;
+
    /* Initialize the circles. */
    gl_circle      = gl_genCircle( 128 );
 
@@ -1175,6 +1340,14 @@ void gl_exitRender (void)
    gl_vboDestroy( gl_renderVBO );
    gl_renderVBO = NULL;
 
+   /* Destroy the sprite batch. */
+   gl_vboDestroy( gl_batchVBO );
+   gl_batchVBO = NULL;
+   free( gl_batchVertex );
+   gl_batchVertex = NULL;
+   free( gl_batchIndex );
+   gl_batchIndex = NULL;
+
    /* Destroy the circles. */
    gl_freeTexture(gl_circle);
    gl_circle = NULL;
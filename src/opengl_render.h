@@ -27,6 +27,13 @@ void gl_screenToGameCoords( double *nx, double *ny, int bx, int by );
 /*
  * Rendering.
  */
+/* Sprite batching. */
+void gl_batchBegin (void);
+void gl_batchFlush (void);
+void gl_batchEnd (void);
+void gl_renderCount( int vertices );
+void gl_renderStats( int *draws, int *vertices );
+void gl_renderStatsReset (void);
 /* blits texture */
 void gl_blitTexture(  const glTexture* texture,
       const double x, const double y,
@@ -6,6 +6,11 @@
  * @file opengl_tex.c
  *
  * @brief This file handles the opengl texture wrapper routines.
+ *
+ * Transparency maps used for collisions are cached in a single pack file
+ *  that is read once and only appended to. Entries are looked up by texture
+ *  name and validated with a key made from the image size and a hash of the
+ *  PNG data.
  */
 
 
@@ -24,7 +29,8 @@
 #include "gui.h"
 #include "conf.h"
 #include "npng.h"
-#include "md5.h"
+#include "threadpool.h"
+#include "SDL_thread.h"
 
 
 /*
@@ -41,12 +47,62 @@ typedef struct glTexList_ {
 static glTexList* texture_list = NULL; /**< Texture list. */
 
 
+/**
+ * @brief Image being decoded in the background before it is needed.
+ */
+typedef struct glTexPrefetch_ {
+   struct glTexPrefetch_ *next; /**< Next in linked list. */
+   char *path; /**< Path of the image. */
+   unsigned int flags; /**< Flags the image will be loaded with. */
+   int pot; /**< Whether to pad to a power of two. */
+   char *data; /**< Contents of the file. */
+   uint32_t size; /**< Size of the file. */
+   SDL_Surface *surface; /**< Decoded image or NULL on failure. */
+   png_uint_32 w; /**< Width of the image. */
+   png_uint_32 h; /**< Height of the image. */
+   int sx; /**< Number of X sprites. */
+   int sy; /**< Number of Y sprites. */
+   int done; /**< Whether decoding is finished. */
+} glTexPrefetch;
+static glTexPrefetch* tex_prefetch = NULL; /**< Images being prefetched. */
+static SDL_mutex *tex_prefetchLock = NULL; /**< Protects the done flags. */
+static SDL_cond *tex_prefetchCond = NULL; /**< Signals a finished image. */
+
+
 /*
  * Extensions.
  */
 static int gl_tex_ext_npot = 0; /**< Support for GL_ARB_texture_non_power_of_two. */
 
 
+/*
+ * Collision cache.
+ */
+#define TRANS_CACHE_FILE      "collisions.pack" /**< Name of the cache file. */
+#define TRANS_CACHE_MAGIC     "NCOL" /**< Magic of the cache file. */
+#define TRANS_CACHE_VERSION   2 /**< Version of the cache file format. */
+#define TRANS_CACHE_HEADER    8 /**< Size of the file header. */
+#define TRANS_CACHE_RECORD    20 /**< Size of a record header. */
+#define TRANS_CACHE_SAMPLE    4096 /**< Bytes of the PNG hashed at a time. */
+#define TRANS_CACHE_MIN       256 /**< Minimum size of the lookup table. */
+/**
+ * @brief A cached transparency map.
+ */
+typedef struct glTransEntry_ {
+   uint64_t name; /**< Hash of the texture name, 0 if unused. */
+   uint64_t key; /**< Key of the image data. */
+   const uint8_t *data; /**< Transparency map. */
+   uint32_t size; /**< Size of the transparency map. */
+   int owned; /**< Whether data was allocated separately. */
+} glTransEntry;
+static glTransEntry *trans_cache = NULL; /**< Lookup table by name hash. */
+static int trans_ncache = 0; /**< Entries in the lookup table. */
+static int trans_mcache = 0; /**< Size of the lookup table (power of two). */
+static char *trans_pack = NULL; /**< Contents of the cache file. */
+static int trans_loaded = 0; /**< Whether the cache file was loaded. */
+static FILE *trans_out = NULL; /**< Cache file being appended to. */
+
+
 /*
  * prototypes
  */
@@ -55,11 +111,25 @@ static int gl_tex_ext_npot = 0; /**< Support for GL_ARB_texture_non_power_of_two
 static int SDL_IsTrans( SDL_Surface* s, int x, int y );
 static uint8_t* SDL_MapTrans( SDL_Surface* s, int w, int h );
 static size_t gl_transSize( const int w, const int h );
+static uint64_t gl_transHash( uint64_t h, const void *data, size_t len );
+static uint64_t gl_transKey( SDL_RWops *rw, int w, int h );
+static glTransEntry* gl_transGet( uint64_t name );
+static void gl_transAdd( uint64_t name, uint64_t key, const uint8_t *data, uint32_t size, int owned );
+static void gl_transLoad (void);
+static void gl_transWrite( FILE *f, uint64_t name, uint64_t key, const uint8_t *data, uint32_t size );
+static void gl_transCompact( const char *path );
+static void gl_transSave( uint64_t name, uint64_t key, const uint8_t *data, uint32_t size );
+static void gl_transFree (void);
 /* glTexture */
 static GLuint gl_loadSurface( SDL_Surface* surface, int *rw, int *rh, unsigned int flags, int freesur );
 static glTexture* gl_loadNewImage( const char* path, unsigned int flags );
 /* List. */
 static glTexture* gl_texExists( const char* path );
+/* Prefetching. */
+static int gl_prefetchThread( void *data );
+static void gl_prefetchWait( glTexPrefetch *pf );
+static void gl_prefetchFree( glTexPrefetch *pf );
+static glTexture* gl_prefetchLoad( const char* path, const unsigned int flags );
 static int gl_texAdd( glTexture *tex );
 
 
@@ -379,6 +449,279 @@ static GLuint gl_loadSurface( SDL_Surface* surface, int *rw, int *rh, unsigned i
 }
 
 
+/**
+ * @brief 64 bit FNV-1a hash.
+ */
+static uint64_t gl_transHash( uint64_t h, const void *data, size_t len )
+{
+   const uint8_t *p;
+   size_t i;
+
+   p = (const uint8_t*) data;
+   for (i=0; i<len; i++) {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+
+/**
+ * @brief Gets the key of an image.
+ *
+ * The whole PNG is hashed, which is still much cheaper than decoding it
+ *  and building the transparency map.
+ *
+ *    @param rw RWops of the PNG.
+ *    @param w Width of the image.
+ *    @param h Height of the image.
+ *    @return Key of the image.
+ */
+static uint64_t gl_transKey( SDL_RWops *rw, int w, int h )
+{
+   uint8_t buf[TRANS_CACHE_SAMPLE];
+   uint64_t key;
+   long size, n;
+
+   key  = 14695981039346656037ULL;
+   size = SDL_RWseek( rw, 0, SEEK_END );
+   key  = gl_transHash( key, &size, sizeof(size) );
+   key  = gl_transHash( key, &w, sizeof(w) );
+   key  = gl_transHash( key, &h, sizeof(h) );
+
+   /* Contents of the file. */
+   SDL_RWseek( rw, 0, SEEK_SET );
+   while ((n = SDL_RWread( rw, buf, 1, TRANS_CACHE_SAMPLE )) > 0)
+      key = gl_transHash( key, buf, n );
+   SDL_RWseek( rw, 0, SEEK_SET );
+
+   return key;
+}
+
+
+/**
+ * @brief Gets a cached transparency map by texture name.
+ */
+static glTransEntry* gl_transGet( uint64_t name )
+{
+   uint32_t i;
+
+   if (trans_mcache == 0)
+      return NULL;
+
+   for (i=(uint32_t)name & (trans_mcache-1); trans_cache[i].name != 0;
+         i = (i+1) & (trans_mcache-1))
+      if (trans_cache[i].name == name)
+         return &trans_cache[i];
+   return NULL;
+}
+
+
+/**
+ * @brief Adds a transparency map to the lookup table, replacing older ones.
+ */
+static void gl_transAdd( uint64_t name, uint64_t key, const uint8_t *data, uint32_t size, int owned )
+{
+   glTransEntry *e, *old;
+   int i, mold;
+   uint32_t j;
+
+   e = gl_transGet( name );
+   if (e == NULL) {
+      /* Keep the table at most half full. */
+      if (2*(trans_ncache+1) > trans_mcache) {
+         old  = trans_cache;
+         mold = trans_mcache;
+         trans_mcache = MAX( TRANS_CACHE_MIN, 2*mold );
+         trans_cache  = calloc( trans_mcache, sizeof(glTransEntry) );
+         for (i=0; i<mold; i++) {
+            if (old[i].name == 0)
+               continue;
+            for (j=(uint32_t)old[i].name & (trans_mcache-1); trans_cache[j].name != 0;
+                  j = (j+1) & (trans_mcache-1));
+            trans_cache[j] = old[i];
+         }
+         free(old);
+      }
+      for (j=(uint32_t)name & (trans_mcache-1); trans_cache[j].name != 0;
+            j = (j+1) & (trans_mcache-1));
+      e = &trans_cache[j];
+      trans_ncache++;
+   }
+   else if (e->owned)
+      free( (void*)e->data );
+
+   e->name  = name;
+   e->key   = key;
+   e->data  = data;
+   e->size  = size;
+   e->owned = owned;
+}
+
+
+/**
+ * @brief Loads the collision cache file.
+ */
+static void gl_transLoad (void)
+{
+   char path[PATH_MAX];
+   uint64_t name, key;
+   uint32_t size, version;
+   int len, pos, nrecords;
+
+   trans_loaded = 1;
+
+   nsnprintf( path, sizeof(path), "%s"TRANS_CACHE_FILE, nfile_cachePath() );
+   if (!nfile_fileExists( path ))
+      return;
+
+   /* One read for the whole cache. */
+   trans_pack = nfile_readFile( &len, path );
+   if (trans_pack == NULL)
+      return;
+
+   /* Check header. */
+   version = 0;
+   if (len >= TRANS_CACHE_HEADER)
+      memcpy( &version, &trans_pack[4], sizeof(uint32_t) );
+   if ((version != TRANS_CACHE_VERSION) || (memcmp( trans_pack, TRANS_CACHE_MAGIC, 4 ) != 0)) {
+      free(trans_pack);
+      trans_pack = NULL;
+      nfile_delete( path );
+      return;
+   }
+
+   /* Index the records, later ones replace earlier ones. */
+   nrecords = 0;
+   pos      = TRANS_CACHE_HEADER;
+   while (pos + TRANS_CACHE_RECORD <= len) {
+      memcpy( &name, &trans_pack[pos],    sizeof(uint64_t) );
+      memcpy( &key,  &trans_pack[pos+8],  sizeof(uint64_t) );
+      memcpy( &size, &trans_pack[pos+16], sizeof(uint32_t) );
+      pos += TRANS_CACHE_RECORD;
+      if ((name == 0) || (size > (uint32_t)(len - pos)))
+         break; /* Truncated by a crash. */
+      gl_transAdd( name, key, (const uint8_t*)&trans_pack[pos], size, 0 );
+      pos += size;
+      nrecords++;
+   }
+
+   /* Drop replaced or truncated records if they waste too much. */
+   if ((pos != len) || (nrecords > 2*trans_ncache))
+      gl_transCompact( path );
+}
+
+
+/**
+ * @brief Writes a record to the collision cache file.
+ */
+static void gl_transWrite( FILE *f, uint64_t name, uint64_t key, const uint8_t *data, uint32_t size )
+{
+   fwrite( &name, sizeof(uint64_t), 1, f );
+   fwrite( &key,  sizeof(uint64_t), 1, f );
+   fwrite( &size, sizeof(uint32_t), 1, f );
+   fwrite( data, 1, size, f );
+}
+
+
+/**
+ * @brief Rewrites the collision cache file with only the current entries.
+ */
+static void gl_transCompact( const char *path )
+{
+   char tmp[PATH_MAX];
+   uint32_t version;
+   FILE *f;
+   int i;
+
+   nsnprintf( tmp, sizeof(tmp), "%s.tmp", path );
+   f = fopen( tmp, "wb" );
+   if (f == NULL)
+      return;
+
+   version = TRANS_CACHE_VERSION;
+   fwrite( TRANS_CACHE_MAGIC, 1, 4, f );
+   fwrite( &version, sizeof(uint32_t), 1, f );
+   for (i=0; i<trans_mcache; i++)
+      if (trans_cache[i].name != 0)
+         gl_transWrite( f, trans_cache[i].name, trans_cache[i].key,
+               trans_cache[i].data, trans_cache[i].size );
+
+   if (fclose(f) != 0) {
+      remove( tmp );
+      return;
+   }
+#if HAS_WIN32
+   remove( path ); /* Windows won't rename over existing files. */
+#endif /* HAS_WIN32 */
+   if (rename( tmp, path ) != 0)
+      remove( tmp );
+}
+
+
+/**
+ * @brief Appends a newly generated transparency map to the cache.
+ */
+static void gl_transSave( uint64_t name, uint64_t key, const uint8_t *data, uint32_t size )
+{
+   char path[PATH_MAX];
+   uint32_t version;
+   uint8_t *copy;
+
+   /* Remember it for textures loaded again this session. */
+   copy = malloc( size );
+   memcpy( copy, data, size );
+   gl_transAdd( name, key, copy, size, 1 );
+
+   /* Open the file once for the session. */
+   if (trans_out == NULL) {
+      if (nfile_dirMakeExist( "%s", nfile_cachePath() ) < 0)
+         return;
+      nsnprintf( path, sizeof(path), "%s"TRANS_CACHE_FILE, nfile_cachePath() );
+      trans_out = fopen( path, "ab" );
+      if (trans_out == NULL) {
+         WARN("Unable to open collision cache '%s' for writing.", path);
+         return;
+      }
+
+      /* New file needs a header. */
+      if (ftell( trans_out ) == 0) {
+         version = TRANS_CACHE_VERSION;
+         fwrite( TRANS_CACHE_MAGIC, 1, 4, trans_out );
+         fwrite( &version, sizeof(uint32_t), 1, trans_out );
+      }
+   }
+
+   gl_transWrite( trans_out, name, key, data, size );
+}
+
+
+/**
+ * @brief Frees the collision cache.
+ */
+static void gl_transFree (void)
+{
+   int i;
+
+   if (trans_out != NULL) {
+      fclose( trans_out );
+      trans_out = NULL;
+   }
+
+   for (i=0; i<trans_mcache; i++)
+      if (trans_cache[i].owned)
+         free( (void*)trans_cache[i].data );
+   free( trans_cache );
+   trans_cache  = NULL;
+   trans_ncache = 0;
+   trans_mcache = 0;
+
+   free( trans_pack );
+   trans_pack   = NULL;
+   trans_loaded = 0;
+}
+
+
 /**
  * @brief Wrapper for gl_loadImagePad that includes transparency mapping.
  *
@@ -397,13 +740,10 @@ glTexture* gl_loadImagePadTrans( const char *name, SDL_Surface* surface, SDL_RWo
       unsigned int flags, int w, int h, int sx, int sy, int freesur )
 {
    glTexture *texture;
-   int i, filesize;
-   size_t cachesize, pngsize;
+   size_t cachesize;
    uint8_t *trans;
-   char *cachefile, *data;
-   char digest[33];
-   md5_state_t md5;
-   md5_byte_t *md5val;
+   uint64_t namehash, key;
+   glTransEntry *e;
 
    if (name != NULL) {
       texture = gl_texExists( name );
@@ -417,68 +757,41 @@ glTexture* gl_loadImagePadTrans( const char *name, SDL_Surface* surface, SDL_RWo
    /* Appropriate size for the transparency map, see SDL_MapTrans */
    cachesize = gl_transSize(w, h);
 
-   cachefile = NULL;
-   trans     = NULL;
-
-   if (rw != NULL) {
-      md5val = malloc(16);
-      md5_init(&md5);
-
-      pngsize = SDL_RWseek( rw, 0, SEEK_END );
-      SDL_RWseek( rw, 0, SEEK_SET );
-
-      data = malloc(pngsize);
-      if (data == NULL)
-         WARN("Out of memory!");
-      else {
-         SDL_RWread( rw, data, pngsize, 1 );
-         md5_append( &md5, (md5_byte_t*)data, pngsize );
-         free(data);
-      }
-      md5_finish( &md5, md5val );
+   trans    = NULL;
+   namehash = 0;
+   key      = 0;
 
-      for (i=0; i<16; i++)
-         nsnprintf( &digest[i * 2], 3, "%02x", md5val[i] );
-      free(md5val);
-
-      cachefile = malloc( PATH_MAX );
-      nsnprintf( cachefile, PATH_MAX, "%scollisions/%s",
-         nfile_cachePath(), digest );
-
-      /* Attempt to find a cached transparency map. */
-      if (nfile_fileExists(cachefile)) {
-         trans = (uint8_t*)nfile_readFile( &filesize, cachefile );
-
-         /* Consider cached data invalid if the length doesn't match. */
-         if (trans != NULL && cachesize != (unsigned int)filesize) {
-            free(trans);
-            trans = NULL;
-         }
-         /* Cached data matches, no need to overwrite. */
-         else {
-            free(cachefile);
-            cachefile = NULL;
-         }
-      }
-   }
-   else {
+   if (rw == NULL) {
       /* We could hash raw pixel data here, but that's slower than just
        * generating the map from scratch.
        */
       WARN("Texture '%s' has no RWops", name);
    }
+   else if (name != NULL) {
+      if (!trans_loaded)
+         gl_transLoad();
+
+      namehash = gl_transHash( 14695981039346656037ULL, name, strlen(name) );
+      if (namehash == 0)
+         namehash = 1; /* 0 marks free slots. */
+      key = gl_transKey( rw, w, h );
+
+      /* Attempt to find a cached transparency map. */
+      e = gl_transGet( namehash );
+      if ((e != NULL) && (e->key == key) && (e->size == cachesize)) {
+         trans = malloc( cachesize );
+         memcpy( trans, e->data, cachesize );
+      }
+   }
 
    if (trans == NULL) {
       SDL_LockSurface(surface);
       trans = SDL_MapTrans( surface, w, h );
       SDL_UnlockSurface(surface);
 
-      if (cachefile != NULL) {
-         /* Cache newly-generated transparency map. */
-         nfile_dirMakeExist( "%s/collisions/", nfile_cachePath() );
-         nfile_writeFile( (char*)trans, cachesize, cachefile );
-         free(cachefile);
-      }
+      /* Cache newly-generated transparency map. */
+      if (namehash != 0)
+         gl_transSave( namehash, key, trans, cachesize );
    }
 
    texture = gl_loadImagePad( name, surface, flags, w, h, sx, sy, freesur );
@@ -626,11 +939,178 @@ glTexture* gl_newImage( const char* path, const unsigned int flags )
    if (t != NULL)
       return t;
 
+   /* Might have been decoded already. */
+   t = gl_prefetchLoad( path, flags );
+   if (t != NULL)
+      return t;
+
    /* Load the image */
    return gl_loadNewImage( path, flags );
 }
 
 
+/**
+ * @brief Decodes a prefetched image, runs on a worker thread.
+ */
+static int gl_prefetchThread( void *data )
+{
+   glTexPrefetch *pf;
+   SDL_RWops *rw;
+   npng_t *npng;
+   char *str;
+   int len;
+
+   pf = (glTexPrefetch*) data;
+
+   rw = SDL_RWFromConstMem( pf->data, pf->size );
+   npng = (rw != NULL) ? npng_open( rw ) : NULL;
+   if (npng != NULL) {
+      npng_dim( npng, &pf->w, &pf->h );
+
+      /* Process metadata. */
+      len    = npng_metadata( npng, "sx", &str );
+      pf->sx = (len > 0) ? atoi(str) : 1;
+      len    = npng_metadata( npng, "sy", &str );
+      pf->sy = (len > 0) ? atoi(str) : 1;
+
+      /* Load surface. */
+      pf->surface = npng_readSurface( npng, pf->pot, 1 );
+      npng_close( npng );
+   }
+   if (rw != NULL)
+      SDL_RWclose( rw );
+
+   /* Signal completion. */
+   SDL_mutexP( tex_prefetchLock );
+   pf->done = 1;
+   SDL_CondBroadcast( tex_prefetchCond );
+   SDL_mutexV( tex_prefetchLock );
+   return 0;
+}
+
+
+/**
+ * @brief Waits until a prefetched image is decoded.
+ */
+static void gl_prefetchWait( glTexPrefetch *pf )
+{
+   SDL_mutexP( tex_prefetchLock );
+   while (!pf->done)
+      SDL_CondWait( tex_prefetchCond, tex_prefetchLock );
+   SDL_mutexV( tex_prefetchLock );
+}
+
+
+/**
+ * @brief Frees a prefetched image that is done decoding.
+ */
+static void gl_prefetchFree( glTexPrefetch *pf )
+{
+   if (pf->surface != NULL)
+      SDL_FreeSurface( pf->surface );
+   free( pf->data );
+   free( pf->path );
+   free( pf );
+}
+
+
+/**
+ * @brief Starts decoding an image in the background.
+ *
+ * The file is read on the calling thread and decoded on the thread pool. The
+ *  next gl_newImage of the same path with the same flags just uploads the
+ *  result. Images that need a transparency map are not prefetched.
+ *
+ *    @param path Image to prefetch.
+ *    @param flags Flags the image will be loaded with.
+ */
+void gl_prefetchImage( const char* path, const unsigned int flags )
+{
+   glTexPrefetch *pf;
+   glTexList *cur;
+
+   if (flags & OPENGL_TEX_MAPTRANS)
+      return;
+
+   /* Already loaded or being prefetched. */
+   for (cur=texture_list; cur!=NULL; cur=cur->next)
+      if (strcmp(path,cur->tex->name)==0)
+         return;
+   for (pf=tex_prefetch; pf!=NULL; pf=pf->next)
+      if (strcmp(path,pf->path)==0)
+         return;
+
+   /* Read the file now, ndata is not safe to use from other threads. */
+   pf = calloc( 1, sizeof(glTexPrefetch) );
+   pf->data = ndata_read( path, &pf->size );
+   if (pf->data == NULL) {
+      free( pf );
+      return;
+   }
+   pf->path  = strdup( path );
+   pf->flags = flags;
+   pf->pot   = gl_needPOT();
+
+   /* Queue decoding. */
+   pf->next     = tex_prefetch;
+   tex_prefetch = pf;
+   threadpool_newJob( gl_prefetchThread, pf );
+}
+
+
+/**
+ * @brief Creates a texture from a prefetched image.
+ *
+ *    @param path Image to load.
+ *    @param flags Flags to load the image with.
+ *    @return The texture or NULL if it was not prefetched.
+ */
+static glTexture* gl_prefetchLoad( const char* path, const unsigned int flags )
+{
+   glTexPrefetch *pf, **prev;
+   glTexture *t;
+
+   for (prev=&tex_prefetch; *prev!=NULL; prev=&(*prev)->next)
+      if (strcmp(path,(*prev)->path)==0)
+         break;
+   pf = *prev;
+   if (pf == NULL)
+      return NULL;
+
+   /* Remove from list once decoded. */
+   gl_prefetchWait( pf );
+   *prev = pf->next;
+
+   /* Must match what gl_loadNewImage would do. */
+   if ((pf->surface == NULL) || (pf->flags != flags) ||
+         (pf->pot != gl_needPOT())) {
+      gl_prefetchFree( pf );
+      return NULL;
+   }
+
+   t = gl_loadImagePad( path, pf->surface, flags, pf->w, pf->h, pf->sx, pf->sy, 1 );
+   pf->surface = NULL;
+   gl_prefetchFree( pf );
+   return t;
+}
+
+
+/**
+ * @brief Drops all the prefetched images that were not used.
+ */
+void gl_prefetchClear (void)
+{
+   glTexPrefetch *pf;
+
+   while (tex_prefetch != NULL) {
+      pf           = tex_prefetch;
+      tex_prefetch = pf->next;
+      gl_prefetchWait( pf );
+      gl_prefetchFree( pf );
+   }
+}
+
+
 /**
  * @brief Only loads the image, does not add to stack unlike gl_newImage.
  *
@@ -894,6 +1374,10 @@ int gl_initTextures (void)
    if (gl_hasVersion(2,0) || gl_hasExt("GL_ARB_texture_non_power_of_two"))
       gl_tex_ext_npot = 1;
 
+   /* Prefetching. */
+   tex_prefetchLock = SDL_CreateMutex();
+   tex_prefetchCond = SDL_CreateCond();
+
    return 0;
 }
 
@@ -905,6 +1389,16 @@ void gl_exitTextures (void)
 {
    glTexList *tex;
 
+   /* Close the collision cache. */
+   gl_transFree();
+
+   /* Stop prefetching. */
+   gl_prefetchClear();
+   SDL_DestroyCond( tex_prefetchCond );
+   SDL_DestroyMutex( tex_prefetchLock );
+   tex_prefetchCond = NULL;
+   tex_prefetchLock = NULL;
+
    /* Make sure there's no texture leak */
    if (texture_list != NULL) {
       DEBUG("Texture leak detected!");
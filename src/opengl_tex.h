@@ -96,6 +96,12 @@ glTexture* gl_newSprite( const char* path, const int sx, const int sy,
       const unsigned int flags );
 glTexture* gl_dupTexture( glTexture *texture );
 
+/*
+ * Prefetching.
+ */
+void gl_prefetchImage( const char* path, const unsigned int flags );
+void gl_prefetchClear (void);
+
 /*
  * Clean up.
  */
@@ -49,6 +49,7 @@
  * the stack
  */
 static Outfit* outfit_stack = NULL; /**< Stack of outfits. */
+static xmlDocPtr* outfit_mapDocs = NULL; /**< Parsed maps waiting for outfit_mapParse. */
 
 
 /*
@@ -61,6 +62,7 @@ static void outfit_launcherDesc( Outfit* o );
 static int outfit_compareNames( const void *name1, const void *name2 );
 /* parsing */
 static int outfit_loadDir( char *dir );
+static void outfit_mapDocsFree (void);
 static int outfit_parseDamage( Damage *dmg, xmlNodePtr node );
 static int outfit_parse( Outfit* temp, const char* file );
 static void outfit_parseSBolt( Outfit* temp, const xmlNodePtr parent );
@@ -2041,10 +2043,7 @@ static int outfit_parse( Outfit* temp, const char* file )
    char *prop;
    const char *cprop;
    int group;
-   uint32_t bufsize;
-   char *buf = ndata_read( file, &bufsize );
-
-   xmlDocPtr doc = xmlParseMemory( buf, bufsize );
+   xmlDocPtr doc = xml_parseNdata( file );
 
    parent = doc->xmlChildrenNode; /* first system node */
    if (parent == NULL) {
@@ -2191,8 +2190,14 @@ if (o) WARN("Outfit '%s' missing/invalid '"s"' element", temp->name) /**< Define
    MELEMENT(temp->description==NULL,"description");
 #undef MELEMENT
 
-   xmlFreeDoc(doc);
-   free(buf);
+   /* Maps need the systems loaded, keep them for outfit_mapParse. */
+   if (outfit_isMap(temp)) {
+      if (outfit_mapDocs == NULL)
+         outfit_mapDocs = array_create( xmlDocPtr );
+      array_push_back( &outfit_mapDocs, doc );
+   }
+   else
+      xmlFreeDoc(doc);
 
    return 0;
 }
@@ -2305,46 +2310,26 @@ static int outfit_compareNames( const void *name1, const void *name2 )
 /**
  * @brief Parses all the maps.
  *
+ * Uses the documents kept from outfit_load instead of reading them again.
  */
 int outfit_mapParse (void)
 {
-   int i, len;
+   int i;
    Outfit *o;
-   uint32_t bufsize, nfiles;
-   char *buf;
    xmlNodePtr node, cur;
-   xmlDocPtr doc;
-   char **map_files;
-   char *file, *n;
+   char *n;
 
-   map_files = ndata_list( MAP_DATA_PATH, &nfiles );
-   for (i=0; i<(int)nfiles; i++) {
-
-      len  = strlen(MAP_DATA_PATH)+strlen(map_files[i])+2;
-      file = malloc( len );
-      nsnprintf( file, len, "%s%s", MAP_DATA_PATH, map_files[i] );
-
-      buf = ndata_read( file, &bufsize );
-      doc = xmlParseMemory( buf, bufsize );
+   if (outfit_mapDocs == NULL)
+      return 0;
 
-      node = doc->xmlChildrenNode; /* first system node */
-      if (node == NULL) {
-         WARN("Malformed '"OUTFIT_DATA_PATH"' file: does not contain elements");
-         free(file);
-         xmlFreeDoc(doc);
-         free(buf);
-         return -1;
-      }
+   for (i=0; i<array_size(outfit_mapDocs); i++) {
+      node = outfit_mapDocs[i]->xmlChildrenNode; /* first system node */
 
       n = xml_nodeProp( node,"name" );
       o = outfit_get( n );
       free(n);
-      if (!outfit_isMap(o)) { /* If its not a map, we don't care. */
-         free(file);
-         xmlFreeDoc(doc);
-         free(buf);
+      if (!outfit_isMap(o)) /* If its not a map, we don't care. */
          continue;
-      }
 
       cur = node->xmlChildrenNode;
       do { /* load all the data */
@@ -2355,22 +2340,32 @@ int outfit_mapParse (void)
             outfit_parseSMap(o, cur);
 
       } while (xml_nextNode(cur));
-
-      /* Clean up. */
-      free(file);
-      xmlFreeDoc(doc);
-      free(buf);
    }
 
    /* Clean up. */
-   for (i=0; i<(int)nfiles; i++)
-      free( map_files[i] );
-   free( map_files );
+   outfit_mapDocsFree();
 
    return 0;
 }
 
 
+/**
+ * @brief Frees the map documents kept for outfit_mapParse.
+ */
+static void outfit_mapDocsFree (void)
+{
+   int i;
+
+   if (outfit_mapDocs == NULL)
+      return;
+
+   for (i=0; i<array_size(outfit_mapDocs); i++)
+      xmlFreeDoc( outfit_mapDocs[i] );
+   array_free( outfit_mapDocs );
+   outfit_mapDocs = NULL;
+}
+
+
 /**
  * @brief Generates short descs for launchers, including ammo info.
  *
@@ -2461,5 +2456,8 @@ void outfit_free (void)
    }
 
    array_free(outfit_stack);
+
+   /* In case outfit_mapParse never ran. */
+   outfit_mapDocsFree();
 }
 
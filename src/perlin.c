@@ -38,6 +38,12 @@
  * @note Tried to optimize a while back with SSE and the works, but because
  *       of the nature of how it's implemented in non-linear fashion it just
  *       wound up complicating the code without actually making it faster.
+ *
+ * The nebula generator works on bands of rows in parallel. All the pixels of
+ *  a row share the y and z lattice coordinates so the hashed gradients are
+ *  computed once per cell, and 4 pixels are then evaluated at once. The
+ *  operations are the same as the scalar path in the same order, so the
+ *  output is bit identical on targets using SSE for floats.
  */
 
 
@@ -53,6 +59,10 @@
 #include "SDL_thread.h"
 #include "threadpool.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif /* defined(__SSE2__) */
+
 #include "log.h"
 #include "rng.h"
 #include "nfile.h"
@@ -60,6 +70,8 @@
 
 #define SIMPLEX_SCALE 0.5f
 
+#define NEBULA_TILE_ROWS   16 /**< Rows of nebula generated per job. */
+
 
 /**
  * @brief Linearly Interpolates x between a and b.
@@ -81,11 +93,25 @@ struct perlin_data_s {
 };
 
 
+/**
+ * @brief Lattice of a row of 3D noise.
+ */
+typedef struct noise_row_s {
+   int octaves; /**< Octaves prepared. */
+   float wy[NOISE_MAX_OCTAVES]; /**< Y interpolation weight per octave. */
+   float wz[NOISE_MAX_OCTAVES]; /**< Z interpolation weight per octave. */
+   float *cells[NOISE_MAX_OCTAVES]; /**< Corner gradients per cell and octave. */
+   int mcells[NOISE_MAX_OCTAVES]; /**< Cells allocated per octave. */
+} noise_row_t;
+
+
 /**
  * @brief Threading stuff.
  */
 typedef struct thread_args_ {
    int z; /**< Z level working on. */
+   int y0; /**< First row to generate. */
+   int y1; /**< Row after the last row to generate. */
    float zoom; /**< Zoom level of detail. */
    int n; /**< Number of layers to generate. */
    int h; /**< Height. */
@@ -108,6 +134,12 @@ static float lattice3( perlin_data_t *pdata, int ix, float fx,
       int iy, float fy, int iz, float fz );
 static float lattice2( perlin_data_t *pdata, int ix, float fx, int iy, float fy );
 static float lattice1( perlin_data_t *pdata, int ix, float fx );
+/* Rows. */
+static void noise_rowPrepare( perlin_data_t* pdata, noise_row_t *row,
+      float fxmax, float fy, float fz, int octaves );
+static void noise_rowFree( noise_row_t *row );
+static void noise_turbulence3x4( perlin_data_t* pdata, const noise_row_t *row,
+      const float fx[4], float out[4] );
 /*Threading */
 static int noise_genNebulaMap_thread( void *data );
 
@@ -584,6 +616,198 @@ float* noise_genRadarInt( const int w, const int h, float rug )
 }
 
 
+/*
+ * 4 wide float vectors for noise_turbulence3x4.
+ */
+#if defined(__SSE2__)
+typedef __m128 nvec; /**< 4 floats. */
+#define NV_SET1(a)      _mm_set1_ps(a) /**< Broadcasts a float. */
+#define NV_LOAD(p)      _mm_loadu_ps(p) /**< Loads 4 floats. */
+#define NV_STORE(p,a)   _mm_storeu_ps(p,a) /**< Stores 4 floats. */
+#define NV_ADD(a,b)     _mm_add_ps(a,b) /**< Adds. */
+#define NV_SUB(a,b)     _mm_sub_ps(a,b) /**< Subtracts. */
+#define NV_MUL(a,b)     _mm_mul_ps(a,b) /**< Multiplies. */
+#define NV_ABS(a)       _mm_andnot_ps(_mm_set1_ps(-0.f),a) /**< Absolute value. */
+#define NV_CLAMP(a,b,x) _mm_min_ps(_mm_max_ps(x,_mm_set1_ps(a)),_mm_set1_ps(b)) /**< Same as CLAMP. */
+#else /* defined(__SSE2__) */
+typedef struct nvec_ { float v[4]; } nvec; /**< 4 floats. */
+static nvec nv_set1( float a ) { nvec r; r.v[0]=r.v[1]=r.v[2]=r.v[3]=a; return r; }
+static nvec nv_load( const float *p ) { nvec r; memcpy(r.v,p,sizeof(r.v)); return r; }
+#define NV_OP(name,expr) \
+static nvec name( nvec a, nvec b ) { nvec r; int l; (void)b; \
+   for (l=0; l<4; l++) r.v[l] = expr; return r; }
+NV_OP( nv_add, a.v[l] + b.v[l] )
+NV_OP( nv_sub, a.v[l] - b.v[l] )
+NV_OP( nv_mul, a.v[l] * b.v[l] )
+NV_OP( nv_abs, ABS(a.v[l]) )
+NV_OP( nv_clamp, CLAMP(-0.99999f, 0.99999f, a.v[l]) )
+#undef NV_OP
+#define NV_SET1(a)      nv_set1(a)
+#define NV_LOAD(p)      nv_load(p)
+#define NV_STORE(p,a)   memcpy(p,(a).v,sizeof((a).v))
+#define NV_ADD(a,b)     nv_add(a,b)
+#define NV_SUB(a,b)     nv_sub(a,b)
+#define NV_MUL(a,b)     nv_mul(a,b)
+#define NV_ABS(a)       nv_abs(a,a)
+#define NV_CLAMP(a,b,x) nv_clamp(x,x)
+#endif /* defined(__SSE2__) */
+#define NV_LERP(a,b,x)  NV_ADD(a, NV_MUL(x, NV_SUB(b,a))) /**< Same as LERP. */
+#define NV_CUBIC(a)     NV_MUL(NV_MUL(a,a), NV_SUB(NV_SET1(3.f), NV_MUL(NV_SET1(2.f),a))) /**< Same as CUBIC. */
+
+
+/**
+ * @brief Prepares the lattice of a row for noise_turbulence3x4.
+ *
+ * A row has the same y and z coordinates for all the pixels, so the lattice
+ *  hashes and the y and z terms of the gradients are computed once per cell
+ *  instead of once per pixel.
+ *
+ *    @param pdata Perlin data to generate noise from.
+ *    @param row Row to prepare, buffers are reused between rows.
+ *    @param fxmax Largest X coordinate that will be queried.
+ *    @param fy Y coordinate of the row.
+ *    @param fz Z coordinate of the row.
+ *    @param octaves Octaves to use.
+ */
+static void noise_rowPrepare( perlin_data_t* pdata, noise_row_t *row,
+      float fxmax, float fy, float fz, int octaves )
+{
+   int i, k, c, j, ncells, ny, nz, hy, hz;
+   float tx, ty, tz, ry, rz, cy, cz, *cell;
+
+   row->octaves = octaves;
+   tx = fxmax;
+   ty = fy;
+   tz = fz;
+   for (i=0; i<octaves; i++) {
+      /* Same operations as noise_get3. */
+      ny = (int)ty;
+      nz = (int)tz;
+      ry = ty - ny;
+      rz = tz - nz;
+      row->wy[i] = CUBIC(ry);
+      row->wz[i] = CUBIC(rz);
+
+      /* Allocate the cells. */
+      ncells = (int)tx + 1;
+      if (ncells > row->mcells[i]) {
+         row->mcells[i] = ncells;
+         row->cells[i]  = realloc( row->cells[i], sizeof(float) * 24 * ncells );
+      }
+
+      /* Gradients of the corners in the same order as noise_get3. */
+      for (k=0; k<ncells; k++) {
+         cell = &row->cells[i][ 24*k ];
+         for (c=0; c<8; c++) {
+            hy = ny + ((c>>1) & 1);
+            hz = nz + ((c>>2) & 1);
+            cy = (c & 2) ? ry-1 : ry;
+            cz = (c & 4) ? rz-1 : rz;
+            j  = pdata->map[ (k + (c & 1)) & 0xFF ];
+            j  = pdata->map[ (j + hy) & 0xFF ];
+            j  = pdata->map[ (j + hz) & 0xFF ];
+            cell[c]    = pdata->buffer[j][0];
+            cell[8+c]  = pdata->buffer[j][1] * cy;
+            cell[16+c] = pdata->buffer[j][2] * cz;
+         }
+      }
+
+      tx *= pdata->lacunarity;
+      ty *= pdata->lacunarity;
+      tz *= pdata->lacunarity;
+   }
+}
+
+
+/**
+ * @brief Frees the buffers of a row.
+ *
+ *    @param row Row to free.
+ */
+static void noise_rowFree( noise_row_t *row )
+{
+   int i;
+   for (i=0; i<NOISE_MAX_OCTAVES; i++)
+      free( row->cells[i] );
+}
+
+
+/**
+ * @brief Gets 3d Turbulence noise for 4 positions of a row.
+ *
+ * Gives the same results as noise_turbulence3 for each position.
+ *
+ *    @param pdata Perlin data to generate noise from.
+ *    @param row Row prepared with noise_rowPrepare.
+ *    @param fx X coordinate of each position.
+ *    @param[out] out The noise level at each position.
+ */
+static void noise_turbulence3x4( perlin_data_t* pdata, const noise_row_t *row,
+      const float fx[4], float out[4] )
+{
+   nvec tx, rx, rx1, wx, value, noise, v[8];
+   float g[3][4];
+   const float *cell[4];
+   int nx[4], i, c, l;
+
+   tx    = NV_LOAD( fx );
+   value = NV_SET1( 0.f );
+
+   /* Inner loop of spectral construction, where the fractal is built */
+   for (i=0; i<row->octaves; i++) {
+      /* Lattice cell, same as in noise_get3. */
+#if defined(__SSE2__)
+      {
+         __m128i n = _mm_cvttps_epi32( tx );
+         _mm_storeu_si128( (__m128i*)nx, n );
+         rx = _mm_sub_ps( tx, _mm_cvtepi32_ps( n ) );
+      }
+#else /* defined(__SSE2__) */
+      for (l=0; l<4; l++) {
+         nx[l]   = (int)tx.v[l];
+         rx.v[l] = tx.v[l] - nx[l];
+      }
+#endif /* defined(__SSE2__) */
+      rx1 = NV_SUB( rx, NV_SET1(1.f) );
+      wx  = NV_CUBIC( rx );
+
+      /* Neighbouring pixels are almost always in the same cell. */
+      if ((nx[0] == nx[3]) && (nx[1] == nx[3]) && (nx[2] == nx[3])) {
+         cell[0] = &row->cells[i][ 24*nx[0] ];
+         for (c=0; c<8; c++)
+            v[c] = NV_ADD( NV_ADD(
+                     NV_MUL( NV_SET1(cell[0][c]), (c & 1) ? rx1 : rx ),
+                     NV_SET1(cell[0][8+c]) ), NV_SET1(cell[0][16+c]) );
+      }
+      else {
+         for (l=0; l<4; l++)
+            cell[l] = &row->cells[i][ 24*nx[l] ];
+         for (c=0; c<8; c++) {
+            for (l=0; l<4; l++) {
+               g[0][l] = cell[l][c];
+               g[1][l] = cell[l][8+c];
+               g[2][l] = cell[l][16+c];
+            }
+            v[c] = NV_ADD( NV_ADD(
+                     NV_MUL( NV_LOAD(g[0]), (c & 1) ? rx1 : rx ),
+                     NV_LOAD(g[1]) ), NV_LOAD(g[2]) );
+         }
+      }
+
+      noise = NV_LERP(
+            NV_LERP( NV_LERP(v[0], v[1], wx), NV_LERP(v[2], v[3], wx), NV_SET1(row->wy[i]) ),
+            NV_LERP( NV_LERP(v[4], v[5], wx), NV_LERP(v[6], v[7], wx), NV_SET1(row->wy[i]) ),
+            NV_SET1(row->wz[i]) );
+      noise = NV_CLAMP( -0.99999f, 0.99999f, noise );
+      value = NV_ADD( value, NV_MUL( NV_ABS( noise ), NV_SET1( pdata->exponent[i] ) ) );
+
+      tx  = NV_MUL( tx, NV_SET1( pdata->lacunarity ) );
+   }
+
+   NV_STORE( out, NV_CLAMP( -0.99999f, 0.99999f, value ) );
+}
+
+
 /**
  * @brief Thread worker for generating nebula stuff.
  *
@@ -592,33 +816,54 @@ float* noise_genRadarInt( const int w, const int h, float rug )
 static int noise_genNebulaMap_thread( void *data )
 {
    thread_args *args = (thread_args*) data;
-   float f[3];
+   float f[3], fx[4], v[4];
    float value;
-   int y, x;
-   float max;
+   int y, x, l;
+   float max, *row;
+   noise_row_t lattice;
 
-   /* Generate the layer. */
+   /* Generate the rows of the layer. */
    max = 0;
+   memset( &lattice, 0, sizeof(lattice) );
    f[2] = args->zoom * (float)args->z / (float)args->n;
 
-   for (y=0; y<args->h; y++) {
+   for (y=args->y0; y<args->y1; y++) {
       f[1] = args->zoom * (float)y / (float)args->h;
+      row  = &args->nebula[args->z * args->w * args->h + y * args->w];
+      noise_rowPrepare( args->noise, &lattice,
+            args->zoom * (float)(args->w-1) / (float)args->w,
+            f[1], f[2], args->octaves );
+
+      /* Four pixels at a time. */
+      for (x=0; x+4<=args->w; x+=4) {
+         for (l=0; l<4; l++)
+            fx[l] = args->zoom * (float)(x+l) / (float)args->w;
+
+         noise_turbulence3x4( args->noise, &lattice, fx, v );
+         for (l=0; l<4; l++) {
+            if (max < v[l])
+               max = v[l];
+            row[x+l] = v[l];
+         }
+      }
 
-      for (x=0; x<args->w; x++) {
+      /* Remaining pixels. */
+      for ( ; x<args->w; x++) {
          f[0] = args->zoom * (float)x / (float)args->w;
 
          value = noise_turbulence3( args->noise, f, args->octaves );
          if (max < value)
             max = value;
 
-         args->nebula[args->z * args->w * args->h + y * args->w + x] = value;
-       }
+         row[x] = value;
+      }
    }
 
    /* Set up output. */
    *args->max = max;
 
    /* Clean up. */
+   noise_rowFree( &lattice );
    free( args );
    return 0;
 }
@@ -635,7 +880,7 @@ static int noise_genNebulaMap_thread( void *data )
  */
 float* noise_genNebulaMap( const int w, const int h, const int n, float rug )
 {
-   int x, y, z, i;
+   int x, y, z, i, t, ntiles;
    int octaves;
    float hurst;
    float lacunarity;
@@ -668,34 +913,39 @@ float* noise_genNebulaMap( const int w, const int h, const int n, float rug )
    s = SDL_GetTicks();
    DEBUG("Generating Nebula of size %dx%dx%d", w, h, n);
 
-   /* Prepare for generation. */
-   _max        = malloc( sizeof(float) * n );
+   /* Prepare for generation, layers are split in bands of rows. */
+   ntiles      = (h + NEBULA_TILE_ROWS - 1) / NEBULA_TILE_ROWS;
+   _max        = malloc( sizeof(float) * n * ntiles );
 
    /* Initialize vpool */
    vpool = vpool_create();
 
    /* Start to create the nebula */
    for (z=0; z<n; z++) {
-      /* Make ze arguments! */
-      args     = malloc( sizeof(thread_args) );
-      args->z  = z;
-      args->zoom = zoom;
-      args->n  = n;
-      args->h  = h;
-      args->w  = w;
-      args->noise = noise;
-      args->octaves = octaves;
-      args->max = &_max[z];
-      args->nebula = nebula;
-
-      /* Launch ze thread. */
-      vpool_enqueue( vpool, noise_genNebulaMap_thread, args );
+      for (t=0; t<ntiles; t++) {
+         /* Make ze arguments! */
+         args     = malloc( sizeof(thread_args) );
+         args->z  = z;
+         args->y0 = t * NEBULA_TILE_ROWS;
+         args->y1 = MIN( h, (t+1) * NEBULA_TILE_ROWS );
+         args->zoom = zoom;
+         args->n  = n;
+         args->h  = h;
+         args->w  = w;
+         args->noise = noise;
+         args->octaves = octaves;
+         args->max = &_max[z*ntiles + t];
+         args->nebula = nebula;
+
+         /* Launch ze thread. */
+         vpool_enqueue( vpool, noise_genNebulaMap_thread, args );
+      }
    }
 
    /* Wait for threads to signal completion. */
    vpool_wait( vpool );
    max = 0.;
-   for (i=0; i<n; i++) {
+   for (i=0; i<n*ntiles; i++) {
       if (_max[i]>max)
          max = _max[i];
    }
@@ -409,6 +409,66 @@ static void solid_update_rk4 (Solid *obj, const double dt)
 }
 
 
+/**
+ * @brief Updates many solids at once.
+ *
+ * Euler solids are stepped in place without going through their update
+ *  method, and the trigonometry is skipped for the ones without thrust
+ *  (most bolts). Results match solid_update_euler. Other solids just use
+ *  their update method.
+ *
+ *    @param solids Solids to update.
+ *    @param n Number of solids to update.
+ *    @param dt Current delta tick.
+ */
+void solid_updateBatch( Solid **solids, int n, const double dt )
+{
+   int i;
+   Solid *obj;
+   double px,py, vx,vy, ax,ay, th;
+
+   for (i=0; i<n; i++) {
+      obj = solids[i];
+      if (obj->update != solid_update_euler) {
+         obj->update( obj, dt );
+         continue;
+      }
+
+      /* make sure angle doesn't flip */
+      obj->dir += obj->dir_vel*dt;
+      if (obj->dir >= 2*M_PI)
+         obj->dir -= 2*M_PI;
+      if (obj->dir < 0.)
+         obj->dir += 2*M_PI;
+
+      /* Initial positions. */
+      px = obj->pos.x;
+      py = obj->pos.y;
+      vx = obj->vel.x;
+      vy = obj->vel.y;
+      th = obj->thrust;
+
+      /* Get acceleration, no thrust means no acceleration. */
+      if (th != 0.) {
+         ax = th*cos(obj->dir) / obj->mass;
+         ay = th*sin(obj->dir) / obj->mass;
+      }
+      else {
+         ax = 0.;
+         ay = 0.;
+      }
+
+      /* p = v*dt + 0.5*a*dt^2 */
+      px += vx*dt + 0.5*ax * dt*dt;
+      py += vy*dt + 0.5*ay * dt*dt;
+
+      /* Update position and velocity. */
+      vect_cset( &obj->vel, vx, vy );
+      vect_cset( &obj->pos, px, py );
+   }
+}
+
+
 /**
  * @brief Gets the maximum speed of any object with speed and thrust.
  */
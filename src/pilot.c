@@ -45,11 +45,15 @@
 #include "camera.h"
 #include "damagetype.h"
 #include "pause.h"
+#include "spatial.h"
+#include "space.h"
 
 
 #define PILOT_CHUNK_MIN 128 /**< Minimum chunks to increment pilot_stack by */
 #define PILOT_CHUNK_MAX 2048 /**< Maximum chunks to increment pilot_stack by */
 #define CHUNK_SIZE      32 /**< Size to allocate memory by. */
+#define PILOT_SPATIAL_CELL 512. /**< Cell size of the pilot spatial index. */
+#define PILOT_HANDLES_MIN 256 /**< Minimum size of the pilot handle table. */
 
 /* ID Generators. */
 static unsigned int pilot_id = PLAYER_ID; /**< Stack of pilot ids to assure uniqueness */
@@ -60,6 +64,24 @@ Pilot** pilot_stack = NULL; /**< Not static, used in player.c, weapon.c, pause.c
 int pilot_nstack = 0; /**< same */
 static int pilot_mstack = 0; /**< Memory allocated for pilot_stack. */
 
+/* Spatial index. */
+static SpatialIndex pilot_spatial; /**< Spatial index of the pilot stack. */
+static int pilot_spatialDirty = 1; /**< Spatial index must be rebuilt. */
+
+/**
+ * @brief Slot of the pilot handle table.
+ *
+ * The table is indexed by the low bits of the pilot id, the full id is kept
+ *  to tell apart pilots that land on the same slot.
+ */
+typedef struct PilotHandle_ {
+   unsigned int id; /**< ID of the pilot in the slot, 0 if empty. */
+   Pilot *p; /**< Pilot in the slot. */
+} PilotHandle;
+static PilotHandle *pilot_handles = NULL; /**< Handle table mapping ids to pilots. */
+static int pilot_mhandles = 0; /**< Size of the handle table, power of two. */
+static int pilot_nhandles = 0; /**< Used slots of the handle table. */
+
 
 /* misc */
 static double pilot_commTimeout  = 15.; /**< Time for text above pilot to time out. */
@@ -80,6 +102,10 @@ static int pilot_validEnemy( const Pilot* p, const Pilot* target );
 /* Misc. */
 static void pilot_setCommMsg( Pilot *p, const char *s );
 static int pilot_getStackPos( const unsigned int id );
+/* Handles. */
+static void pilot_handleAdd( Pilot *p );
+static void pilot_handleRemove( const unsigned int id );
+static void pilot_handleClear (void);
 
 
 /**
@@ -505,29 +531,172 @@ double pilot_getNearestAng( const Pilot *p, unsigned int *tp, double ang, int di
 }
 
 
+/**
+ * @brief Adds a pilot to the handle table.
+ *
+ *    @param p Pilot to add.
+ */
+static void pilot_handleAdd( Pilot *p )
+{
+   int i, mask, oldm;
+   PilotHandle *old;
+
+   /* Grow to keep the table at most half full. */
+   if (2*(pilot_nhandles+1) > pilot_mhandles) {
+      old  = pilot_handles;
+      oldm = pilot_mhandles;
+      pilot_mhandles = MAX( PILOT_HANDLES_MIN, 2*pilot_mhandles );
+      pilot_handles  = calloc( pilot_mhandles, sizeof(PilotHandle) );
+      pilot_nhandles = 0;
+      for (i=0; i<oldm; i++)
+         if (old[i].id != 0)
+            pilot_handleAdd( old[i].p );
+      free(old);
+   }
+
+   /* Ids are mostly sequential so the low bits rarely collide. */
+   mask = pilot_mhandles-1;
+   for (i=p->id & mask; pilot_handles[i].id != 0; i=(i+1) & mask);
+   pilot_handles[i].id = p->id;
+   pilot_handles[i].p  = p;
+   pilot_nhandles++;
+}
+
+
+/**
+ * @brief Removes a pilot from the handle table.
+ *
+ *    @param id ID of the pilot to remove.
+ */
+static void pilot_handleRemove( const unsigned int id )
+{
+   int i, j, k, mask;
+
+   if (pilot_mhandles == 0)
+      return;
+   mask = pilot_mhandles-1;
+
+   /* Find the slot. */
+   for (i=id & mask; pilot_handles[i].id != id; i=(i+1) & mask)
+      if (pilot_handles[i].id == 0)
+         return;
+
+   /* Shift back the following slots so probing never hits a hole. */
+   for (j=(i+1) & mask; pilot_handles[j].id != 0; j=(j+1) & mask) {
+      k = pilot_handles[j].id & mask;
+      if (((j > i) && ((k <= i) || (k > j))) ||
+            ((j < i) && ((k <= i) && (k > j)))) {
+         pilot_handles[i] = pilot_handles[j];
+         i = j;
+      }
+   }
+   pilot_handles[i].id = 0;
+   pilot_handles[i].p  = NULL;
+   pilot_nhandles--;
+}
+
+
+/**
+ * @brief Empties the handle table.
+ */
+static void pilot_handleClear (void)
+{
+   if (pilot_handles != NULL)
+      memset( pilot_handles, 0, pilot_mhandles*sizeof(PilotHandle) );
+   pilot_nhandles = 0;
+}
+
+
 /**
  * @brief Pulls a pilot out of the pilot_stack based on ID.
  *
- * It's a binary search ( O(logn) ) therefore it's pretty fast and can be
- *  abused all the time.  Maximum iterations is 32 on a platform with 32 bit
- *  unsigned ints.
+ * It's a lookup in a handle table ( O(1) ) therefore it's fast and can be
+ *  abused all the time.
  *
  *    @param id ID of the pilot to get.
  *    @return The actual pilot who has matching ID or NULL if not found.
  */
 Pilot* pilot_get( const unsigned int id )
 {
-   int m;
+   int i, mask;
+   Pilot *p;
 
    if (id==PLAYER_ID)
       return player.p; /* special case player.p */
 
-   m = pilot_getStackPos(id);
+   if ((id == 0) || (pilot_mhandles == 0))
+      return NULL;
+
+   mask = pilot_mhandles-1;
+   for (i=id & mask; pilot_handles[i].id != id; i=(i+1) & mask)
+      if (pilot_handles[i].id == 0)
+         return NULL;
 
-   if ((m==-1) || (pilot_isFlag(pilot_stack[m], PILOT_DELETE)))
+   p = pilot_handles[i].p;
+   if (pilot_isFlag(p, PILOT_DELETE))
       return NULL;
-   else
-      return pilot_stack[m];
+   return p;
+}
+
+
+/**
+ * @brief Marks the pilot spatial index as out of date.
+ *
+ * Must be called whenever pilots are moved outside of the normal update.
+ */
+void pilot_spatialInvalidate (void)
+{
+   pilot_spatialDirty = 1;
+}
+
+
+/**
+ * @brief Gets all the pilots that are in or touch a circle.
+ *
+ * Pilots are considered to be circles with the width of their ship sprite
+ *  as radius. Results are in pilot stack order, so they match looping over
+ *  the stack. The spatial index backing this gets rebuilt lazily once per
+ *  update or whenever the stack changes.
+ *
+ *    @param x X position of the center of the circle.
+ *    @param y Y position of the center of the circle.
+ *    @param r Radius of the circle.
+ *    @param[in,out] pilots Buffer to fill with the pilots found, grown with
+ *           realloc as needed and owned by the caller. Hooks can run queries
+ *           of their own so it must not be shared between callers.
+ *    @param[in,out] mpilots Memory allocated for the buffer.
+ *    @return Number of pilots found.
+ */
+int pilot_getInRadius( double x, double y, double r, Pilot ***pilots, int *mpilots )
+{
+   int i, n;
+   const int *ids;
+   Pilot *p;
+
+   /* Rebuild index if needed. */
+   if (pilot_spatialDirty) {
+      if (pilot_spatial.cell <= 0.)
+         spatial_init( &pilot_spatial, PILOT_SPATIAL_CELL );
+      spatial_clear( &pilot_spatial );
+      for (i=0; i<pilot_nstack; i++) {
+         p = pilot_stack[i];
+         spatial_add( &pilot_spatial, i, p->solid->pos.x, p->solid->pos.y,
+               p->ship->gfx_space->sw );
+      }
+      spatial_build( &pilot_spatial );
+      pilot_spatialDirty = 0;
+   }
+
+   /* Query. */
+   n = spatial_query( &pilot_spatial, x, y, r, &ids );
+   if (n > *mpilots) {
+      *mpilots = MAX( n, 2*(*mpilots) );
+      *pilots  = realloc( *pilots, *mpilots * sizeof(Pilot*) );
+   }
+   for (i=0; i<n; i++)
+      (*pilots)[i] = pilot_stack[ ids[i] ];
+
+   return n;
 }
 
 
@@ -1468,18 +1637,23 @@ static void pilot_dead( Pilot* p, unsigned int killer )
  */
 void pilot_explode( double x, double y, double radius, const Damage *dmg, const Pilot *parent )
 {
-   int i;
+   int i, n, mpilots;
    double rx, ry;
    double dist, rad2;
-   Pilot *p;
+   Pilot *p, **pilots;
    Solid s; /* Only need to manipulate mass and vel. */
    Damage ddmg;
 
    rad2 = radius*radius;
    memcpy( &ddmg, dmg, sizeof(Damage) );
 
-   for (i=0; i<pilot_nstack; i++) {
-      p = pilot_stack[i];
+   /* Only pilots that can be reached by the explosion.
+    * Hooks run by pilot_hit can explode or query too, so use our own buffer. */
+   pilots  = NULL;
+   mpilots = 0;
+   n = pilot_getInRadius( x, y, radius, &pilots, &mpilots );
+   for (i=0; i<n; i++) {
+      p = pilots[i];
 
       /* Calculate a bit. */
       rx = p->solid->pos.x - x;
@@ -1508,6 +1682,8 @@ void pilot_explode( double x, double y, double radius, const Damage *dmg, const
             spfx_shake( pow2(ddmg.damage) / pow2(100.) * SHAKE_MAX );
       }
    }
+
+   free(pilots);
 }
 
 
@@ -2315,6 +2491,12 @@ void pilot_init( Pilot* pilot, Ship* ship, const char* name, int faction, const
    else
       pilot->id = ++pilot_id; /* new unique pilot id based on pilot_id, can't be 0 */
 
+   /* Register the handle right away, the AI create function uses pilot_get.
+    * The player is special cased by pilot_get and empty pilots aren't on the
+    * stack. */
+   if ((pilot->id != PLAYER_ID) && !pilot_isFlagRaw( flags, PILOT_EMPTY ))
+      pilot_handleAdd( pilot );
+
    /* Defaults. */
    pilot->autoweap = 1;
 
@@ -2485,6 +2667,7 @@ unsigned int pilot_create( Ship* ship, const char* name, int faction, const char
    /* Set the pilot in the stack -- must be there before initializing */
    pilot_stack[pilot_nstack] = dyn;
    pilot_nstack++; /* there's a new pilot */
+   pilot_spatialDirty = 1;
 
    /* Initialize the pilot. */
    pilot_init( dyn, ship, name, faction, ai, dir, pos, vel, flags, systemFleet );
@@ -2681,8 +2864,10 @@ void pilot_destroy(Pilot* p)
    }
 
    /* pilot is eliminated */
+   pilot_handleRemove( p->id );
    pilot_free(p);
    pilot_nstack--;
+   pilot_spatialDirty = 1;
 
    /* copy other pilots down */
    memmove(&pilot_stack[i], &pilot_stack[i+1], (pilot_nstack-i)*sizeof(Pilot*));
@@ -2705,6 +2890,16 @@ void pilots_free (void)
    pilot_stack = NULL;
    player.p = NULL;
    pilot_nstack = 0;
+
+   /* Free handle table. */
+   free(pilot_handles);
+   pilot_handles  = NULL;
+   pilot_mhandles = 0;
+   pilot_nhandles = 0;
+
+   /* Free spatial index. */
+   spatial_free( &pilot_spatial );
+   pilot_spatialDirty = 1;
 }
 
 
@@ -2730,6 +2925,8 @@ void pilots_clean (void)
    }
    else
       pilot_nstack = 0;
+   pilot_handleClear();
+   pilot_spatialDirty = 1;
 
    /* Clear global hooks. */
    pilots_clearGlobalHooks();
@@ -2759,6 +2956,7 @@ void pilots_cleanAll (void)
       player.p = NULL;
    }
    pilot_nstack = 0;
+   pilot_spatialDirty = 1;
 }
 
 
@@ -2769,9 +2967,14 @@ void pilots_cleanAll (void)
  */
 void pilots_update( double dt )
 {
-   int i;
+   static unsigned int tick = 0;
+   int i, nthink;
    Pilot *p;
 
+   /* Thinking is spread out over several ticks when simulating the system. */
+   tick++;
+   nthink = space_isSimulating() ? SYSTEM_SIMULATE_THINK : 1;
+
    /* Now update all the pilots. */
    for (i=0; i<pilot_nstack; i++) {
       p = pilot_stack[i];
@@ -2808,7 +3011,9 @@ void pilots_update( double dt )
             !pilot_isFlag(p, PILOT_REFUELBOARDING) &&
             /* Must not be landing nor taking off. */
             !pilot_isFlag(p, PILOT_LANDING) &&
-            !pilot_isFlag(p, PILOT_TAKEOFF))
+            !pilot_isFlag(p, PILOT_TAKEOFF) &&
+            /* Must be its turn to think. */
+            ((tick + p->id) % nthink == 0))
          p->think(p, dt);
    }
 
@@ -2824,9 +3029,11 @@ void pilots_update( double dt )
       if (pilot_isFlag(p, PILOT_INVISIBLE))
          continue;
 
-      /* Just update the pilot. */
-      if (p->update) /* update */
+      /* Just update the pilot, explosions in later updates must see it moved. */
+      if (p->update) { /* update */
          p->update( p, dt );
+         pilot_spatialDirty = 1;
+      }
    }
 }
 
@@ -2839,6 +3046,7 @@ void pilots_update( double dt )
 void pilots_render( double dt )
 {
    int i;
+   gl_batchBegin();
    for (i=0; i<pilot_nstack; i++) {
 
       /* Invisible, not doing anything. */
@@ -2848,6 +3056,7 @@ void pilots_render( double dt )
       if (pilot_stack[i]->render != NULL) /* render */
          pilot_stack[i]->render(pilot_stack[i], dt);
    }
+   gl_batchEnd();
 }
 
 
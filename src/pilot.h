@@ -128,6 +128,10 @@ enum {
 };
 typedef char PilotFlags[ PILOT_FLAGS_MAX ];
 
+/* pending recalculations of an outfit batch, kept in outfit_dirty */
+#define PILOT_BATCH_STATS        (1<<0) /**< Stats must be recalculated. */
+#define PILOT_BATCH_WEAPONS      (1<<1) /**< Weapon sets must be recalculated if automatic. */
+
 /* makes life easier */
 #define pilot_isPlayer(p)   pilot_isFlag(p,PILOT_PLAYER) /**< Checks if pilot is a player. */
 #define pilot_isDisabled(p) pilot_isFlag(p,PILOT_DISABLED) /**< Checks if pilot is disabled. */
@@ -374,6 +378,10 @@ typedef struct Pilot_ {
    int active_set;   /**< Index of the currently active weapon set. */
    int autoweap;     /**< Automatically update weapon sets. */
 
+   /* Outfit edits. */
+   int outfit_batch; /**< Depth of outfit edit batches, see pilot_outfitBatchBegin. */
+   int outfit_dirty; /**< Recalculations pending until the batch is committed. */
+
    /* Cargo */
    credits_t credits; /**< monies the pilot has */
    PilotCommodity* commodities; /**< commodity and quantity */
@@ -434,6 +442,8 @@ typedef struct Pilot_ {
  */
 Pilot** pilot_getAll( int *n );
 Pilot* pilot_get( const unsigned int id );
+int pilot_getInRadius( double x, double y, double r, Pilot ***pilots, int *mpilots );
+void pilot_spatialInvalidate (void);
 unsigned int pilot_getNextID( const unsigned int id, int mode );
 unsigned int pilot_getPrevID( const unsigned int id, int mode );
 unsigned int pilot_getNearestEnemy( const Pilot* p );
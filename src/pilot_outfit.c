@@ -397,7 +397,7 @@ int pilot_addOutfit( Pilot* pilot, Outfit* outfit, PilotOutfitSlot *s )
    ret = pilot_addOutfitRaw( pilot, outfit, s );
 
    /* Recalculate the stats */
-   pilot_calcStats(pilot);
+   pilot_outfitChanged( pilot, outfit, 1 );
 
    return ret;
 }
@@ -449,6 +449,7 @@ int pilot_rmOutfit( Pilot* pilot, PilotOutfitSlot *s )
 {
    const char *str;
    int ret;
+   Outfit *o;
 
    str = pilot_canEquip( pilot, s, NULL );
    if (str != NULL) {
@@ -457,10 +458,11 @@ int pilot_rmOutfit( Pilot* pilot, PilotOutfitSlot *s )
       return -1;
    }
 
+   o   = s->outfit;
    ret = pilot_rmOutfitRaw( pilot, s );
 
    /* recalculate the stats */
-   pilot_calcStats(pilot);
+   pilot_outfitChanged( pilot, o, 0 );
 
    return ret;
 }
@@ -1080,6 +1082,112 @@ void pilot_healLanded( Pilot *pilot )
 }
 
 
+/**
+ * @brief Starts a batch of outfit edits.
+ *
+ * Until the matching pilot_outfitBatchCommit the stats are not recalculated
+ *  after each edit, only the CPU is kept up to date so that
+ *  pilot_addOutfitTest still works. Batches can be nested.
+ *
+ *    @param pilot Pilot to start editing.
+ */
+void pilot_outfitBatchBegin( Pilot *pilot )
+{
+   pilot->outfit_batch++;
+}
+
+
+/**
+ * @brief Finishes a batch of outfit edits, doing any pending recalculation.
+ *
+ *    @param pilot Pilot to finish editing.
+ */
+void pilot_outfitBatchCommit( Pilot *pilot )
+{
+   if (pilot->outfit_batch <= 0) {
+      WARN("Pilot '%s': Committing outfit batch that was never started.",
+            pilot->name );
+      return;
+   }
+   pilot->outfit_batch--;
+   if (pilot->outfit_batch > 0)
+      return;
+
+   if (pilot->outfit_dirty & PILOT_BATCH_STATS)
+      pilot_calcStats( pilot );
+   if ((pilot->outfit_dirty & PILOT_BATCH_WEAPONS) && pilot->autoweap)
+      pilot_weaponAuto( pilot );
+   pilot->outfit_dirty = 0;
+}
+
+
+/**
+ * @brief Checks to see if a pilot is in a batch of outfit edits.
+ *
+ *    @param pilot Pilot to check.
+ *    @return 1 if recalculations are being deferred.
+ */
+int pilot_outfitBatching( const Pilot *pilot )
+{
+   return (pilot->outfit_batch > 0);
+}
+
+
+/**
+ * @brief Recalculates the stats deferred by a batch so they can be read.
+ *
+ * Only the CPU is kept up to date while batching, anything else reading the
+ *  stats of the pilot (mass, health maxima, cargo space, ...) in the middle
+ *  of a batch must call this first. The batch stays open.
+ *
+ *    @param pilot Pilot to update.
+ */
+void pilot_outfitBatchSync( Pilot *pilot )
+{
+   if (!pilot_outfitBatching( pilot ) || !(pilot->outfit_dirty & PILOT_BATCH_STATS))
+      return;
+
+   pilot_calcStats( pilot );
+   pilot->outfit_dirty &= ~PILOT_BATCH_STATS;
+}
+
+
+/**
+ * @brief Updates the pilot after an outfit was added or removed.
+ *
+ * Outside of a batch this is pilot_calcStats.
+ *
+ *    @param pilot Pilot that changed.
+ *    @param o Outfit that was added or removed.
+ *    @param added Whether the outfit was added or removed.
+ */
+void pilot_outfitChanged( Pilot *pilot, const Outfit *o, int added )
+{
+   ShipStatList *ll;
+
+   if (!pilot_outfitBatching( pilot )) {
+      pilot_calcStats( pilot );
+      return;
+   }
+   pilot->outfit_dirty |= PILOT_BATCH_STATS;
+   if (o == NULL)
+      return;
+
+   /* Outfits changing the CPU capacity need the full recalculation. */
+   if (outfit_isMod(o)) {
+      for (ll=o->u.mod.stats; ll!=NULL; ll=ll->next) {
+         if ((ll->type == SS_TYPE_D_CPU_MOD) || (ll->type == SS_TYPE_A_CPU_MAX)) {
+            pilot_calcStats( pilot );
+            return;
+         }
+      }
+   }
+
+   /* CPU usage is just the sum of the outfits. */
+   pilot->cpu += (added) ? outfit_cpu(o) : -outfit_cpu(o);
+}
+
+
 /**
  * @brief Updates the pilot stats after mass change.
  *
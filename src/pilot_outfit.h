@@ -39,6 +39,11 @@ void pilot_lockClear( Pilot *p );
 /* Other. */
 char* pilot_getOutfits( const Pilot *pilot );
 void pilot_calcStats( Pilot *pilot );
+void pilot_outfitBatchBegin( Pilot *pilot );
+void pilot_outfitBatchCommit( Pilot *pilot );
+int pilot_outfitBatching( const Pilot *pilot );
+void pilot_outfitBatchSync( Pilot *pilot );
+void pilot_outfitChanged( Pilot *pilot, const Outfit *o, int added );
 void pilot_updateMass( Pilot *pilot );
 void pilot_healLanded( Pilot *pilot );
 
@@ -603,6 +603,7 @@ void player_swapShip( char* shipname )
          if (pilot_stack[j] == player.p) {
             player.p         = ship;
             pilot_stack[j] = ship;
+            pilot_spatialInvalidate();
             break;
          }
 
@@ -907,6 +908,7 @@ void player_soundResume (void)
 void player_warp( const double x, const double y )
 {
    vect_cset( &player.p->solid->pos, x, y );
+   pilot_spatialInvalidate();
 }
 
 
@@ -1674,6 +1676,8 @@ int player_jump (void)
       player_message("\erYou do not have enough fuel to hyperspace jump.");
    else {
       player_message("\epPreparing for hyperspace.");
+      /* Start decoding the destination graphics while the jump charges. */
+      space_gfxPrefetch( cur_system->jumps[player.p->nav_hyperspace].target );
       /* Stop acceleration noise. */
       player_accelOver();
       /* Stop possible shooting. */
@@ -6,6 +6,10 @@
  * @file save.c
  *
  * @brief Handles saving/loading games.
+ *
+ * Saving is split in two: the game state is serialized into an in-memory
+ *  buffer on the main thread, then a worker thread writes it to a temporary
+ *  file and renames it over the save so it's never left half written.
  */
 
 #include "save.h"
@@ -13,6 +17,9 @@
 #include "naev.h"
 
 #include <errno.h> /* errno */
+#include <stdio.h>
+
+#include "SDL_thread.h"
 
 #include "log.h"
 #include "nxml.h"
@@ -31,11 +38,27 @@
 #include "land.h"
 #include "gui.h"
 #include "load.h"
+#include "ntime.h"
 
 
 int save_loaded   = 0; /**< Just loaded the savegame. */
 
 
+/**
+ * @brief A save waiting to be written to disk.
+ */
+typedef struct SaveJob_ {
+   xmlBufferPtr buf; /**< Serialized save. */
+   char file[PATH_MAX]; /**< Save file to write. */
+   int backup; /**< Whether to keep the previous save as backup. */
+   int compress; /**< Compression level to use. */
+} SaveJob;
+
+static SDL_Thread *save_thread = NULL; /**< Thread writing the last save. */
+static SaveJob save_job; /**< Save being written by the thread. */
+static int save_failed = 0; /**< Whether the last written save failed. */
+
+
 /*
  * prototypes
  */
@@ -59,7 +82,49 @@ extern int space_sysSave( xmlTextWriterPtr writer ); /**< Saves the space stuff.
 /* unidiff.c */
 extern int diff_save( xmlTextWriterPtr writer ); /**< Saves the universe diffs. */
 /* static */
+static int save_header( xmlTextWriterPtr writer );
 static int save_data( xmlTextWriterPtr writer );
+static int save_write( SaveJob *job );
+static int save_thread_func( void *data );
+
+
+/**
+ * @brief Saves the summary shown in the load menu.
+ *
+ * Duplicates what the load menu needs from the player data near the top of
+ *  the file so it doesn't have to read the whole save.
+ *
+ *    @param writer XML writer to use.
+ *    @return 0 on success.
+ */
+static int save_header( xmlTextWriterPtr writer )
+{
+   int scu, stp, stu;
+   double rem;
+
+   xmlw_startElem(writer,"header");
+   xmlw_attr(writer,"name","%s",player.name);
+   xmlw_elem(writer,"location","%s",land_planet->name);
+   xmlw_elem(writer,"credits","%"CREDITS_PRI,player.p->credits);
+
+   /* Time. */
+   xmlw_startElem(writer,"time");
+   ntime_getR( &scu, &stp, &stu, &rem );
+   xmlw_elem(writer,"SCU","%d", scu);
+   xmlw_elem(writer,"STP","%d", stp);
+   xmlw_elem(writer,"STU","%d", stu);
+   xmlw_endElem(writer); /* "time" */
+
+   /* Current ship. */
+   xmlw_startElem(writer,"ship");
+   xmlw_attr(writer,"name","%s",player.p->name);
+   xmlw_attr(writer,"model","%s",player.p->ship->name);
+   xmlw_endElem(writer); /* "ship" */
+
+   xmlw_endElem(writer); /* "header" */
+
+   return 0;
+}
 
 
 /**
@@ -85,25 +150,128 @@ static int save_data( xmlTextWriterPtr writer )
 }
 
 
+/**
+ * @brief Writes a serialized save to disk.
+ *
+ * The data is written to a temporary file which is then renamed over the
+ *  save, the previous save is renamed to the backup if needed.
+ *
+ *    @param job Save to write.
+ *    @return 0 on success.
+ */
+static int save_write( SaveJob *job )
+{
+   char tmp[PATH_MAX], backup[PATH_MAX];
+   xmlOutputBufferPtr out;
+   int ret;
+
+   nsnprintf( tmp, PATH_MAX, "%s.tmp", job->file );
+   nsnprintf( backup, PATH_MAX, "%s.backup", job->file );
+
+   /* Write to the temporary file. */
+   out = xmlOutputBufferCreateFilename( tmp, NULL, job->compress );
+   if (out == NULL) {
+      WARN("Failed to open '%s' for writing: %s", tmp, strerror(errno));
+      return -1;
+   }
+   ret = xmlOutputBufferWrite( out, xmlBufferLength(job->buf),
+         (const char*)xmlBufferContent(job->buf) );
+   if (xmlOutputBufferClose( out ) < 0)
+      ret = -1;
+   if (ret < 0) {
+      WARN("Failed to write savegame '%s'.", tmp);
+      remove( tmp );
+      return -1;
+   }
+
+   /* Back up old savegame. */
+   if (job->backup && nfile_fileExists( job->file )) {
+#if HAS_WIN32
+      remove( backup ); /* Windows won't rename over existing files. */
+#endif /* HAS_WIN32 */
+      if (rename( job->file, backup ))
+         WARN("Failure to create back up of '%s': %s", job->file, strerror(errno));
+   }
+
+   /* Put the new savegame in place. */
+#if HAS_WIN32
+   remove( job->file );
+#endif /* HAS_WIN32 */
+   if (rename( tmp, job->file )) {
+      WARN("Failed to move '%s' to '%s': %s", tmp, job->file, strerror(errno));
+      return -1;
+   }
+
+   return 0;
+}
+
+
+/**
+ * @brief Thread that writes the pending save.
+ */
+static int save_thread_func( void *data )
+{
+   SaveJob *job = (SaveJob*) data;
+   save_failed = (save_write( job ) < 0);
+   return 0;
+}
+
+
+/**
+ * @brief Waits for the save being written to hit the disk.
+ *
+ *    @return 0 if the last save was written fine.
+ */
+int save_sync (void)
+{
+   if (save_thread != NULL) {
+      SDL_WaitThread( save_thread, NULL );
+      save_thread = NULL;
+   }
+   if (save_job.buf != NULL) {
+      xmlBufferFree( save_job.buf );
+      save_job.buf = NULL;
+   }
+
+   if (save_failed) {
+      save_failed = 0;
+      return -1;
+   }
+   return 0;
+}
+
+
 /**
  * @brief Saves the current game.
  *
+ * Only serializing the game is done here, the data is written to disk in the
+ *  background. Use save_sync to wait for it.
+ *
  *    @return 0 on success.
  */
 int save_all (void)
 {
-   char file[PATH_MAX];
-   xmlDocPtr doc;
+   xmlBufferPtr buf;
    xmlTextWriterPtr writer;
 
    /* Do not save during tutorial. Or if saving is off. */
    if (player_isTut() || player_isFlag(PLAYER_NOSAVE))
       return 0;
 
+   /* Only one save in flight at a time. */
+   if (save_sync() < 0)
+      WARN("Previous savegame failed to write.");
+
    /* Create the writer. */
-   writer = xmlNewTextWriterDoc(&doc, conf.save_compress);
+   buf = xmlBufferCreate();
+   if (buf == NULL) {
+      ERR("testXmlwriterMemory: Error creating the xml buffer");
+      return -1;
+   }
+   writer = xmlNewTextWriterMemory(buf, 0);
    if (writer == NULL) {
-      ERR("testXmlwriterDoc: Error creating the xml writer");
+      ERR("testXmlwriterMemory: Error creating the xml writer");
+      xmlBufferFree(buf);
       return -1;
    }
 
@@ -120,6 +288,12 @@ int save_all (void)
    xmlw_elem( writer, "data", "%s", ndata_name() );
    xmlw_endElem(writer); /* "version" */
 
+   /* Save the summary for the load menu. */
+   if (save_header(writer) < 0) {
+      ERR("Trying to save game header");
+      goto err_writer;
+   }
+
    /* Save the data. */
    if (save_data(writer) < 0) {
       ERR("Trying to save game data");
@@ -129,39 +303,41 @@ int save_all (void)
    /* Finish element. */
    xmlw_endElem(writer); /* "naev_save" */
    xmlw_done(writer);
+   xmlFreeTextWriter(writer);
 
-   /* Write to file. */
+   /* Make sure the directory exists. */
    if ((nfile_dirMakeExist("%s", nfile_dataPath()) < 0) ||
          (nfile_dirMakeExist("%ssaves", nfile_dataPath()) < 0)) {
       WARN("Failed to create save directory '%ssaves'.", nfile_dataPath());
-      goto err_writer;
+      goto err;
    }
-   nsnprintf(file, PATH_MAX, "%ssaves/%s.ns", nfile_dataPath(), player.name);
 
-   /* Back up old savegame. */
-   if (!save_loaded) {
-      if (nfile_backupIfExists(file) < 0) {
-         WARN("Aborting save...");
-         goto err_writer;
-      }
-   }
+   /* Set up the job, old savegame is backed up unless just loaded. */
+   save_job.buf      = buf;
+   save_job.backup   = !save_loaded;
+   save_job.compress = conf.save_compress;
+   nsnprintf(save_job.file, PATH_MAX, "%ssaves/%s.ns", nfile_dataPath(), player.name);
    save_loaded = 0;
 
-   /* Critical section, if crashes here player's game gets corrupted.
-    * Luckily we have a copy just in case... */
-   xmlFreeTextWriter(writer);
-   if (xmlSaveFileEnc(file, doc, "UTF-8") < 0) {
-      WARN("Failed to write savegame!  You'll most likely have to restore it by copying your backup savegame over your current savegame.");
-      goto err;
+   /* Write in the background. */
+   save_failed = 0;
+   save_thread = SDL_CreateThread( save_thread_func,
+#if SDL_VERSION_ATLEAST(1,3,0)
+         "save_thread",
+#endif /* SDL_VERSION_ATLEAST(1,3,0) */
+         &save_job );
+   if (save_thread == NULL) {
+      WARN("Unable to create save thread, writing savegame directly.");
+      save_thread_func( &save_job );
+      return save_sync();
    }
-   xmlFreeDoc(doc);
 
    return 0;
 
 err_writer:
    xmlFreeTextWriter(writer);
 err:
-   xmlFreeDoc(doc);
+   xmlBufferFree(buf);
    return -1;
 }
 
@@ -171,6 +347,7 @@ err:
 void save_reload (void)
 {
    char path[PATH_MAX];
+   save_sync();
    nsnprintf(path, PATH_MAX, "%ssaves/%s.ns", nfile_dataPath(), player.name);
    load_game( path, 0 );
 }
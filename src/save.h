@@ -8,6 +8,7 @@
 
 
 int save_all (void);
+int save_sync (void);
 void save_reload (void);
 int save_hasSave (void);
 
@@ -908,8 +908,8 @@ static int ship_parse( Ship *temp, xmlNodePtr parent )
  */
 int ships_load (void)
 {
-   uint32_t bufsize, nfiles;
-   char *buf, **ship_files, *file;
+   uint32_t nfiles;
+   char **ship_files, *file;
    int i, sl;
    xmlNodePtr node;
    xmlDocPtr doc;
@@ -931,11 +931,9 @@ int ships_load (void)
       nsnprintf( file, sl, "%s%s", SHIP_DATA_PATH, ship_files[i] );
 
       /* Load the XML. */
-      buf  = ndata_read( file, &bufsize );
-      doc  = xmlParseMemory( buf, bufsize );
+      doc  = xml_parseNdata( file );
 
       if (doc == NULL) {
-         free(buf);
          WARN("%s file is invalid xml!", file);
          free(file);
          continue;
@@ -944,7 +942,6 @@ int ships_load (void)
       node = doc->xmlChildrenNode; /* First ship node */
       if (node == NULL) {
          xmlFreeDoc(doc);
-         free(buf);
          WARN("Malformed %s file: does not contain elements", file);
          free(file);
          continue;
@@ -958,7 +955,6 @@ int ships_load (void)
 
       /* Clean up. */
       xmlFreeDoc(doc);
-      free(buf);
    }
 
    /* Shrink stack. */
@@ -36,6 +36,15 @@
 #define SOUND_SUFFIX_OGG   ".ogg" /**< Suffix of sounds. */
 
 
+#define SOUND_REFERENCE_DISTANCE 500. /**< Distance at which sounds start to get quieter. */
+#define SOUND_VIRTUAL_GAIN    0.05 /**< Gain below which voices are virtualized. */
+#define SOUND_VIRTUAL_MINLEN  0.5 /**< Shorter inaudible sounds aren't tracked. */
+#define SOUND_VIRTUAL_MINLEFT 0.05 /**< Virtual voices with less time left aren't restored. */
+#define SOUND_VOICES_RESERVE  4 /**< Voices kept free for non-positional sounds. */
+#define SOUND_VOICES_MIN      8 /**< Minimum amount of real positional voices. */
+#define SOUND_HYSTERESIS      1.25 /**< Priority bonus of real voices to avoid thrashing. */
+
+
 #define voiceLock()        SDL_LockMutex(voice_mutex)
 #define voiceUnlock()      SDL_UnlockMutex(voice_mutex)
 
@@ -61,6 +70,21 @@ static int voice_genid        = 0; /**< Voice identifier generator. */
 alVoice *voice_active         = NULL; /**< Active voices. */
 static alVoice *voice_pool    = NULL; /**< Pool of free voices. */
 static SDL_mutex *voice_mutex = NULL; /**< Lock for voices. */
+static alVoice **voice_rank   = NULL; /**< Positional voices ranked by priority. */
+static int voice_mrank        = 0; /**< Memory allocated for voice_rank. */
+static int voice_nreal        = 0; /**< Real positional voices. */
+static int voice_nvirtual     = 0; /**< Virtual voices as of the last update. */
+static int voice_nplain       = 0; /**< Non-positional voices as of the last update. */
+static int voice_nsteals      = 0; /**< Total real voices virtualized. */
+static int voice_nrestores    = 0; /**< Total virtual voices made real. */
+
+
+/*
+ * Playback state.
+ */
+static double sound_listener[2] = { 0., 0. }; /**< Position of the listener. */
+static double sound_speedMod  = 1.; /**< Speed sounds are played at. */
+static int sound_paused       = 0; /**< Whether or not sounds are paused. */
 
 
 /*
@@ -92,6 +116,8 @@ int  (*sound_sys_playPos) ( alVoice *v, alSound *s,
 int  (*sound_sys_updatePos) ( alVoice *v, double px, double py,
       double vx, double vy )           = NULL;
 void (*sound_sys_updateVoice) ( alVoice *v ) = NULL;
+void (*sound_sys_releaseVoice) ( alVoice *v ) = NULL;
+void (*sound_sys_seekVoice) ( alVoice *v, double offset ) = NULL;
  /* Sound management. */
 void (*sound_sys_update) (void)        = NULL;
 void (*sound_sys_stop) ( alVoice *v )  = NULL;
@@ -122,6 +148,12 @@ static int sound_makeList (void);
 static int sound_load( alSound *snd, const char *filename );
 static void sound_free( alSound *snd );
 /* Voices. */
+static double sound_audibility( double px, double py );
+static int voice_maxReal (void);
+static int voice_rankCmp( const void *p1, const void *p2 );
+static int voice_playReal( alVoice *v );
+static void voice_virtualize( alVoice *v );
+static void voice_balance (void);
 
 
 /**
@@ -165,6 +197,8 @@ int sound_init (void)
       sound_sys_playPos    = sound_al_playPos;
       sound_sys_updatePos  = sound_al_updatePos;
       sound_sys_updateVoice = sound_al_updateVoice;
+      sound_sys_releaseVoice = sound_al_releaseVoice;
+      sound_sys_seekVoice  = sound_al_seekVoice;
       /* Sound management. */
       sound_sys_update     = sound_al_update;
       sound_sys_stop       = sound_al_stop;
@@ -209,6 +243,8 @@ int sound_init (void)
       sound_sys_playPos    = sound_mix_playPos;
       sound_sys_updatePos  = sound_mix_updatePos;
       sound_sys_updateVoice = sound_mix_updateVoice;
+      sound_sys_releaseVoice = sound_mix_releaseVoice;
+      sound_sys_seekVoice  = sound_mix_seekVoice;
       /* Sound management. */
       sound_sys_update     = sound_mix_update;
       sound_sys_stop       = sound_mix_stop;
@@ -314,6 +350,9 @@ void sound_exit (void)
          voice_pool = v->next;
          free(v);
       }
+      free(voice_rank);
+      voice_rank  = NULL;
+      voice_mrank = 0;
       voiceUnlock();
 
       /* Destroy voice lock. */
@@ -418,14 +457,16 @@ int sound_play( int sound )
  *    @param vx X velocity of the sound.
  *    @param vy Y velocity of the sound.
  *    @return Voice identifier on success.
+ *
+ * Voices that are too quiet to hear or that don't fit in the real voice
+ *  budget are created virtual: they get no backend source and are only
+ *  tracked until sound_update gives them one or they run out.
  */
 int sound_playPos( int sound, double px, double py, double vx, double vy )
 {
    alVoice *v;
    alSound *s;
-   Pilot *p;
-   double cx, cy, dist;
-   int target;
+   double priority;
 
    if (sound_disabled)
       return 0;
@@ -433,31 +474,30 @@ int sound_playPos( int sound, double px, double py, double vx, double vy )
    if ((sound < 0) || (sound >= sound_nlist))
       return -1;
 
-   target = cam_getTarget();
+   /* Get the sound. */
+   s = &sound_list[sound];
 
-   /* Following a pilot. */
-   p = pilot_get(target);
-   if (target && (p != NULL)) {
-      if (!pilot_inRange( p, px, py ))
-         return 0;
-   }
-   /* Set to a position. */
-   else {
-      cam_getPos(&cx, &cy);
-      dist = pow2(px - cx) + pow2(py - cy);
-      if (dist > pilot_sensorRange())
-         return 0;
-   }
+   /* Short sounds out of range will be over before they can be heard. */
+   priority = sound_audibility( px, py );
+   if ((priority <= 0.) && (s->length < SOUND_VIRTUAL_MINLEN))
+      return 0;
 
    /* Gets a new voice. */
    v = voice_new();
-
-   /* Get the sound. */
-   s = &sound_list[sound];
-
-   /* Try to play the sound. */
-   if (sound_sys_playPos( v, s, px, py, vx, vy ))
-      return -1;
+   v->sound    = sound;
+   v->pos[0]   = px;
+   v->pos[1]   = py;
+   v->vel[0]   = vx;
+   v->vel[1]   = vy;
+   v->timer    = s->length;
+   v->priority = priority;
+
+   /* Try to play the sound, fall back to a virtual voice. */
+   if ((priority < SOUND_VIRTUAL_GAIN) || (voice_nreal >= voice_maxReal()) ||
+         sound_sys_playPos( v, s, px, py, vx, vy ))
+      v->flags |= VOICE_VIRTUAL;
+   else
+      voice_nreal++;
 
    /* Actually add the voice to the list. */
    v->state = VOICE_PLAYING;
@@ -479,11 +519,19 @@ int sound_updatePos( int voice, double px, double py, double vx, double vy )
 {
    alVoice *v;
 
-   if (sound_disabled)
+   if (sound_disabled || (voice <= 0))
       return 0;
 
    v = voice_get(voice);
    if (v != NULL) {
+      v->pos[0] = px;
+      v->pos[1] = py;
+      v->vel[0] = vx;
+      v->vel[1] = vy;
+
+      /* Virtual voices only get updated logically. */
+      if (v->flags & VOICE_VIRTUAL)
+         return 0;
 
       /* Update the voice. */
       if (sound_sys_updatePos( v, px, py, vx, vy))
@@ -501,7 +549,7 @@ int sound_updatePos( int voice, double px, double py, double vx, double vy )
  */
 int sound_update( double dt )
 {
-   alVoice *v, *tv;
+   alVoice *v, *tv, *nv;
 
    /* Update music if needed. */
    music_update(dt);
@@ -512,16 +560,31 @@ int sound_update( double dt )
    /* System update. */
    sound_sys_update();
 
-   if (voice_active == NULL)
+   if (voice_active == NULL) {
+      voice_nreal    = 0;
+      voice_nvirtual = 0;
+      voice_nplain   = 0;
       return 0;
+   }
 
    voiceLock();
 
-   /* The actual control loop. */
-   for (v=voice_active; v!=NULL; v=v->next) {
+   /* The actual control loop, next is saved since v may go to the pool. */
+   for (v=voice_active; v!=NULL; v=nv) {
+      nv = v->next;
+
+      /* Positional voices keep track of how far along they are whether they
+       * are real or not, so they can be virtualized and restored anytime. */
+      if ((v->sound >= 0) && !sound_paused)
+         v->timer -= dt * sound_speedMod;
 
       /* Run first to clear in same iteration. */
-      sound_sys_updateVoice( v );
+      if (v->flags & VOICE_VIRTUAL) {
+         if (v->timer <= 0.)
+            v->state = VOICE_STOPPED;
+      }
+      else
+         sound_sys_updateVoice( v );
 
       /* Destroy and toss into pool. */
       if ((v->state == VOICE_STOPPED) || (v->state == VOICE_DESTROY)) {
@@ -545,14 +608,12 @@ int sound_update( double dt )
          voice_pool = v;
          if (v->next != NULL)
             v->next->prev = v;
-
-         /* Avoid loop blockage. */
-         v = (tv != NULL) ? tv->next : voice_active;
-         if (v == NULL)
-            break;
       }
    }
 
+   /* Hand out the real voices. */
+   voice_balance();
+
    voiceUnlock();
 
    return 0;
@@ -568,6 +629,7 @@ void sound_pause (void)
       return;
 
    sound_sys_pause();
+   sound_paused = 1;
 
    if (snd_compression >= 0)
       sound_sys_pauseGroup( snd_compressionG );
@@ -583,6 +645,7 @@ void sound_resume (void)
       return;
 
    sound_sys_resume();
+   sound_paused = 0;
 
    if (snd_compression >= 0)
       sound_sys_resumeGroup( snd_compressionG );
@@ -605,7 +668,8 @@ void sound_stopAll (void)
 
    voiceLock();
    for (v=voice_active; v!=NULL; v=v->next) {
-      sound_sys_stop( v );
+      if (!(v->flags & VOICE_VIRTUAL))
+         sound_sys_stop( v );
       v->state = VOICE_STOPPED;
    }
    voiceUnlock();
@@ -626,7 +690,8 @@ void sound_stop( int voice )
 
    v = voice_get(voice);
    if (v != NULL) {
-      sound_sys_stop( v );
+      if (!(v->flags & VOICE_VIRTUAL))
+         sound_sys_stop( v );
       v->state = VOICE_STOPPED;
    }
 
@@ -651,10 +716,36 @@ int sound_updateListener( double dir, double px, double py,
    if (sound_disabled)
       return 0;
 
+   sound_listener[0] = px;
+   sound_listener[1] = py;
+
    return sound_sys_updateListener( dir, px, py, vx, vy );
 }
 
 
+/**
+ * @brief Gets statistics on the voices.
+ *
+ * Counts are as of the last sound_update.
+ *
+ *    @param[out] nreal Voices playing with a backend source.
+ *    @param[out] nvirtual Voices only being tracked logically.
+ *    @param[out] nsteals Total times a real voice was virtualized.
+ *    @param[out] nrestores Total times a virtual voice was made real.
+ */
+void sound_voiceStats( int *nreal, int *nvirtual, int *nsteals, int *nrestores )
+{
+   if (nreal != NULL)
+      *nreal = voice_nreal + voice_nplain;
+   if (nvirtual != NULL)
+      *nvirtual = voice_nvirtual;
+   if (nsteals != NULL)
+      *nsteals = voice_nsteals;
+   if (nrestores != NULL)
+      *nrestores = voice_nrestores;
+}
+
+
 /**
  * @brief Sets the speed to play the sound at.
  *
@@ -689,6 +780,7 @@ void sound_setSpeed( double s )
       sound_sys_setSpeedVolume( 1. ); /* Restore volume. */
    }
    snd_compression_gain = v;
+   sound_speedMod = s;
 
    return sound_sys_setSpeed( s );
 }
@@ -998,11 +1090,14 @@ alVoice* voice_new (void)
    if (voice_pool == NULL) {
       v = calloc( 1, sizeof(alVoice) );
       voice_pool = v;
-      return v;
    }
-
    /* First free voice. */
-   v = voice_pool; /* We do not touch the next nor prev, it's still in the pool. */
+   else
+      v = voice_pool; /* We do not touch the next nor prev, it's still in the pool. */
+
+   /* Not positional until told otherwise. */
+   v->sound  = -1;
+   v->flags &= ~VOICE_VIRTUAL;
    return v;
 }
 
@@ -1066,3 +1161,172 @@ alVoice* voice_get( int id )
    return v;
 }
 
+
+/**
+ * @brief Estimates how audible a positional sound is.
+ *
+ * Mirrors the inverse distance model the OpenAL backend uses, so the value
+ *  is roughly the gain the sound would play at.
+ *
+ *    @param px X position of the sound.
+ *    @param py Y position of the sound.
+ *    @return Estimated gain of the sound, 0 if it is out of range.
+ */
+static double sound_audibility( double px, double py )
+{
+   Pilot *p;
+   double cx, cy, dist;
+   int target;
+
+   target = cam_getTarget();
+
+   /* Following a pilot. */
+   p = pilot_get(target);
+   if (target && (p != NULL)) {
+      if (!pilot_inRange( p, px, py ))
+         return 0.;
+   }
+   /* Set to a position. */
+   else {
+      cam_getPos(&cx, &cy);
+      dist = pow2(px - cx) + pow2(py - cy);
+      if (dist > pilot_sensorRange())
+         return 0.;
+   }
+
+   dist = sqrt( pow2(px - sound_listener[0]) + pow2(py - sound_listener[1]) );
+   return SOUND_REFERENCE_DISTANCE / MAX( SOUND_REFERENCE_DISTANCE, dist );
+}
+
+
+/**
+ * @brief Gets the amount of positional voices that may have a real source.
+ */
+static int voice_maxReal (void)
+{
+   return MAX( SOUND_VOICES_MIN, conf.snd_voices - SOUND_VOICES_RESERVE );
+}
+
+
+/**
+ * @brief Compares voices by priority, highest first.
+ */
+static int voice_rankCmp( const void *p1, const void *p2 )
+{
+   const alVoice *v1, *v2;
+   v1 = *(const alVoice**) p1;
+   v2 = *(const alVoice**) p2;
+   if (v1->priority > v2->priority)
+      return -1;
+   else if (v1->priority < v2->priority)
+      return +1;
+   /* Keep older voices first so the order is stable. */
+   return v1->id - v2->id;
+}
+
+
+/**
+ * @brief Gives a virtual voice a real backend source.
+ *
+ * The voice resumes where it would be had it been playing all along if the
+ *  backend can seek, otherwise it restarts from the beginning.
+ *
+ *    @param v Virtual voice to make real.
+ *    @return 0 on success.
+ */
+static int voice_playReal( alVoice *v )
+{
+   alSound *s;
+
+   s = &sound_list[ v->sound ];
+   if (sound_sys_playPos( v, s, v->pos[0], v->pos[1], v->vel[0], v->vel[1] ))
+      return -1;
+   sound_sys_seekVoice( v, s->length - v->timer );
+
+   v->flags &= ~VOICE_VIRTUAL;
+   return 0;
+}
+
+
+/**
+ * @brief Takes the backend source away from a voice, leaving it virtual.
+ *
+ *    @param v Real voice to virtualize.
+ */
+static void voice_virtualize( alVoice *v )
+{
+   sound_sys_releaseVoice( v );
+   v->flags |= VOICE_VIRTUAL;
+}
+
+
+/**
+ * @brief Hands out the real voices to the most audible positional voices.
+ *
+ * Real voices that became inaudible or got outranked are virtualized first
+ *  so their sources can be given to the virtual voices that made the cut.
+ *  Must be called with the voices locked.
+ */
+static void voice_balance (void)
+{
+   alVoice *v;
+   int i, n, nreal, nvirtual, nplain, maxreal;
+
+   /* Rank the positional voices. */
+   n        = 0;
+   nreal    = 0;
+   nvirtual = 0;
+   nplain   = 0;
+   for (v=voice_active; v!=NULL; v=v->next) {
+      if (v->state != VOICE_PLAYING)
+         continue;
+      if (v->sound < 0) {
+         nplain++;
+         continue;
+      }
+
+      v->priority = sound_audibility( v->pos[0], v->pos[1] );
+      if (!(v->flags & VOICE_VIRTUAL))
+         v->priority *= SOUND_HYSTERESIS;
+
+      if (n >= voice_mrank) {
+         voice_mrank = MAX( 64, 2*voice_mrank );
+         voice_rank  = realloc( voice_rank, voice_mrank * sizeof(alVoice*) );
+      }
+      voice_rank[n++] = v;
+   }
+   qsort( voice_rank, n, sizeof(alVoice*), voice_rankCmp );
+
+   /* Free the sources of the voices that didn't make the cut. */
+   maxreal = voice_maxReal();
+   for (i=0; i<n; i++) {
+      v = voice_rank[i];
+      if (v->flags & VOICE_VIRTUAL)
+         continue;
+      if ((i >= maxreal) || (v->priority < SOUND_VIRTUAL_GAIN)) {
+         voice_virtualize( v );
+         voice_nsteals++;
+      }
+   }
+
+   /* Give them to the ones that did. */
+   for (i=0; i<n; i++) {
+      v = voice_rank[i];
+      if ((i < maxreal) && (v->flags & VOICE_VIRTUAL) &&
+            (v->priority >= SOUND_VIRTUAL_GAIN) &&
+            (v->timer > SOUND_VIRTUAL_MINLEFT) && !sound_paused &&
+            (sound_speedMod <= SOUND_SPEED_PLAY_LIMIT)) {
+         if (voice_playReal( v ) == 0)
+            voice_nrestores++;
+      }
+
+      if (v->flags & VOICE_VIRTUAL)
+         nvirtual++;
+      else
+         nreal++;
+   }
+
+   voice_nreal    = nreal;
+   voice_nvirtual = nvirtual;
+   voice_nplain   = nplain;
+}
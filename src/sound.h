@@ -46,6 +46,7 @@ int sound_playPos( int sound, double px, double py, double vx, double vy );
 void sound_stop( int voice );
 void sound_stopAll (void);
 int sound_updatePos( int voice, double px, double py, double vx, double vy );
+void sound_voiceStats( int *nreal, int *nvirtual, int *nsteals, int *nrestores );
 int sound_updateListener( double dir, double px, double py,
       double vx, double vy );
 void sound_setSpeed( double s );
@@ -973,6 +973,57 @@ void sound_al_updateVoice( alVoice *v )
 }
 
 
+/**
+ * @brief Stops a voice at once and gives back its source.
+ *
+ * The voice is left as is so it can be played again later.
+ *
+ *    @param v Voice to release.
+ */
+void sound_al_releaseVoice( alVoice *v )
+{
+   if (v->u.al.source == 0)
+      return;
+
+   soundLock();
+
+   alSourceStop( v->u.al.source );
+   alSourcei( v->u.al.source, AL_BUFFER, AL_NONE );
+
+   /* Check for errors. */
+   al_checkErr();
+
+   /* Put source back on the list. */
+   source_stack[source_nstack] = v->u.al.source;
+   source_nstack++;
+   v->u.al.source = 0;
+
+   soundUnlock();
+}
+
+
+/**
+ * @brief Moves the playback position of a voice.
+ *
+ *    @param v Voice to seek.
+ *    @param offset Offset from the start of the sound in seconds.
+ */
+void sound_al_seekVoice( alVoice *v, double offset )
+{
+   if ((v->u.al.source == 0) || (offset <= 0.))
+      return;
+
+   soundLock();
+
+   alSourcef( v->u.al.source, AL_SEC_OFFSET, offset );
+
+   /* Check for errors. */
+   al_checkErr();
+
+   soundUnlock();
+}
+
+
 /**
  * @brief Stops playing sound.
  */
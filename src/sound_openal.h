@@ -88,6 +88,8 @@ int sound_al_playPos( alVoice *v, alSound *s,
 int sound_al_updatePos( alVoice *v,
       double px, double py, double vx, double vy );
 void sound_al_updateVoice( alVoice *v );
+void sound_al_releaseVoice( alVoice *v );
+void sound_al_seekVoice( alVoice *v, double offset );
 
 /*
  * Sound management.
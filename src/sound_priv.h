@@ -25,6 +25,7 @@
  */
 #define VOICE_LOOPING      (1<<10) /* voice loops */
 #define VOICE_STATIC       (1<<11) /* voice isn't relative */
+#define VOICE_VIRTUAL      (1<<12) /* voice is only tracked logically */
 
 
 #define MUSIC_FADEOUT_DELAY   1000 /**< Time it takes to fade out. */
@@ -87,6 +88,15 @@ typedef struct alVoice_ {
    voice_state_t state; /**< Current state of the sound. */
    unsigned int flags; /**< Voice flags. */
 
+   /*
+    * Logical state, used to virtualize positional voices.
+    */
+   int sound; /**< Sound being played, -1 if not positional. */
+   double pos[2]; /**< Position of the voice. */
+   double vel[2]; /**< Velocity of the voice. */
+   double timer; /**< Time left to play. */
+   double priority; /**< How audible the voice is, higher is more important. */
+
    /*
     * Backend specific.
     */
@@ -691,6 +691,35 @@ void sound_mix_updateVoice( alVoice *v )
 }
 
 
+/**
+ * @brief Stops a voice at once and gives back its channel.
+ *
+ *    @param v Voice to release.
+ */
+void sound_mix_releaseVoice( alVoice *v )
+{
+   int channel;
+
+   if (v->u.mix.channel < 0)
+      return;
+
+   /* Clear first so the finished callback doesn't mark the voice stopped. */
+   channel = v->u.mix.channel;
+   v->u.mix.channel = -1;
+   Mix_HaltChannel( channel );
+}
+
+
+/**
+ * @brief SDL_mixer can't seek chunks, voices restart from the beginning.
+ */
+void sound_mix_seekVoice( alVoice *v, double offset )
+{
+   (void) v;
+   (void) offset;
+}
+
+
 /**
  * @brief Marks the voice to which channel belongs to as stopped.
  *
@@ -702,7 +731,7 @@ static void voice_mix_markStopped( int channel )
 
    voice_lock();
    for (v=voice_active; v!=NULL; v=v->next)
-      if (v->u.mix.channel == channel) {
+      if ((v->u.mix.channel == channel) && !(v->flags & VOICE_VIRTUAL)) {
          v->state = VOICE_STOPPED;
          break;
       }
@@ -44,6 +44,8 @@ int sound_mix_playPos( alVoice *v, alSound *s,
 int sound_mix_updatePos( alVoice *v,
       double px, double py, double vx, double vy );
 void sound_mix_updateVoice( alVoice *v );
+void sound_mix_releaseVoice( alVoice *v );
+void sound_mix_seekVoice( alVoice *v, double offset );
 
 /*
  * Sound management.
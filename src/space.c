@@ -1111,6 +1111,18 @@ static void system_scheduler( double dt, int init )
 }
 
 
+/**
+ * @brief Checks to see if the system is being simulated before the player
+ *        enters it.
+ *
+ *    @return 1 if the system is being simulated.
+ */
+int space_isSimulating (void)
+{
+   return space_simulating;
+}
+
+
 /**
  * @brief Mark when a faction changes.
  */
@@ -1335,8 +1347,9 @@ void space_init( const char* sysname )
       cur_system->presence[i].disabled = 0;
    }
 
-   /* Load graphics. */
+   /* Load graphics, anything prefetched but not used is dropped. */
    space_gfxLoad( cur_system );
+   gl_prefetchClear();
 
    /* Call the scheduler. */
    system_scheduler( 0., 1 );
@@ -1352,6 +1365,8 @@ void space_init( const char* sysname )
    s = sound_disabled;
    sound_disabled = 1;
    ntime_allowUpdate( 0 );
+   /* AI only thinks every SYSTEM_SIMULATE_THINK ticks and no effects are
+    * created, see pilots_update and spfx_add. */
    n = SYSTEM_SIMULATE_TIME / fps_min;
    for (i=0; i<n; i++)
       update_routine( fps_min, 1 );
@@ -1421,7 +1436,7 @@ static int planets_load ( void )
    int i, len;
 
    /* Load landing stuff. */
-   landing_lua = nlua_newState();
+   landing_lua = nlua_newState( LANDING_DATA_PATH );
    L           = landing_lua;
    nlua_loadStandard(L, 1);
    buf         = ndata_read( LANDING_DATA_PATH, &bufsize );
@@ -1446,12 +1461,10 @@ static int planets_load ( void )
       len  = (strlen(PLANET_DATA_PATH)+strlen(planet_files[i])+2);
       file = malloc( len );
       nsnprintf( file, len,"%s%s",PLANET_DATA_PATH,planet_files[i]);
-      buf  = ndata_read( file, &bufsize );
-      doc  = xmlParseMemory( buf, bufsize );
+      doc  = xml_parseNdata( file );
       if (doc == NULL) {
          WARN("%s file is invalid xml!",file);
          free(file);
-         free(buf);
          continue;
       }
 
@@ -1460,7 +1473,6 @@ static int planets_load ( void )
          WARN("Malformed %s file: does not contain elements",file);
          free(file);
          xmlFreeDoc(doc);
-         free(buf);
          continue;
       }
 
@@ -1472,7 +1484,6 @@ static int planets_load ( void )
       /* Clean up. */
       free(file);
       xmlFreeDoc(doc);
-      free(buf);
    }
 
    /* Clean up. */
@@ -1641,6 +1652,29 @@ void space_gfxLoad( StarSystem *sys )
 }
 
 
+/**
+ * @brief Starts decoding the graphics of a star system in the background.
+ *
+ * Used while jumping so that space_gfxLoad only has to upload them.
+ *
+ *    @param sys System to prefetch graphics for.
+ */
+void space_gfxPrefetch( StarSystem *sys )
+{
+   int i;
+   Planet *planet;
+   for (i=0; i<sys->nplanets; i++) {
+      planet = sys->planets[i];
+
+      if (planet->real != ASSET_REAL)
+         continue;
+
+      if (planet->gfx_space == NULL)
+         gl_prefetchImage( planet->gfx_spaceName, OPENGL_TEX_MIPMAPS );
+   }
+}
+
+
 /**
  * @brief Unloads all the graphics for a star system.
  *
@@ -2042,7 +2076,7 @@ int system_addJumpDiff( StarSystem *sys, xmlNodePtr node )
 {
    if (system_parseJumpPointDiff(node, sys) <= -1)
       return 0;
-   systems_reconstructJumps();
+   system_reconstructJumps(sys); /* Target is set, only this system changed. */
    economy_addQueuedUpdate();
 
    return 1;
@@ -2743,10 +2777,9 @@ int space_load (void)
  */
 static int systems_load (void)
 {
-   uint32_t bufsize;
-   char *buf, **system_files, *file;
+   char **system_files, *file;
    xmlNodePtr node;
-   xmlDocPtr doc;
+   xmlDocPtr doc, *docs;
    StarSystem *sys;
    int i, len;
    uint32_t nfiles;
@@ -2759,6 +2792,7 @@ static int systems_load (void)
    }
 
    system_files = ndata_list( SYSTEM_DATA_PATH, &nfiles );
+   docs = calloc( nfiles, sizeof(xmlDocPtr) ); /* Kept for the second pass. */
 
    /*
     * First pass - loads all the star systems_stack.
@@ -2769,11 +2803,10 @@ static int systems_load (void)
       file = malloc( len );
       nsnprintf( file, len, "%s%s", SYSTEM_DATA_PATH, system_files[i] );
       /* Load the file. */
-      buf = ndata_read( file, &bufsize );
-      doc = xmlParseMemory( buf, bufsize );
+      doc = xml_parseNdata( file );
       if (doc == NULL) {
          WARN("%s file is invalid xml!",file);
-         free(buf);
+         free( file );
          continue;
       }
 
@@ -2781,7 +2814,7 @@ static int systems_load (void)
       if (node == NULL) {
          WARN("Malformed %s file: does not contain elements",file);
          xmlFreeDoc(doc);
-         free(buf);
+         free( file );
          continue;
       }
 
@@ -2789,8 +2822,7 @@ static int systems_load (void)
       system_parse( sys, node );
 
       /* Clean up. */
-      xmlFreeDoc(doc);
-      free(buf);
+      docs[i] = doc;
       free( file );
    }
 
@@ -2798,32 +2830,16 @@ static int systems_load (void)
     * Second pass - loads all the jump routes.
     */
    for (i=0; i<(int)nfiles; i++) {
-
-      len  = strlen(SYSTEM_DATA_PATH)+strlen(system_files[i])+2;
-      file = malloc( len );
-      nsnprintf( file, len, "%s%s", SYSTEM_DATA_PATH, system_files[i] );
-      /* Load the file. */
-      buf = ndata_read( file, &bufsize );
-      free( file );
-      doc = xmlParseMemory( buf, bufsize );
-      if (doc == NULL) {
-         free(buf);
+      if (docs[i] == NULL)
          continue;
-      }
-
-      node = doc->xmlChildrenNode; /* first planet node */
-      if (node == NULL) {
-         xmlFreeDoc(doc);
-         free(buf);
-         continue;
-      }
 
+      node = docs[i]->xmlChildrenNode; /* first planet node */
       system_parseJumps(node); /* will automatically load the jumps into the system */
 
       /* Clean up. */
-      xmlFreeDoc(doc);
-      free(buf);
+      xmlFreeDoc(docs[i]);
    }
+   free(docs);
 
    DEBUG("Loaded %d Star System%s with %d Planet%s",
          systems_nstack, (systems_nstack==1) ? "" : "s",
@@ -3017,7 +3033,7 @@ void space_exit (void)
 
    /* Free landing lua. */
    if (landing_lua != NULL)
-      lua_close( landing_lua );
+      nlua_closeState( landing_lua );
    landing_lua = NULL;
 }
 
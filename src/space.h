@@ -18,6 +18,7 @@
 
 
 #define SYSTEM_SIMULATE_TIME  15. /**< Time to simulate system before player is added. */
+#define SYSTEM_SIMULATE_THINK 3 /**< Physics ticks per AI tick while simulating the system. */
 
 #define MAX_HYPERSPACE_VEL    25 /**< Speed to brake to before jumping. */
 
@@ -321,6 +322,7 @@ void space_update( const double dt );
  * Graphics.
  */
 void space_gfxLoad( StarSystem *sys );
+void space_gfxPrefetch( StarSystem *sys );
 void space_gfxUnload( StarSystem *sys );
 
 /*
@@ -367,6 +369,7 @@ int space_calcJumpInPos( StarSystem *in, StarSystem *out, Vector2d *pos, Vector2
  */
 void system_setFaction( StarSystem *sys );
 void space_factionChange (void);
+int space_isSimulating (void);
 
 
 #endif /* SPACE_H */
@@ -0,0 +1,264 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+/**
+ * @file spatial.c
+ *
+ * @brief Spatial hash grid used to find objects within a radius.
+ *
+ * Objects are hashed by grid cell into a bucket array that is counting
+ *  sorted on build, so a query only has to look at the buckets of the cells
+ *  touching the query circle.  Results are returned in the order the entries
+ *  were added, which lets callers visit objects in the same order as a brute
+ *  force loop over their stack would.
+ */
+
+
+#include "spatial.h"
+
+#include "naev.h"
+
+#include <stdlib.h>
+#include "nstring.h"
+
+#include "log.h"
+
+
+#define SPATIAL_CHUNK      128 /**< Minimum entries to allocate. */
+#define SPATIAL_BUCKETS    16 /**< Minimum number of buckets. */
+
+
+/*
+ * Prototypes.
+ */
+static unsigned int spatial_hash( int cx, int cy, int nbuckets );
+static int spatial_cmp( const void *a, const void *b );
+static void spatial_addResult( SpatialIndex *si, int e, int *nres );
+
+
+/**
+ * @brief Hashes a cell into a bucket.
+ */
+static unsigned int spatial_hash( int cx, int cy, int nbuckets )
+{
+   return (((unsigned int)cx * 73856093u) ^ ((unsigned int)cy * 19349663u)) &
+         (unsigned int)(nbuckets-1);
+}
+
+
+/**
+ * @brief Compares two entries by insertion order.
+ */
+static int spatial_cmp( const void *a, const void *b )
+{
+   return *(const int*)a - *(const int*)b;
+}
+
+
+/**
+ * @brief Initializes a spatial index.
+ *
+ *    @param si Spatial index to initialize.
+ *    @param cell Size of the grid cells, should be around the typical query
+ *           radius.
+ */
+void spatial_init( SpatialIndex *si, double cell )
+{
+   memset( si, 0, sizeof(SpatialIndex) );
+   si->cell = cell;
+}
+
+
+/**
+ * @brief Frees all the memory used by a spatial index.
+ *
+ *    @param si Spatial index to free.
+ */
+void spatial_free( SpatialIndex *si )
+{
+   free( si->id );
+   free( si->x );
+   free( si->y );
+   free( si->r );
+   free( si->bucket );
+   free( si->mark );
+   free( si->start );
+   free( si->sorted );
+   free( si->res );
+   spatial_init( si, si->cell );
+}
+
+
+/**
+ * @brief Removes all the entries from a spatial index, keeping the memory.
+ *
+ *    @param si Spatial index to clear.
+ */
+void spatial_clear( SpatialIndex *si )
+{
+   si->n      = 0;
+   si->maxrad = 0.;
+}
+
+
+/**
+ * @brief Adds an entry to a spatial index.
+ *
+ * The index must be built with spatial_build before querying.
+ *
+ *    @param si Spatial index to add to.
+ *    @param id Identifier to return in queries.
+ *    @param x X position of the entry.
+ *    @param y Y position of the entry.
+ *    @param r Radius of the entry.
+ */
+void spatial_add( SpatialIndex *si, int id, double x, double y, double r )
+{
+   if (si->n >= si->mentries) {
+      si->mentries = MAX( SPATIAL_CHUNK, 2*si->mentries );
+      si->id     = realloc( si->id,     si->mentries * sizeof(int) );
+      si->x      = realloc( si->x,      si->mentries * sizeof(double) );
+      si->y      = realloc( si->y,      si->mentries * sizeof(double) );
+      si->r      = realloc( si->r,      si->mentries * sizeof(double) );
+      si->bucket = realloc( si->bucket, si->mentries * sizeof(int) );
+      si->mark   = realloc( si->mark,   si->mentries * sizeof(int) );
+      si->sorted = realloc( si->sorted, si->mentries * sizeof(int) );
+      si->res    = realloc( si->res,    si->mentries * sizeof(int) );
+   }
+
+   si->id[ si->n ]   = id;
+   si->x[ si->n ]    = x;
+   si->y[ si->n ]    = y;
+   si->r[ si->n ]    = r;
+   si->mark[ si->n ] = 0;
+   si->n++;
+
+   if (r > si->maxrad)
+      si->maxrad = r;
+}
+
+
+/**
+ * @brief Builds the buckets of a spatial index.
+ *
+ *    @param si Spatial index to build.
+ */
+void spatial_build( SpatialIndex *si )
+{
+   int i, b, nbuckets;
+
+   /* Get the amount of buckets, grows but never shrinks. */
+   nbuckets = MAX( SPATIAL_BUCKETS, si->nbuckets );
+   while (nbuckets < 2*si->n)
+      nbuckets *= 2;
+   if (nbuckets != si->nbuckets) {
+      si->nbuckets = nbuckets;
+      si->start    = realloc( si->start, (nbuckets+1) * sizeof(int) );
+   }
+   memset( si->start, 0, (si->nbuckets+1) * sizeof(int) );
+
+   /* Count entries per bucket. */
+   for (i=0; i<si->n; i++) {
+      b = spatial_hash( (int)floor(si->x[i] / si->cell),
+            (int)floor(si->y[i] / si->cell), si->nbuckets );
+      si->bucket[i] = b;
+      si->start[b+1]++;
+   }
+
+   /* Prefix sum. */
+   for (i=0; i<si->nbuckets; i++)
+      si->start[i+1] += si->start[i];
+
+   /* Sort entries, start is used as the insertion point and fixed up after. */
+   for (i=0; i<si->n; i++)
+      si->sorted[ si->start[ si->bucket[i] ]++ ] = i;
+   for (i=si->nbuckets; i>0; i--)
+      si->start[i] = si->start[i-1];
+   si->start[0] = 0;
+}
+
+
+/**
+ * @brief Adds an entry to the query results if not already there.
+ */
+static void spatial_addResult( SpatialIndex *si, int e, int *nres )
+{
+   if (si->mark[e] == si->stamp)
+      return;
+   si->mark[e] = si->stamp;
+   si->res[ (*nres)++ ] = e;
+}
+
+
+/**
+ * @brief Gets all the entries whose circle touches a circle.
+ *
+ *    @param si Spatial index to query.
+ *    @param x X position of the query circle.
+ *    @param y Y position of the query circle.
+ *    @param r Radius of the query circle.
+ *    @param[out] ids Identifiers of the entries found, in the order they were
+ *                added. Valid until the next query.
+ *    @return Number of entries found.
+ */
+int spatial_query( SpatialIndex *si, double x, double y, double r, const int **ids )
+{
+   int i, k, e, b, nres;
+   int cx, cy, x0, y0, x1, y1;
+   double R, d;
+
+   *ids = si->res;
+   if (si->n <= 0)
+      return 0;
+
+   /* New query stamp. */
+   si->stamp++;
+   if (si->stamp <= 0) {
+      memset( si->mark, 0, si->n * sizeof(int) );
+      si->stamp = 1;
+   }
+
+   /* Cells touched by the query circle grown by the largest entry. */
+   R  = r + si->maxrad;
+   x0 = (int)floor( (x-R) / si->cell );
+   x1 = (int)floor( (x+R) / si->cell );
+   y0 = (int)floor( (y-R) / si->cell );
+   y1 = (int)floor( (y+R) / si->cell );
+
+   /* Candidates. */
+   nres = 0;
+   if ((double)(x1-x0+1) * (double)(y1-y0+1) > (double)si->nbuckets) {
+      /* Query is huge, cheaper to look at everything. */
+      for (e=0; e<si->n; e++)
+         spatial_addResult( si, e, &nres );
+   }
+   else {
+      for (cx=x0; cx<=x1; cx++) {
+         for (cy=y0; cy<=y1; cy++) {
+            b = spatial_hash( cx, cy, si->nbuckets );
+            for (k=si->start[b]; k<si->start[b+1]; k++)
+               spatial_addResult( si, si->sorted[k], &nres );
+         }
+      }
+   }
+
+   /* Filter by actual distance. */
+   k = 0;
+   for (i=0; i<nres; i++) {
+      e = si->res[i];
+      d = r + si->r[e];
+      if (pow2(si->x[e]-x) + pow2(si->y[e]-y) > pow2(d))
+         continue;
+      si->res[k++] = e;
+   }
+   nres = k;
+
+   /* Restore insertion order and convert to identifiers. */
+   qsort( si->res, nres, sizeof(int), spatial_cmp );
+   for (i=0; i<nres; i++)
+      si->res[i] = si->id[ si->res[i] ];
+
+   return nres;
+}
+
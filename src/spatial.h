@@ -0,0 +1,52 @@
+/*
+ * See Licensing and Copyright notice in naev.h
+ */
+
+
+
+#ifndef SPATIAL_H
+#  define SPATIAL_H
+
+
+/**
+ * @brief Spatial hash grid for radius queries.
+ *
+ * Entries are added with spatial_add and become queryable after
+ *  spatial_build. Rebuilding is cheap so the index is meant to be rebuilt
+ *  whenever the objects move.
+ */
+typedef struct SpatialIndex_ {
+   double cell;      /**< Size of a grid cell. */
+   double maxrad;    /**< Largest radius of the entries. */
+
+   /* Entries. */
+   int n;            /**< Number of entries. */
+   int mentries;     /**< Memory allocated for entries. */
+   int *id;          /**< Identifier of each entry. */
+   double *x;        /**< X position of each entry. */
+   double *y;        /**< Y position of each entry. */
+   double *r;        /**< Radius of each entry. */
+   int *bucket;      /**< Bucket of each entry. */
+   int *mark;        /**< Last query that visited each entry. */
+
+   /* Buckets. */
+   int nbuckets;     /**< Number of buckets (power of two). */
+   int *start;       /**< Start of each bucket in sorted (nbuckets+1). */
+   int *sorted;      /**< Entries sorted by bucket. */
+
+   /* Query results. */
+   int stamp;        /**< Current query stamp. */
+   int *res;         /**< Results of the last query. */
+} SpatialIndex;
+
+
+void spatial_init( SpatialIndex *si, double cell );
+void spatial_free( SpatialIndex *si );
+void spatial_clear( SpatialIndex *si );
+void spatial_add( SpatialIndex *si, int id, double x, double y, double r );
+void spatial_build( SpatialIndex *si );
+int spatial_query( SpatialIndex *si, double x, double y, double r, const int **ids );
+
+
+#endif /* SPATIAL_H */
+
@@ -30,6 +30,8 @@
 #include "nxml.h"
 #include "debris.h"
 #include "perlin.h"
+#include "space.h"
+#include "camera.h"
 
 
 #define SPFX_XML_ID     "spfxs" /**< XML Document tag. */
@@ -39,6 +41,8 @@
 
 #define SPFX_CHUNK_MAX  16384 /**< Maximum chunk to alloc when needed */
 #define SPFX_CHUNK_MIN  256 /**< Minimum chunk to alloc when needed */
+#define SPFX_MAX        4096 /**< Maximum active effects per layer. */
+#define SPFX_CULL_SCAN  16 /**< Effects checked for replacement per add when a layer is full. */
 
 #define SHAKE_MASS      (1./400.) /** Shake mass. */
 #define SHAKE_K         (1./50.) /**< Constant for virtual spring. */
@@ -89,28 +93,31 @@ static int spfx_neffects = 0; /**< Total number of special effects. */
 
 
 /**
- * @struct SPFX
+ * @struct SPFX_Layer
  *
- * @brief An actual in-game active special effect.
+ * @brief The in-game active special effects of a layer.
+ *
+ * Stored as arrays of each field so the update loops run over contiguous
+ *  memory. Order is not kept, dead effects are replaced by the last one.
  */
-typedef struct SPFX_ {
-   Vector2d pos; /**< Current position. */
-   Vector2d vel; /**< Current velocity. */
-
-   int lastframe; /**< Needed when paused */
-   int effect; /**< The real effect */
+typedef struct SPFX_Layer_ {
+   int n; /**< Number of active effects. */
+   int m; /**< Memory allocated for effects. */
+   int cull; /**< Cull cursor, next effect to check for replacement when full. */
 
-   double timer; /**< Time left */
-} SPFX;
+   double *px; /**< Current X position. */
+   double *py; /**< Current Y position. */
+   double *vx; /**< Current X velocity. */
+   double *vy; /**< Current Y velocity. */
+   double *timer; /**< Time left */
+   int *effect; /**< The real effect */
+   int *lastframe; /**< Needed when paused */
+} SPFX_Layer;
 
 
-/* front stack is for effects on player, back is for the rest */
-static SPFX *spfx_stack_front = NULL; /**< Frontal special effect layer. */
-static int spfx_nstack_front = 0; /**< Number of special effects in front. */
-static int spfx_mstack_front = 0; /**< Memory allocated for frontal special effects. */
-static SPFX *spfx_stack_back = NULL; /**< Back special effect layer. */
-static int spfx_nstack_back = 0; /**< Number of special effects in back. */
-static int spfx_mstack_back = 0; /**< Memory allocated for special effects in back. */
+/* front layer is for effects on player, back is for the rest */
+static SPFX_Layer spfx_front; /**< Frontal special effect layer. */
+static SPFX_Layer spfx_back; /**< Back special effect layer. */
 
 
 /*
@@ -119,8 +126,12 @@ static int spfx_mstack_back = 0; /**< Memory allocated for special effects in ba
 /* General. */
 static int spfx_base_parse( SPFX_Base *temp, const xmlNodePtr parent );
 static void spfx_base_free( SPFX_Base *effect );
-static void spfx_destroy( SPFX *layer, int *nlayer, int spfx );
-static void spfx_update_layer( SPFX *layer, int *nlayer, const double dt );
+static SPFX_Layer* spfx_getLayer( int layer );
+static int spfx_onScreen( const SPFX_Base *effect, double px, double py );
+static int spfx_alloc( SPFX_Layer *l, const SPFX_Base *effect, double px, double py );
+static void spfx_destroy( SPFX_Layer *l, int spfx );
+static void spfx_freeLayer( SPFX_Layer *l );
+static void spfx_update_layer( SPFX_Layer *l, const double dt );
 /* Haptic. */
 static int spfx_hapticInit (void);
 static void spfx_hapticRumble( double mod );
@@ -290,12 +301,8 @@ void spfx_free (void)
 
    /* get rid of all the particles and free the stacks */
    spfx_clear();
-   if (spfx_stack_front) free(spfx_stack_front);
-   spfx_stack_front = NULL;
-   spfx_mstack_front = 0;
-   if (spfx_stack_back) free(spfx_stack_back);
-   spfx_stack_back = NULL;
-   spfx_mstack_back = 0;
+   spfx_freeLayer( &spfx_front );
+   spfx_freeLayer( &spfx_back );
 
    /* now clear the effects */
    for (i=0; i<spfx_neffects; i++)
@@ -309,6 +316,96 @@ void spfx_free (void)
 }
 
 
+/**
+ * @brief Gets a special effect layer.
+ *
+ *    @param layer Layer to get (SPFX_LAYER_FRONT or SPFX_LAYER_BACK).
+ *    @return The layer or NULL if invalid.
+ */
+static SPFX_Layer* spfx_getLayer( int layer )
+{
+   if (layer == SPFX_LAYER_FRONT)
+      return &spfx_front;
+   else if (layer == SPFX_LAYER_BACK)
+      return &spfx_back;
+   return NULL;
+}
+
+
+/**
+ * @brief Checks to see if an effect at a position would be visible.
+ */
+static int spfx_onScreen( const SPFX_Base *effect, double px, double py )
+{
+   double x, y, w, h, z;
+
+   z = cam_getZoom();
+   gl_gameToScreenCoords( &x, &y, px - effect->gfx->sw/2., py - effect->gfx->sh/2. );
+   w = effect->gfx->sw*z;
+   h = effect->gfx->sh*z;
+   return !((x < -w) || (x > SCREEN_W+w) || (y < -h) || (y > SCREEN_H+h));
+}
+
+
+/**
+ * @brief Gets a slot for a new effect in a layer.
+ *
+ * Once the layer is full, effects that are off-screen are the first to go,
+ *  then the ones closest to dying. New effects that would be off-screen are
+ *  dropped instead of replacing anything.
+ *
+ * Only SPFX_CULL_SCAN effects are checked per add, starting at the cull
+ *  cursor of the layer which then moves past them. Successive adds sweep
+ *  the whole layer while each one costs the same no matter how many
+ *  effects there are.
+ *
+ *    @param l Layer to get slot in.
+ *    @param effect Effect that will be added.
+ *    @param px X position of the new effect.
+ *    @param py Y position of the new effect.
+ *    @return Index of the slot or -1 if the effect should be dropped.
+ */
+static int spfx_alloc( SPFX_Layer *l, const SPFX_Base *effect, double px, double py )
+{
+   int i, j, best;
+
+   /* Still room. */
+   if (l->n < SPFX_MAX) {
+      if (l->m < l->n+1) { /* need more memory */
+         if (l->m == 0)
+            l->m = SPFX_CHUNK_MIN;
+         else
+            l->m += MIN( l->m, SPFX_CHUNK_MAX );
+         l->m         = MIN( l->m, SPFX_MAX );
+         l->px        = realloc( l->px,        l->m*sizeof(double) );
+         l->py        = realloc( l->py,        l->m*sizeof(double) );
+         l->vx        = realloc( l->vx,        l->m*sizeof(double) );
+         l->vy        = realloc( l->vy,        l->m*sizeof(double) );
+         l->timer     = realloc( l->timer,     l->m*sizeof(double) );
+         l->effect    = realloc( l->effect,    l->m*sizeof(int) );
+         l->lastframe = realloc( l->lastframe, l->m*sizeof(int) );
+      }
+      return l->n++;
+   }
+
+   /* Full, nobody will miss an effect they can't see. */
+   if (!spfx_onScreen( effect, px, py ))
+      return -1;
+
+   /* Replace the least important effect near the cull cursor. */
+   best = -1;
+   for (j=0; j<SPFX_CULL_SCAN; j++) {
+      i       = l->cull;
+      l->cull = (l->cull+1) % l->n;
+      if (!spfx_onScreen( &spfx_effects[ l->effect[i] ], l->px[i], l->py[i] ))
+         return i;
+      if ((best < 0) || (l->timer[i] < l->timer[best]))
+         best = i;
+   }
+   return best;
+}
+
+
 /**
  * @brief Creates a new special effect.
  *
@@ -324,7 +421,8 @@ void spfx_add( int effect,
       const double vx, const double vy,
       const int layer )
 {
-   SPFX *cur_spfx;
+   SPFX_Layer *l;
+   int i;
    double ttl, anim;
 
    if ((effect < 0) || (effect > spfx_neffects)) {
@@ -332,47 +430,36 @@ void spfx_add( int effect,
       return;
    }
 
+   /* Nobody will see effects while the system is being simulated. */
+   if (space_isSimulating())
+      return;
+
    /*
     * Select the Layer
     */
-   if (layer == SPFX_LAYER_FRONT) { /* front layer */
-      if (spfx_mstack_front < spfx_nstack_front+1) { /* need more memory */
-         if (spfx_mstack_front == 0)
-            spfx_mstack_front = SPFX_CHUNK_MIN;
-         else
-            spfx_mstack_front += MIN( spfx_mstack_front, SPFX_CHUNK_MAX );
-         spfx_stack_front = realloc( spfx_stack_front, spfx_mstack_front*sizeof(SPFX) );
-      }
-      cur_spfx = &spfx_stack_front[spfx_nstack_front];
-      spfx_nstack_front++;
-   }
-   else if (layer == SPFX_LAYER_BACK) { /* back layer */
-      if (spfx_mstack_back < spfx_nstack_back+1) { /* need more memory */
-         if (spfx_mstack_back == 0)
-            spfx_mstack_back = SPFX_CHUNK_MIN;
-         else
-            spfx_mstack_back += MIN( spfx_mstack_back, SPFX_CHUNK_MAX );
-         spfx_stack_back = realloc( spfx_stack_back, spfx_mstack_back*sizeof(SPFX) );
-      }
-      cur_spfx = &spfx_stack_back[spfx_nstack_back];
-      spfx_nstack_back++;
-   }
-   else {
+   l = spfx_getLayer( layer );
+   if (l == NULL) {
       WARN("Invalid SPFX layer.");
       return;
    }
+   i = spfx_alloc( l, &spfx_effects[effect], px, py );
+   if (i < 0)
+      return;
 
    /* The actual adding of the spfx */
-   cur_spfx->effect = effect;
-   vect_csetmin( &cur_spfx->pos, px, py );
-   vect_csetmin( &cur_spfx->vel, vx, vy );
+   l->effect[i]    = effect;
+   l->px[i]        = px;
+   l->py[i]        = py;
+   l->vx[i]        = vx;
+   l->vy[i]        = vy;
+   l->lastframe[i] = 0;
    /* Timer magic if ttl != anim */
    ttl = spfx_effects[effect].ttl;
    anim = spfx_effects[effect].anim;
    if (ttl != anim)
-      cur_spfx->timer = ttl + RNGF()*anim;
+      l->timer[i] = ttl + RNGF()*anim;
    else
-      cur_spfx->timer = ttl;
+      l->timer[i] = ttl;
 }
 
 
@@ -381,15 +468,11 @@ void spfx_add( int effect,
  */
 void spfx_clear (void)
 {
-   int i;
-
-   /* Clear front layer */
-   for (i=spfx_nstack_front-1; i>=0; i--)
-      spfx_destroy( spfx_stack_front, &spfx_nstack_front, i );
-
-   /* Clear back layer */
-   for (i=spfx_nstack_back-1; i>=0; i--)
-      spfx_destroy( spfx_stack_back, &spfx_nstack_back, i );
+   /* Clear layers, memory is kept. */
+   spfx_front.n    = 0;
+   spfx_back.n     = 0;
+   spfx_front.cull = 0;
+   spfx_back.cull  = 0;
 
    /* Clear rumble */
    shake_set = 0;
@@ -400,16 +483,43 @@ void spfx_clear (void)
 }
 
 /**
- * @brief Destroys an active spfx.
+ * @brief Destroys an active spfx by moving the last one into its place.
  *
- *    @param layer Layer the spfx is on.
- *    @param nlayer Pointer to the number of elements in the layer.
- *    @param spfx Position of the spfx in the stack.
+ *    @param l Layer the spfx is on.
+ *    @param spfx Position of the spfx in the layer.
  */
-static void spfx_destroy( SPFX *layer, int *nlayer, int spfx )
+static void spfx_destroy( SPFX_Layer *l, int spfx )
 {
-   (*nlayer)--;
-   memmove( &layer[spfx], &layer[spfx+1], (*nlayer-spfx)*sizeof(SPFX) );
+   int last;
+
+   last = --l->n;
+   if (spfx == last)
+      return;
+   l->px[spfx]        = l->px[last];
+   l->py[spfx]        = l->py[last];
+   l->vx[spfx]        = l->vx[last];
+   l->vy[spfx]        = l->vy[last];
+   l->timer[spfx]     = l->timer[last];
+   l->effect[spfx]    = l->effect[last];
+   l->lastframe[spfx] = l->lastframe[last];
+}
+
+
+/**
+ * @brief Frees the memory of a layer.
+ *
+ *    @param l Layer to free.
+ */
+static void spfx_freeLayer( SPFX_Layer *l )
+{
+   free( l->px );
+   free( l->py );
+   free( l->vx );
+   free( l->vy );
+   free( l->timer );
+   free( l->effect );
+   free( l->lastframe );
+   memset( l, 0, sizeof(SPFX_Layer) );
 }
 
 
@@ -420,35 +530,40 @@ static void spfx_destroy( SPFX *layer, int *nlayer, int spfx )
  */
 void spfx_update( const double dt )
 {
-   spfx_update_layer( spfx_stack_front, &spfx_nstack_front, dt );
-   spfx_update_layer( spfx_stack_back, &spfx_nstack_back, dt );
+   spfx_update_layer( &spfx_front, dt );
+   spfx_update_layer( &spfx_back, dt );
 }
 
 
 /**
- * @brief Updates an individual spfx.
+ * @brief Updates an individual spfx layer.
  *
- *    @param layer Layer the spfx is on.
- *    @param nlayer Pointer to the associated nlayer.
+ *    @param l Layer to update.
  *    @param dt Current delta tick.
  */
-static void spfx_update_layer( SPFX *layer, int *nlayer, const double dt )
+static void spfx_update_layer( SPFX_Layer *l, const double dt )
 {
-   int i;
-
-   for (i=0; i<*nlayer; i++) {
-      layer[i].timer -= dt; /* less time to live */
-
-      /* time to die! */
-      if (layer[i].timer < 0.) {
-         spfx_destroy( layer, nlayer, i );
-         i--;
-         continue;
-      }
-
-      /* actually update it */
-      vect_cadd( &layer[i].pos, dt*VX(layer[i].vel), dt*VY(layer[i].vel) );
+   int i, n;
+   double *px, *py, *timer;
+   const double *vx, *vy;
+
+   /* Straight loops over the arrays so the compiler can vectorize them. */
+   n     = l->n;
+   px    = l->px;
+   py    = l->py;
+   vx    = l->vx;
+   vy    = l->vy;
+   timer = l->timer;
+   for (i=0; i<n; i++) {
+      timer[i] -= dt; /* less time to live */
+      px[i]    += dt*vx[i];
+      py[i]    += dt*vy[i];
    }
+
+   /* time to die! */
+   for (i=l->n-1; i>=0; i--)
+      if (l->timer[i] < 0.)
+         spfx_destroy( l, i );
 }
 
 
@@ -706,49 +821,38 @@ void spfx_cinematic (void)
  */
 void spfx_render( const int layer )
 {
-   SPFX *spfx_stack;
-   int i, spfx_nstack;
+   SPFX_Layer *l;
+   int i;
    SPFX_Base *effect;
    int sx, sy;
    double time;
 
 
    /* get the appropriate layer */
-   switch (layer) {
-      case SPFX_LAYER_FRONT:
-         spfx_stack = spfx_stack_front;
-         spfx_nstack = spfx_nstack_front;
-         break;
-
-      case SPFX_LAYER_BACK:
-         spfx_stack = spfx_stack_back;
-         spfx_nstack = spfx_nstack_back;
-         break;
-
-      default:
-         WARN("Rendering invalid SPFX layer.");
-         return;
+   l = spfx_getLayer( layer );
+   if (l == NULL) {
+      WARN("Rendering invalid SPFX layer.");
+      return;
    }
 
    /* Now render the layer */
-   for (i=spfx_nstack-1; i>=0; i--) {
-      effect = &spfx_effects[ spfx_stack[i].effect ];
+   gl_batchBegin();
+   for (i=l->n-1; i>=0; i--) {
+      effect = &spfx_effects[ l->effect[i] ];
 
       /* Simplifies */
       sx = (int)effect->gfx->sx;
       sy = (int)effect->gfx->sy;
 
       if (!paused) { /* don't calculate frame if paused */
-         time = 1. - fmod(spfx_stack[i].timer,effect->anim) / effect->anim;
-         spfx_stack[i].lastframe = sx * sy * MIN(time, 1.);
+         time = 1. - fmod(l->timer[i],effect->anim) / effect->anim;
+         l->lastframe[i] = sx * sy * MIN(time, 1.);
       }
 
       /* Renders */
-      gl_blitSprite( effect->gfx,
-            VX(spfx_stack[i].pos), VY(spfx_stack[i].pos),
-            spfx_stack[i].lastframe % sx,
-            spfx_stack[i].lastframe / sx,
-            NULL );
+      gl_blitSprite( effect->gfx, l->px[i], l->py[i],
+            l->lastframe[i] % sx, l->lastframe[i] / sx, NULL );
    }
+   gl_batchEnd();
 }
 
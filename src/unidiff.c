@@ -10,6 +10,10 @@
  * Diffs allow changing planets, fleets, factions, etc... in the universe.
  *  These are meant to be applied after the player triggers them, mostly
  *  through missions.
+ *
+ * The diff data file is parsed once into an index sorted by name. Diffs can
+ *  be applied in batches so the presences, map overlay and economy are only
+ *  updated once at the end instead of once per diff.
  */
 
 
@@ -117,6 +121,33 @@ typedef struct UniDiff_ {
 } UniDiff_t;
 
 
+/**
+ * @struct UniDiffData_t
+ *
+ * @brief A diff available in the data file.
+ */
+typedef struct UniDiffData_ {
+   char *name; /**< Name of the diff. */
+   xmlNodePtr node; /**< Node of the diff. */
+   int pos; /**< Position in the data file. */
+} UniDiffData_t;
+
+
+/*
+ * Available diffs.
+ */
+static xmlDocPtr diff_doc = NULL; /**< Parsed diff data file. */
+static UniDiffData_t *diff_available = NULL; /**< Diffs sorted by name. */
+static int diff_navailable = 0; /**< Number of available diffs. */
+
+
+/*
+ * Batching.
+ */
+static int diff_batch = 0; /**< Depth of the current batch. */
+static int diff_univ_update = 0; /**< Presences need to be reconstructed. */
+
+
 /*
  * Diff stack.
  */
@@ -129,6 +160,13 @@ static int diff_mstack = 0; /**< Currently allocated diffs. */
  * Prototypes.
  */
 static UniDiff_t* diff_get( const char *name );
+static int diff_cmpData( const void *p1, const void *p2 );
+static int diff_cmpNames( const void *p1, const void *p2 );
+static int diff_loadAvailable (void);
+static UniDiffData_t* diff_getData( const char *name );
+static void diff_batchStart (void);
+static void diff_batchEnd (void);
+static int diff_applyData( const char *name );
 static UniDiff_t *diff_newDiff (void);
 static int diff_removeDiff( UniDiff_t *diff );
 static int diff_patchSystem( UniDiff_t *diff, xmlNodePtr node );
@@ -175,65 +213,245 @@ static UniDiff_t* diff_get( const char *name )
 
 
 /**
- * @brief Applies a diff to the universe.
+ * @brief Compares two available diffs by name and position.
+ */
+static int diff_cmpData( const void *p1, const void *p2 )
+{
+   const UniDiffData_t *d1, *d2;
+   int ret;
+
+   d1  = (const UniDiffData_t*) p1;
+   d2  = (const UniDiffData_t*) p2;
+   ret = strcmp( d1->name, d2->name );
+   if (ret != 0)
+      return ret;
+   return d1->pos - d2->pos;
+}
+
+
+/**
+ * @brief Compares two available diffs by name only.
+ */
+static int diff_cmpNames( const void *p1, const void *p2 )
+{
+   return strcmp( ((const UniDiffData_t*)p1)->name,
+         ((const UniDiffData_t*)p2)->name );
+}
+
+
+/**
+ * @brief Parses the diff data file into the index of available diffs.
  *
- *    @param name Diff to apply.
  *    @return 0 on success.
  */
-int diff_apply( const char *name )
+static int diff_loadAvailable (void)
 {
    xmlNodePtr node;
-   xmlDocPtr doc;
    uint32_t bufsize;
    char *buf;
-   char *diffname;
-
-   /* Check if already applied. */
-   if (diff_isApplied(name))
-      return 0;
+   int i, j, m;
 
    buf = ndata_read( DIFF_DATA_PATH, &bufsize );
-   doc = xmlParseMemory( buf, bufsize );
+   if (buf == NULL) {
+      WARN("Unable to read "DIFF_DATA_PATH".");
+      return -1;
+   }
+   diff_doc = xmlParseMemory( buf, bufsize );
+   free(buf);
+   if (diff_doc == NULL) {
+      WARN("Unable to parse "DIFF_DATA_PATH".");
+      return -1;
+   }
 
-   node = doc->xmlChildrenNode;
+   node = diff_doc->xmlChildrenNode;
    if (strcmp((char*)node->name,"unidiffs")) {
       ERR("Malformed unidiff file: missing root element 'unidiffs'");
-      return 0;
+      return -1;
    }
 
    node = node->xmlChildrenNode; /* first system node */
    if (node == NULL) {
       ERR("Malformed unidiff file: does not contain elements");
-      return 0;
+      return -1;
    }
 
+   /* Index the diffs. */
+   m = 0;
    do {
-      if (xml_isNode(node,"unidiff")) {
-         /* Check to see if it's the diff we're looking for. */
-         xmlr_attr(node,"name",diffname);
-         if (strcmp(diffname,name)==0) {
-            /* Apply it. */
-            diff_patch( node );
-
-            /* Clean up. */
-            free(diffname);
-            xmlFreeDoc(doc);
-            free(buf);
-
-            economy_execQueued();
+      if (!xml_isNode(node,"unidiff"))
+         continue;
 
-            return 0;
-         }
-         free(diffname);
+      if (diff_navailable >= m) {
+         m = (m == 0) ? CHUNK_SIZE : 2*m;
+         diff_available = realloc( diff_available, m * sizeof(UniDiffData_t) );
       }
+      xmlr_attr( node, "name", diff_available[diff_navailable].name );
+      if (diff_available[diff_navailable].name == NULL) {
+         WARN("Unidiff in "DIFF_DATA_PATH" has no 'name' attribute.");
+         continue;
+      }
+      diff_available[diff_navailable].node = node;
+      diff_available[diff_navailable].pos  = diff_navailable;
+      diff_navailable++;
    } while (xml_nextNode(node));
 
-   /* More clean up. */
-   xmlFreeDoc(doc);
-   free(buf);
+   /* Sort by name, only the first of duplicates is kept like before. */
+   qsort( diff_available, diff_navailable, sizeof(UniDiffData_t), diff_cmpData );
+   j = 0;
+   for (i=0; i<diff_navailable; i++) {
+      if ((j > 0) && (strcmp(diff_available[j-1].name, diff_available[i].name)==0)) {
+         WARN("UniDiff '%s' is defined multiple times in "DIFF_DATA_PATH".",
+               diff_available[i].name);
+         free( diff_available[i].name );
+         continue;
+      }
+      diff_available[j++] = diff_available[i];
+   }
+   diff_navailable = j;
 
-   WARN("UniDiff '%s' not found in "DIFF_DATA_PATH".", name);
-   return -1;
+   return 0;
+}
+
+
+/**
+ * @brief Gets an available diff by name.
+ *
+ *    @param name Name of the diff to get.
+ *    @return The diff data or NULL if not found.
+ */
+static UniDiffData_t* diff_getData( const char *name )
+{
+   UniDiffData_t key;
+
+   /* Parse the data the first time it's needed. */
+   if (diff_doc == NULL)
+      if (diff_loadAvailable() < 0)
+         return NULL;
+
+   key.name = (char*)name;
+   return bsearch( &key, diff_available, diff_navailable,
+         sizeof(UniDiffData_t), diff_cmpNames );
+}
+
+
+/**
+ * @brief Starts a batch of diff changes.
+ *
+ * Universe wide updates are postponed until the matching diff_batchEnd.
+ */
+static void diff_batchStart (void)
+{
+   diff_batch++;
+}
+
+
+/**
+ * @brief Ends a batch of diff changes, updating the universe if needed.
+ */
+static void diff_batchEnd (void)
+{
+   diff_batch--;
+   if (diff_batch > 0)
+      return;
+
+   /* Prune presences if necessary. */
+   if (diff_univ_update)
+      space_reconstructPresences();
+   diff_univ_update = 0;
+
+   /* Update overlay map just in case. */
+   ovr_refresh();
+
+   economy_execQueued();
+}
+
+
+/**
+ * @brief Applies a diff without updating the universe.
+ *
+ *    @param name Diff to apply.
+ *    @return 0 on success.
+ */
+static int diff_applyData( const char *name )
+{
+   UniDiffData_t *data;
+
+   /* Check if already applied. */
+   if (diff_isApplied(name))
+      return 0;
+
+   data = diff_getData( name );
+   if (data == NULL) {
+      WARN("UniDiff '%s' not found in "DIFF_DATA_PATH".", name);
+      return -1;
+   }
+
+   return diff_patch( data->node );
+}
+
+
+/**
+ * @brief Applies a diff to the universe.
+ *
+ *    @param name Diff to apply.
+ *    @return 0 on success.
+ */
+int diff_apply( const char *name )
+{
+   int ret;
+
+   /* Check if already applied. */
+   if (diff_isApplied(name))
+      return 0;
+
+   diff_batchStart();
+   ret = diff_applyData( name );
+   diff_batchEnd();
+
+   return ret;
+}
+
+
+/**
+ * @brief Applies many diffs to the universe at once.
+ *
+ * The universe is only updated once after all the diffs are applied.
+ *
+ *    @param names Diffs to apply.
+ *    @param n Number of diffs to apply.
+ *    @return 0 on success.
+ */
+int diff_applyList( const char **names, int n )
+{
+   int i, ret;
+
+   ret = 0;
+   diff_batchStart();
+   for (i=0; i<n; i++)
+      if (diff_applyData( names[i] ) < 0)
+         ret = -1;
+   diff_batchEnd();
+
+   return ret;
+}
+
+
+/**
+ * @brief Frees the parsed diff data.
+ */
+void diff_free (void)
+{
+   int i;
+
+   for (i=0; i<diff_navailable; i++)
+      free( diff_available[i].name );
+   free( diff_available );
+   diff_available  = NULL;
+   diff_navailable = 0;
+
+   if (diff_doc != NULL)
+      xmlFreeDoc( diff_doc );
+   diff_doc = NULL;
 }
 
 
@@ -461,12 +679,14 @@ static int diff_patchAsset( UniDiff_t *diff, xmlNodePtr node )
 /**
  * @brief Actually applies a diff in XML node form.
  *
+ * Must be called inside a batch which updates the universe when done.
+ *
  *    @param parent Node containing the diff information.
  *    @return 0 on success.
  */
 static int diff_patch( xmlNodePtr parent )
 {
-   int i, univ_update;
+   int i;
    UniDiff_t *diff;
    UniHunk_t *fail;
    xmlNodePtr node;
@@ -477,20 +697,17 @@ static int diff_patch( xmlNodePtr parent )
    memset(diff, 0, sizeof(UniDiff_t));
    xmlr_attr(parent,"name",diff->name);
 
-   /* Whether or not we need to update the universe. */
-   univ_update = 0;
-
    node = parent->xmlChildrenNode;
    do {
       xml_onlyNodes(node);
       if (xml_isNode(node,"system")) {
-         univ_update = 1;
+         diff_univ_update = 1;
          diff_patchSystem( diff, node );
       }
       else if (xml_isNode(node, "tech"))
          diff_patchTech( diff, node );
       else if (xml_isNode(node, "asset")) {
-         univ_update = 1;
+         diff_univ_update = 1;
          diff_patchAsset( diff, node );
       }
       else
@@ -545,12 +762,6 @@ static int diff_patch( xmlNodePtr parent )
       }
    }
 
-   /* Prune presences if necessary. */
-   if (univ_update)
-      space_reconstructPresences();
-
-   /* Update overlay map just in case. */
-   ovr_refresh();
    return 0;
 }
 
@@ -867,20 +1078,35 @@ int diff_save( xmlTextWriterPtr writer )
 int diff_load( xmlNodePtr parent )
 {
    xmlNodePtr node, cur;
+   const char **names;
+   int n, m;
 
    diff_clear();
 
-   node = parent->xmlChildrenNode;
+   /* Gather the diffs. */
+   names = NULL;
+   n     = 0;
+   m     = 0;
+   node  = parent->xmlChildrenNode;
    do {
       if (xml_isNode(node,"diffs")) {
          cur = node->xmlChildrenNode;
          do {
-            if (xml_isNode(cur,"diff"))
-               diff_apply( xml_get(cur) );
+            if (!xml_isNode(cur,"diff") || (xml_get(cur) == NULL))
+               continue;
+            if (n >= m) {
+               m    += CHUNK_SIZE;
+               names = realloc( names, m * sizeof(char*) );
+            }
+            names[n++] = xml_get(cur);
          } while (xml_nextNode(cur));
       }
    } while (xml_nextNode(node));
 
+   /* Apply them all at once. */
+   diff_applyList( names, n );
+   free( names );
+
    return 0;
 
 }
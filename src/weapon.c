@@ -32,12 +32,14 @@
 #include "camera.h"
 #include "ai.h"
 #include "ai_extra.h"
+#include "spatial.h"
 
 
 #define weapon_isSmart(w)     (w->think != NULL) /**< Checks if the weapon w is smart. */
 
 #define WEAPON_CHUNK_MAX      16384 /**< Maximum size to increase array with */
 #define WEAPON_CHUNK_MIN      256 /**< Minimum size to increase array with */
+#define WEAPON_SPATIAL_CELL   512. /**< Cell size of the weapon spatial index. */
 
 /* Weapon status */
 #define WEAPON_STATUS_OK         0 /**< Weapon is fine */
@@ -58,8 +60,10 @@ extern int pilot_nstack;
  * @brief In-game representation of a weapon.
  */
 typedef struct Weapon_ {
-   Solid *solid; /**< Actually has its own solid :) */
+   Solid *solid; /**< Actually has its own solid :), points to solid_mem. */
+   Solid solid_mem; /**< Storage for the solid, allocated with the weapon. */
    unsigned int ID; /**< Only used for beam weapons. */
+   int idx; /**< Position in the weapon layer. */
 
    int faction; /**< faction of pilot that shot it */
    unsigned int parent; /**< pilot that shot it */
@@ -103,6 +107,23 @@ static gl_vbo  *weapon_vbo     = NULL; /**< Weapon VBO. */
 static GLfloat *weapon_vboData = NULL; /**< Data of weapon VBO. */
 static int weapon_vboSize      = 0; /**< Size of the VBO. */
 
+/* Weapon pool. */
+static Weapon **weapon_blocks = NULL; /**< Blocks of preallocated weapons. */
+static int weapon_nblocks     = 0; /**< Number of weapon blocks. */
+static Weapon **weapon_pool   = NULL; /**< Weapons available for use. */
+static int weapon_npool       = 0; /**< Number of weapons available. */
+static int weapon_nmallocs    = 0; /**< Total allocations done by the weapon pool. */
+
+/* Physics. */
+static Solid **weapon_solids  = NULL; /**< Solids of a layer to update in one batch. */
+static int weapon_msolids     = 0; /**< Memory allocated for weapon_solids. */
+
+/* Spatial index, one per layer. */
+static SpatialIndex weapon_spatial[2]; /**< Spatial index of the weapons of each layer. */
+static Weapon **weapon_spatialW[2]   = { NULL, NULL }; /**< Weapons indexed at build time. */
+static int weapon_mspatialW[2]       = { 0, 0 }; /**< Memory allocated for weapon_spatialW. */
+static int weapon_spatialDirty[2]    = { 1, 1 }; /**< Spatial index must be rebuilt. */
+
 
 /* Internal stuff. */
 static unsigned int beam_idgen = 0; /**< Beam identifier generator. */
@@ -112,6 +133,8 @@ static unsigned int beam_idgen = 0; /**< Beam identifier generator. */
  * Prototypes
  */
 /* Creation. */
+static Weapon* weapon_alloc (void);
+static void weapon_layerAppend( Weapon **wlayer, int *nlayer, Weapon *w );
 static double weapon_aimTurret( Weapon *w, const Outfit *outfit, const Pilot *parent,
       const Pilot *pilot_target, const Vector2d *pos, const Vector2d *vel, double dir,
       double swivel );
@@ -125,6 +148,7 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
 /* Updating. */
 static void weapon_render( Weapon* w, const double dt );
 static void weapons_updateLayer( const double dt, const WeaponLayer layer );
+static void weapons_moveLayer( const double dt, const WeaponLayer layer );
 static void weapon_update( Weapon* w, const double dt, WeaponLayer layer );
 /* Destruction. */
 static void weapon_destroy( Weapon* w, WeaponLayer layer );
@@ -132,6 +156,9 @@ static void weapon_free( Weapon* w );
 static void weapon_explodeLayer( WeaponLayer layer,
       double x, double y, double radius,
       const Pilot *parent, int mode );
+/* Spatial queries. */
+static int weapon_getInRadius( WeaponLayer layer, double x, double y, double r,
+      Weapon ***weapons, int *mweapons );
 /* Hitting. */
 static int weapon_checkCanHit( Weapon* w, Pilot *p );
 static void weapon_hit( Weapon* w, Pilot* p, WeaponLayer layer, Vector2d* pos );
@@ -459,10 +486,10 @@ void weapons_update( const double dt )
  */
 static void weapons_updateLayer( const double dt, const WeaponLayer layer )
 {
-   Weapon **wlayer;
+   Weapon **wlayer, **wlist;
    int *nlayer;
    Weapon *w;
-   int i, j, k;
+   int i, j, k, n, mlist;
    int spfx;
    int s;
    Pilot *p;
@@ -484,7 +511,6 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
          return;
    }
 
-   /** @TODO optimize me plz. */
    /* Reset jam power. */
    for (k=0; k < *nlayer; k++) {
       w = wlayer[k];
@@ -493,6 +519,8 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
       w->jam_power = 0.;
    }
    /* Iterate over all pilots. */
+   wlist = NULL;
+   mlist = 0;
    for (i=0; i<pilot_nstack; i++) {
       p = pilot_stack[i];
 
@@ -512,9 +540,16 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
          if (!outfit_isJammer(o))
             continue;
     
-         /* Apply jamming. */
-         for (k=0; k < *nlayer; k++) {
-            w = wlayer[k];
+         /* Apply jamming, only to weapons that can be in range. */
+         n = weapon_getInRadius( layer, p->solid->pos.x, p->solid->pos.y,
+               sqrt(o->u.jam.range2), &wlist, &mlist );
+         for (k=0; k < n; k++) {
+            w = wlist[k];
+
+            /* Might have been destroyed since the index was built. */
+            if ((w->idx >= *nlayer) || (wlayer[ w->idx ] != w))
+               continue;
+
             if (!outfit_isSeeker( w->outfit ))
                continue;
 
@@ -527,6 +562,7 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
          }
       }
    }
+   free(wlist);
 
    i = 0;
    while (i < *nlayer) {
@@ -633,6 +669,61 @@ static void weapons_updateLayer( const double dt, const WeaponLayer layer )
             i++;
       }
    }
+
+   /* Move the weapons that survived. */
+   weapons_moveLayer( dt, layer );
+}
+
+
+/**
+ * @brief Updates the positions of all the weapons in a layer in one batch.
+ *
+ *    @param dt Current delta tick.
+ *    @param layer Layer to move.
+ */
+static void weapons_moveLayer( const double dt, const WeaponLayer layer )
+{
+   Weapon **wlayer;
+   int nlayer;
+   Weapon *w;
+   int i;
+
+   /* Layer may have been reallocated while updating. */
+   switch (layer) {
+      case WEAPON_LAYER_BG:
+         wlayer = wbackLayer;
+         nlayer = nwbackLayer;
+         break;
+      case WEAPON_LAYER_FG:
+         wlayer = wfrontLayer;
+         nlayer = nwfrontLayer;
+         break;
+
+      default:
+         WARN("Unknown weapon layer!");
+         return;
+   }
+   weapon_spatialDirty[layer] = 1;
+   if (nlayer <= 0)
+      return;
+
+   /* Gather the solids, they live inside the pooled weapons. */
+   if (nlayer > weapon_msolids) {
+      weapon_msolids = MAX( nlayer, 2*weapon_msolids );
+      weapon_solids  = realloc( weapon_solids, weapon_msolids * sizeof(Solid*) );
+   }
+   for (i=0; i<nlayer; i++)
+      weapon_solids[i] = wlayer[i]->solid;
+
+   /* Update the solid positions. */
+   solid_updateBatch( weapon_solids, nlayer, dt );
+
+   /* Update the sound. */
+   for (i=0; i<nlayer; i++) {
+      w = wlayer[i];
+      sound_updatePos(w->voice, w->solid->pos.x, w->solid->pos.y,
+            w->solid->vel.x, w->solid->vel.y);
+   }
 }
 
 
@@ -663,8 +754,10 @@ void weapons_render( const WeaponLayer layer, const double dt )
          return;
    }
 
+   gl_batchBegin();
    for (i=0; i<(*nlayer); i++)
       weapon_render( wlayer[i], dt );
+   gl_batchEnd();
 }
 
 
@@ -739,6 +832,9 @@ static void weapon_render( Weapon* w, const double dt )
          x = (w->solid->pos.x - cx)*z + gx;
          y = (w->solid->pos.y - cy)*z + gy;
 
+         /* Beams are drawn directly, sprites before them go first. */
+         gl_batchFlush();
+
          /* Set up the matrix. */
          glPushMatrix();
             glTranslated( SCREEN_W/2.+x, SCREEN_H/2.+y, 0. );
@@ -959,12 +1055,7 @@ static void weapon_update( Weapon* w, const double dt, WeaponLayer layer )
    if (weapon_isSmart(w))
       (*w->think)(w,dt);
 
-   /* Update the solid position. */
-   (*w->solid->update)(w->solid, dt);
-
-   /* Update the sound. */
-   sound_updatePos(w->voice, w->solid->pos.x, w->solid->pos.y,
-         w->solid->vel.x, w->solid->vel.y);
+   /* Solid position and sound get updated in weapons_moveLayer. */
 }
 
 
@@ -1281,7 +1372,7 @@ static void weapon_createBolt( Weapon *w, const Outfit* outfit, double T,
    vect_cadd( &v, outfit->u.blt.speed*cos(rdir), outfit->u.blt.speed*sin(rdir));
    w->timer = outfit->u.blt.range / outfit->u.blt.speed;
    w->falloff = w->timer - outfit->u.blt.falloff / outfit->u.blt.speed;
-   w->solid = solid_create( mass, rdir, pos, &v, SOLID_UPDATE_EULER );
+   solid_init( w->solid, mass, rdir, pos, &v, SOLID_UPDATE_EULER );
    w->voice = sound_playPos( w->outfit->u.blt.sound,
          w->solid->pos.x,
          w->solid->pos.y,
@@ -1345,7 +1436,7 @@ static void weapon_createAmmo( Weapon *w, const Outfit* launcher, double T,
    /* Set up ammo details. */
    mass        = w->outfit->mass;
    w->timer    = ammo->u.amm.duration;
-   w->solid    = solid_create( mass, rdir, pos, &v, SOLID_UPDATE_RK4 );
+   solid_init( w->solid, mass, rdir, pos, &v, SOLID_UPDATE_RK4 );
    if (w->outfit->u.amm.thrust != 0.) {
       weapon_setThrust( w, w->outfit->u.amm.thrust * mass );
       w->solid->speed_max = w->outfit->u.amm.speed; /* Limit speed, we only care if it has thrust. */
@@ -1375,6 +1466,70 @@ static void weapon_createAmmo( Weapon *w, const Outfit* launcher, double T,
 }
 
 
+/**
+ * @brief Gets an unused weapon from the pool, growing it if necessary.
+ *
+ *    @return A weapon ready to be initialized.
+ */
+static Weapon* weapon_alloc (void)
+{
+   int i;
+   Weapon *block;
+
+   if (weapon_npool <= 0) {
+      block = malloc( WEAPON_CHUNK_MIN * sizeof(Weapon) );
+      if (block == NULL)
+         ERR("Out of Memory");
+      weapon_blocks = realloc( weapon_blocks, (weapon_nblocks+1) * sizeof(Weapon*) );
+      weapon_blocks[ weapon_nblocks++ ] = block;
+      weapon_pool   = realloc( weapon_pool,
+            weapon_nblocks * WEAPON_CHUNK_MIN * sizeof(Weapon*) );
+      weapon_nmallocs += 3;
+
+      /* Add in reverse so they get handed out in memory order. */
+      for (i=WEAPON_CHUNK_MIN-1; i>=0; i--)
+         weapon_pool[ weapon_npool++ ] = &block[i];
+   }
+
+   return weapon_pool[ --weapon_npool ];
+}
+
+
+/**
+ * @brief Appends a weapon to a layer that has enough memory for it.
+ *
+ *    @param wlayer Layer to append to.
+ *    @param nlayer Number of weapons in the layer.
+ *    @param w Weapon to append.
+ */
+static void weapon_layerAppend( Weapon **wlayer, int *nlayer, Weapon *w )
+{
+   w->idx = *nlayer;
+   wlayer[ (*nlayer)++ ] = w;
+   weapon_spatialDirty[0] = 1;
+   weapon_spatialDirty[1] = 1;
+}
+
+
+/**
+ * @brief Gets the weapon allocation statistics.
+ *
+ * Once the pool has warmed up the number of allocations should stay
+ *  constant no matter how many weapons are fired.
+ *
+ *    @param[out] nused Number of weapons in use.
+ *    @param[out] nalloced Number of weapons the pool holds.
+ *    @param[out] nmallocs Total number of allocations done by the pool and
+ *                layers since startup.
+ */
+void weapon_allocStats( int *nused, int *nalloced, int *nmallocs )
+{
+   *nalloced = weapon_nblocks * WEAPON_CHUNK_MIN;
+   *nused    = *nalloced - weapon_npool;
+   *nmallocs = weapon_nmallocs;
+}
+
+
 /**
  * @brief Creates a new weapon.
  *
@@ -1396,7 +1551,9 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
    Weapon* w;
 
    /* Create basic features */
-   w           = calloc( 1, sizeof(Weapon) );
+   w           = weapon_alloc();
+   memset( w, 0, sizeof(Weapon) );
+   w->solid    = &w->solid_mem;
    w->dam_mod  = 1.; /* Default of 100% damage. */
    w->faction  = parent->faction; /* non-changeable */
    w->parent   = parent->id; /* non-changeable */
@@ -1432,7 +1589,7 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
          else if (rdir >= 2.*M_PI)
             rdir -= 2.*M_PI;
          mass = 1.; /**< Needs a mass. */
-         w->solid = solid_create( mass, rdir, pos, vel, SOLID_UPDATE_EULER );
+         solid_init( w->solid, mass, rdir, pos, vel, SOLID_UPDATE_EULER );
          w->think = think_beam;
          w->timer = outfit->u.bem.duration;
          w->voice = sound_playPos( w->outfit->u.bem.sound,
@@ -1452,7 +1609,7 @@ static Weapon* weapon_create( const Outfit* outfit, double T,
       default:
          WARN("Weapon of type '%s' has no create implemented yet!",
                w->outfit->name);
-         w->solid = solid_create( 1., dir, pos, vel, SOLID_UPDATE_EULER );
+         solid_init( w->solid, 1., dir, pos, vel, SOLID_UPDATE_EULER );
          break;
    }
 
@@ -1511,7 +1668,7 @@ void weapon_add( const Outfit* outfit, const double T, const double dir,
    }
 
    if (*mLayer > *nLayer) /* more memory alloced than needed */
-      curLayer[(*nLayer)++] = w;
+      weapon_layerAppend( curLayer, nLayer, w );
    else { /* need to allocate more memory */
       if ((*mLayer) == 0)
          (*mLayer) = WEAPON_CHUNK_MIN;
@@ -1526,9 +1683,10 @@ void weapon_add( const Outfit* outfit, const double T, const double dir,
             curLayer   = wfrontLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
             break;
       }
-      curLayer[(*nLayer)++] = w;
+      weapon_layerAppend( curLayer, nLayer, w );
 
       /* Grow the vertex stuff. */
+      weapon_nmallocs += 2;
       weapon_vboSize = mwfrontLayer + mwbacklayer;
       size = sizeof(GLfloat) * (2+4) * weapon_vboSize;
       weapon_vboData = realloc( weapon_vboData, size );
@@ -1594,7 +1752,7 @@ unsigned int beam_start( const Outfit* outfit,
    }
 
    if (*mLayer > *nLayer) /* more memory alloced than needed */
-      curLayer[(*nLayer)++] = w;
+      weapon_layerAppend( curLayer, nLayer, w );
    else { /* need to allocate more memory */
       if ((*mLayer) == 0)
          (*mLayer) = WEAPON_CHUNK_MIN;
@@ -1609,9 +1767,10 @@ unsigned int beam_start( const Outfit* outfit,
             curLayer = wfrontLayer = realloc(curLayer, (*mLayer)*sizeof(Weapon*));
             break;
       }
-      curLayer[(*nLayer)++] = w;
+      weapon_layerAppend( curLayer, nLayer, w );
 
       /* Grow the vertex stuff. */
+      weapon_nmallocs += 2;
       weapon_vboSize = mwfrontLayer + mwbacklayer;
       size = sizeof(GLfloat) * (2+4) * weapon_vboSize;
       weapon_vboData = realloc( weapon_vboData, size );
@@ -1693,18 +1852,23 @@ static void weapon_destroy( Weapon* w, WeaponLayer layer )
          return;
    }
 
-   for (i=0; (wlayer[i] != w) && (i < *nlayer); i++); /* get to the current position */
-   if (i >= *nlayer) {
+   /* Weapons know their position. */
+   i = w->idx;
+   if ((i < 0) || (i >= *nlayer) || (wlayer[i] != w)) {
       WARN("Trying to destroy weapon not found in stack!");
       return;
    }
 
-   weapon_free(wlayer[i]);
-   wlayer[i] = NULL;
+   weapon_free(w);
    (*nlayer)--;
+   weapon_spatialDirty[layer] = 1;
 
-   for ( ; i < (*nlayer); i++)
-      wlayer[i] = wlayer[i+1];
+   /* Swap the last weapon into the hole, order does not matter. */
+   if (i < *nlayer) {
+      wlayer[i] = wlayer[ *nlayer ];
+      wlayer[i]->idx = i;
+   }
+   wlayer[ *nlayer ] = NULL;
 }
 
 
@@ -1734,14 +1898,12 @@ static void weapon_free( Weapon* w )
             w->solid->vel.y);
    }
 
-   /* Free the solid. */
-   solid_free(w->solid);
-
 #ifdef DEBUGGING
    memset(w, 0, sizeof(Weapon));
 #endif /* DEBUGGING */
 
-   free(w);
+   /* Return to the pool, the solid goes with it. */
+   weapon_pool[ weapon_npool++ ] = w;
 }
 
 /**
@@ -1761,6 +1923,8 @@ void weapon_clear (void)
       weapon_free(wfrontLayer[i]);
    }
    nwfrontLayer = 0;
+   weapon_spatialDirty[0] = 1;
+   weapon_spatialDirty[1] = 1;
 }
 
 /**
@@ -1768,6 +1932,8 @@ void weapon_clear (void)
  */
 void weapon_exit (void)
 {
+   int i;
+
    weapon_clear();
 
    /* Destroy front layer. */
@@ -1784,6 +1950,29 @@ void weapon_exit (void)
       mwfrontLayer = 0;
    }
 
+   /* Destroy the weapon pool. */
+   for (i=0; i<weapon_nblocks; i++)
+      free( weapon_blocks[i] );
+   free( weapon_blocks );
+   weapon_blocks  = NULL;
+   weapon_nblocks = 0;
+   free( weapon_pool );
+   weapon_pool    = NULL;
+   weapon_npool   = 0;
+
+   /* Destroy batch update memory. */
+   free( weapon_solids );
+   weapon_solids  = NULL;
+   weapon_msolids = 0;
+
+   /* Destroy spatial indexes. */
+   for (i=0; i<2; i++) {
+      spatial_free( &weapon_spatial[i] );
+      free( weapon_spatialW[i] );
+      weapon_spatialW[i]  = NULL;
+      weapon_mspatialW[i] = 0;
+   }
+
    /* Destroy VBO. */
    if (weapon_vbo != NULL) {
       free( weapon_vboData );
@@ -1816,8 +2005,9 @@ static void weapon_explodeLayer( WeaponLayer layer,
       const Pilot *parent, int mode )
 {
    (void)parent;
-   int i;
-   Weapon **curLayer;
+   int i, n, mlist;
+   Weapon **curLayer, **wlist;
+   Weapon *w;
    int *nLayer;
    double dist, rad2;
 
@@ -1840,19 +2030,98 @@ static void weapon_explodeLayer( WeaponLayer layer,
    rad2 = radius*radius;
 
    /* Now try to destroy the weapons affected. */
-   for (i=0; i<*nLayer; i++) {
-      if (((mode & EXPL_MODE_MISSILE) && outfit_isAmmo(curLayer[i]->outfit)) ||
-            ((mode & EXPL_MODE_BOLT) && outfit_isBolt(curLayer[i]->outfit))) {
+   wlist = NULL;
+   mlist = 0;
+   n = weapon_getInRadius( layer, x, y, radius, &wlist, &mlist );
+   for (i=0; i<n; i++) {
+      w = wlist[i];
+
+      /* Might have been destroyed already. */
+      if ((w->idx >= *nLayer) || (curLayer[ w->idx ] != w))
+         continue;
 
-         dist = pow2(curLayer[i]->solid->pos.x - x) +
-               pow2(curLayer[i]->solid->pos.y - y);
+      if (((mode & EXPL_MODE_MISSILE) && outfit_isAmmo(w->outfit)) ||
+            ((mode & EXPL_MODE_BOLT) && outfit_isBolt(w->outfit))) {
 
-         if (dist < rad2) {
-            weapon_destroy(curLayer[i], layer);
-            i--;
-         }
+         dist = pow2(w->solid->pos.x - x) +
+               pow2(w->solid->pos.y - y);
+
+         if (dist < rad2)
+            weapon_destroy(w, layer);
+      }
+   }
+
+   free(wlist);
+}
+
+
+/**
+ * @brief Gets all the weapons of a layer within a circle.
+ *
+ * The spatial index backing this gets rebuilt lazily once per update or
+ *  whenever weapons are added or destroyed.
+ *
+ *    @param layer Layer to get weapons from.
+ *    @param x X position of the center of the circle.
+ *    @param y Y position of the center of the circle.
+ *    @param r Radius of the circle.
+ *    @param[in,out] weapons Buffer to fill with the weapons found, grown with
+ *           realloc as needed and owned by the caller.
+ *    @param[in,out] mweapons Memory allocated for the buffer.
+ *    @return Number of weapons found.
+ */
+static int weapon_getInRadius( WeaponLayer layer, double x, double y, double r,
+      Weapon ***weapons, int *mweapons )
+{
+   int i, n, nlayer;
+   Weapon **wlayer;
+   SpatialIndex *si;
+   const int *ids;
+
+   switch (layer) {
+      case WEAPON_LAYER_BG:
+         wlayer = wbackLayer;
+         nlayer = nwbackLayer;
+         break;
+      case WEAPON_LAYER_FG:
+         wlayer = wfrontLayer;
+         nlayer = nwfrontLayer;
+         break;
+
+      default:
+         WARN("Unknown weapon layer!");
+         return 0;
+   }
+   si = &weapon_spatial[layer];
+
+   /* Rebuild index if needed. */
+   if (weapon_spatialDirty[layer]) {
+      if (si->cell <= 0.)
+         spatial_init( si, WEAPON_SPATIAL_CELL );
+      if (nlayer > weapon_mspatialW[layer]) {
+         weapon_mspatialW[layer] = MAX( nlayer, 2*weapon_mspatialW[layer] );
+         weapon_spatialW[layer]  = realloc( weapon_spatialW[layer],
+               weapon_mspatialW[layer] * sizeof(Weapon*) );
+      }
+      spatial_clear( si );
+      for (i=0; i<nlayer; i++) {
+         weapon_spatialW[layer][i] = wlayer[i];
+         spatial_add( si, i, wlayer[i]->solid->pos.x, wlayer[i]->solid->pos.y, 0. );
       }
+      spatial_build( si );
+      weapon_spatialDirty[layer] = 0;
    }
+
+   /* Query. */
+   n = spatial_query( si, x, y, r, &ids );
+   if (n > *mweapons) {
+      *mweapons = MAX( n, 2*(*mweapons) );
+      *weapons  = realloc( *weapons, *mweapons * sizeof(Weapon*) );
+   }
+   for (i=0; i<n; i++)
+      (*weapons)[i] = weapon_spatialW[layer][ ids[i] ];
+
+   return n;
 }
 
 